@@ -11,11 +11,164 @@
 #include "main.h"
 #include <Melopero_RV3028.h>
 
+/** I2C address of the RV3028 */
+#define RTC_ADDRESS 0x52
+/** First time register (seconds), seconds to year are read in one burst */
+#define RTC_REG_SECONDS 0x00
+/** Number of time registers */
+#define RTC_TIME_REGS 7
+/** Dates before this year mean the RTC was never set */
+#define RTC_MIN_YEAR 2022
+
 /** Instance of the RTC class */
 Melopero_RV3028 rtc;
 
 date_time_s g_date_time;
 
+/** RV3028 registers and bits for the wake up */
+#define RTC_REG_ALARM_MIN 0x07
+#define RTC_REG_ALARM_HOUR 0x08
+#define RTC_REG_ALARM_DATE 0x09
+#define RTC_REG_TIMER0 0x0A
+#define RTC_REG_TIMER1 0x0B
+#define RTC_REG_STATUS 0x0E
+#define RTC_REG_CONTROL1 0x0F
+#define RTC_REG_CONTROL2 0x10
+#define RTC_STATUS_AF 0x04
+#define RTC_STATUS_TF 0x08
+#define RTC_CTRL1_TD 0x03
+#define RTC_CTRL1_TD_1HZ 0x02
+#define RTC_CTRL1_TD_1_60HZ 0x03
+#define RTC_CTRL1_TE 0x04
+#define RTC_CTRL1_WADA 0x20
+#define RTC_CTRL1_TRPT 0x80
+#define RTC_CTRL2_AIE 0x08
+#define RTC_CTRL2_TIE 0x10
+#define RTC_ALARM_DISABLE 0x80
+/** Max value of the 12 bit countdown timer */
+#define RTC_TIMER_MAX 4095
+/** Seconds between two synchronisations from the same time source */
+#define RTC_SYNC_INTERVAL 86400
+/** Seconds before a failed DeviceTimeReq is repeated */
+#define RTC_SYNC_RETRY 3600
+/** Max time to wait for a second tick in ms */
+#define RTC_TICK_TIMEOUT 1100
+
+/** Flag if the uplinks are aligned to the wall clock */
+bool g_rtc_align = false;
+
+/** WisBlock IO of the RTC interrupt, 0 = RTC wake up off */
+uint8_t g_rtc_wake_pin = 0;
+/** MCU clock vs. RTC in ppm, measured on the RTC wake ups */
+float g_rtc_drift_ppm = 0.0;
+
+/** WisBlock IO pins selectable for the interrupt, index = IO number, WB_IO2 is the 3V3_S supply */
+static const uint8_t rtc_wake_pins[] = {0, WB_IO1, 0, WB_IO3, WB_IO4, WB_IO5, WB_IO6};
+/** Attached interrupt pin, 0 = not attached */
+uint8_t rtc_wake_int_pin = 0;
+/** Low power mode setting before the RTC wake up was enabled */
+uint8_t rtc_wake_prev_lpm = 0;
+/** Programmed countdown interval in seconds, 0 = countdown not running */
+uint32_t rtc_wake_interval = 0;
+/** RTC time and millis() at the start of the drift measurement */
+uint32_t rtc_wake_ref_time = 0;
+time_t rtc_wake_ref_millis = 0;
+
+/** Time synchronisation status */
+rtc_sync_s g_rtc_sync = {0, 0, 0.0, 0, RTC_SYNC_NONE};
+/** millis() of the last DeviceTimeReq, 0 = none sent */
+time_t rtc_sync_req_time = 0;
+/** Time source waiting for rtc_sync_process(), RTC_SYNC_NONE = nothing pending */
+uint32_t rtc_pending_time = 0;
+uint16_t rtc_pending_ms = 0;
+time_t rtc_pending_stamp = 0;
+volatile uint8_t rtc_pending_source = RTC_SYNC_NONE;
+/** Flag that the network time was received and waits for rtc_sync_process() */
+volatile bool rtc_lorawan_pending = false;
+
+/**
+ * @brief Convert a BCD register value
+ *
+ * @param value BCD value
+ * @return uint8_t binary value
+ */
+static uint8_t rtc_bcd(uint8_t value)
+{
+	return (value >> 4) * 10 + (value & 0x0F);
+}
+
+/**
+ * @brief Convert a value to BCD for a register
+ *
+ * @param value binary value
+ * @return uint8_t BCD value
+ */
+static uint8_t rtc_to_bcd(uint8_t value)
+{
+	return ((value / 10) << 4) | (value % 10);
+}
+
+/**
+ * @brief Convert Unix time into date and time
+ *
+ * @param unix_time UTC seconds since 1970
+ * @param date_time pointer for the date and time, weekday 0 = Sunday
+ */
+static void rtc_unix_to_date(uint32_t unix_time, date_time_s *date_time)
+{
+	// Civil date from the days since 1970
+	uint32_t days = unix_time / 86400;
+	uint32_t day_seconds = unix_time % 86400;
+	uint32_t shifted = days + 719468;
+	uint32_t era = shifted / 146097;
+	uint32_t day_of_era = shifted - era * 146097;
+	uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	uint32_t month_index = (5 * day_of_year + 2) / 153;
+	uint8_t month = month_index < 10 ? month_index + 3 : month_index - 9;
+
+	date_time->year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+	date_time->month = month;
+	date_time->date = day_of_year - (153 * month_index + 2) / 5 + 1;
+	date_time->weekday = (days + 4) % 7;
+	date_time->hour = day_seconds / 3600;
+	date_time->minute = (day_seconds % 3600) / 60;
+	date_time->second = day_seconds % 60;
+}
+
+/**
+ * @brief Write the time registers in one I2C burst
+ *        Writing the seconds resets the prescaler of the RTC, the next tick is one second later
+ *
+ * @param unix_time UTC seconds since 1970
+ * @return true if the time was written
+ * @return false if the RTC did not respond
+ */
+static bool rtc_write_time(uint32_t unix_time)
+{
+	date_time_s new_time;
+	rtc_unix_to_date(unix_time, &new_time);
+
+	Wire.beginTransmission(RTC_ADDRESS);
+	Wire.write(RTC_REG_SECONDS);
+	Wire.write(rtc_to_bcd(new_time.second));
+	Wire.write(rtc_to_bcd(new_time.minute));
+	Wire.write(rtc_to_bcd(new_time.hour));
+	Wire.write(new_time.weekday);
+	Wire.write(rtc_to_bcd(new_time.date));
+	Wire.write(rtc_to_bcd(new_time.month));
+	Wire.write(rtc_to_bcd(new_time.year - 2000));
+	if (Wire.endTransmission() != 0)
+	{
+		MYLOG("RTC", "Write time failed");
+		return false;
+	}
+	g_date_time = new_time;
+	// The drift measurement of the wake ups starts again
+	rtc_wake_ref_time = 0;
+	return true;
+}
+
 /**
  * @brief Initialize the RTC
  *
@@ -34,16 +187,7 @@ bool init_rak12002(void)
 
 	rtc.set24HourMode(); // Set the device to use the 24hour format (default) instead of the 12 hour format
 
-	g_date_time.year = rtc.getYear();
-	g_date_time.month = rtc.getMonth();
-	g_date_time.weekday = rtc.getWeekday();
-	g_date_time.date = rtc.getDate();
-	g_date_time.hour = rtc.getHour();
-	g_date_time.minute = rtc.getMinute();
-	g_date_time.second = rtc.getSecond();
-
-	MYLOG("RTC", "%d.%02d.%02d %d:%02d:%02d", g_date_time.year, g_date_time.month, g_date_time.date, g_date_time.hour, g_date_time.minute, g_date_time.second);
-	return true;
+	return read_rak12002();
 }
 
 /**
@@ -57,27 +201,541 @@ bool init_rak12002(void)
  */
 void set_rak12002(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute)
 {
-	uint8_t weekday = (date + (uint16_t)((2.6 * month) - 0.2) - (2 * (year / 100)) + year + (uint16_t)(year / 4) + (uint16_t)(year / 400)) % 7;
-	// MYLOG("RTC", "Calculated weekday is %d", weekday);
-	rtc.setTime(year, month, weekday, date, hour, minute, 0);
+	if (rtc_write_time(date_to_unix(year, month, date, hour, minute, 0)))
+	{
+		// Manual time, the next automatic synchronisation replaces it
+		g_rtc_sync.last_time = 0;
+		g_rtc_sync.source = RTC_SYNC_MANUAL;
+	}
 }
 
 /**
  * @brief Update g_data_time structure with current the date
  *        and time from the RTC
+ *        All time registers are read in one I2C burst, the RTC
+ *        cannot roll over between the single values
  *
+ * @return true if the time was read
+ * @return false if the RTC did not respond
  */
-void read_rak12002(void)
+bool read_rak12002(void)
 {
-	g_date_time.year = rtc.getYear();
-	g_date_time.month = rtc.getMonth();
-	g_date_time.weekday = rtc.getWeekday();
-	g_date_time.date = rtc.getDate();
-	g_date_time.hour = rtc.getHour();
-	g_date_time.minute = rtc.getMinute();
-	g_date_time.second = rtc.getSecond();
+	uint8_t regs[RTC_TIME_REGS];
+
+	Wire.beginTransmission(RTC_ADDRESS);
+	Wire.write(RTC_REG_SECONDS);
+	if (Wire.endTransmission(false) != 0)
+	{
+		MYLOG("RTC", "No response");
+		return false;
+	}
+	if (Wire.requestFrom(RTC_ADDRESS, RTC_TIME_REGS) != RTC_TIME_REGS)
+	{
+		MYLOG("RTC", "Burst read failed");
+		return false;
+	}
+	for (uint8_t idx = 0; idx < RTC_TIME_REGS; idx++)
+	{
+		regs[idx] = Wire.read();
+	}
+
+	g_date_time.second = rtc_bcd(regs[0] & 0x7F);
+	g_date_time.minute = rtc_bcd(regs[1] & 0x7F);
+	g_date_time.hour = rtc_bcd(regs[2] & 0x3F);
+	g_date_time.weekday = regs[3] & 0x07;
+	g_date_time.date = rtc_bcd(regs[4] & 0x3F);
+	g_date_time.month = rtc_bcd(regs[5] & 0x1F);
+	g_date_time.year = 2000 + rtc_bcd(regs[6]);
 
 	MYLOG("RTC", "%d.%02d.%02d %d:%02d:%02d", g_date_time.year, g_date_time.month,
 		  g_date_time.date, g_date_time.hour,
 		  g_date_time.minute, g_date_time.second);
-}
\ No newline at end of file
+	return true;
+}
+
+/**
+ * @brief Get the time of the RTC as Unix time
+ *
+ * @return uint32_t UTC seconds since 1970, 0 if the RTC was never set or cannot be read
+ */
+uint32_t get_unix_rak12002(void)
+{
+	if (!read_rak12002() || (g_date_time.year < RTC_MIN_YEAR))
+	{
+		return 0;
+	}
+	return date_to_unix(g_date_time.year, g_date_time.month, g_date_time.date,
+						g_date_time.hour, g_date_time.minute, g_date_time.second);
+}
+
+/**
+ * @brief Add the time of the sample to the payload
+ *     Data is added to Cayenne LPP payload as channel
+ *     LPP_CHANNEL_TIME
+ *
+ */
+void rtc_add_payload(void)
+{
+	uint32_t unix_time = get_unix_rak12002();
+	if (unix_time == 0)
+	{
+		return;
+	}
+	g_solution_data.addUnixTime(LPP_CHANNEL_TIME, unix_time);
+}
+
+/**
+ * @brief Time until the next wall clock boundary
+ *        The boundaries are multiples of the send interval since midnight UTC,
+ *        e.g. :00, :15, :30, :45 for 15 minutes.
+ *        A call shortly before a boundary counts as the boundary, the next uplink is one interval later.
+ *
+ * @param unix_time current time
+ * @param interval send interval in seconds
+ * @return uint32_t seconds until the next boundary
+ */
+static uint32_t rtc_next_boundary(uint32_t unix_time, uint32_t interval)
+{
+	uint32_t remaining = interval - unix_time % interval;
+	if (remaining < interval / 4)
+	{
+		remaining += interval;
+	}
+	return remaining;
+}
+
+/**
+ * @brief Write to RTC register bits
+ *
+ * @param reg register
+ * @param mask bits to change
+ * @param value new value of the bits
+ */
+static void rtc_update_register(uint8_t reg, uint8_t mask, uint8_t value)
+{
+	rtc.writeToRegister(reg, (rtc.readFromRegister(reg) & ~mask) | (value & mask));
+}
+
+/**
+ * @brief Compare the MCU clock against the RTC on every RTC wake up
+ *        The RTC runs from its calibrated 32 kHz crystal, the difference
+ *        shows how much the software timers would drift
+ *
+ */
+static void rtc_wake_drift(void)
+{
+	if (!read_rak12002())
+	{
+		return;
+	}
+	uint32_t rtc_time = date_to_unix(g_date_time.year, g_date_time.month, g_date_time.date,
+									 g_date_time.hour, g_date_time.minute, g_date_time.second);
+	time_t now = millis();
+	if (rtc_wake_ref_time == 0)
+	{
+		rtc_wake_ref_time = rtc_time;
+		rtc_wake_ref_millis = now;
+		return;
+	}
+	int32_t rtc_elapsed = rtc_time - rtc_wake_ref_time;
+	if (rtc_elapsed <= 0)
+	{
+		// RTC was set, restart the measurement
+		rtc_wake_ref_time = rtc_time;
+		rtc_wake_ref_millis = now;
+		return;
+	}
+	g_rtc_drift_ppm = ((float)(now - rtc_wake_ref_millis) - rtc_elapsed * 1000.0f) / (rtc_elapsed * 1000.0f) * 1000000.0f;
+	MYLOG("RTC", "MCU clock vs. RTC %+.0f ppm over %lds", g_rtc_drift_ppm, rtc_elapsed);
+}
+
+/**
+ * @brief Called by the RTC interrupt
+ *        Clears the interrupt flags and starts the sensor reading and uplink
+ *
+ */
+static void rtc_wake_callback(void)
+{
+	rtc_update_register(RTC_REG_STATUS, RTC_STATUS_AF | RTC_STATUS_TF, 0x00);
+	rtc_wake_drift();
+	sensor_handler(NULL);
+}
+
+/**
+ * @brief Stop the RTC interrupts
+ *
+ */
+static void rtc_wake_stop(void)
+{
+	rtc_update_register(RTC_REG_CONTROL2, RTC_CTRL2_TIE | RTC_CTRL2_AIE, 0x00);
+	rtc_update_register(RTC_REG_CONTROL1, RTC_CTRL1_TE, 0x00);
+	rtc_update_register(RTC_REG_STATUS, RTC_STATUS_AF | RTC_STATUS_TF, 0x00);
+	rtc.writeToRegister(RTC_REG_ALARM_MIN, RTC_ALARM_DISABLE);
+	rtc.writeToRegister(RTC_REG_ALARM_HOUR, RTC_ALARM_DISABLE);
+	rtc.writeToRegister(RTC_REG_ALARM_DATE, RTC_ALARM_DISABLE);
+	rtc_wake_interval = 0;
+}
+
+/**
+ * @brief Program the periodic countdown timer of the RTC
+ *        Repeats by itself, the wake ups do not drift with the time needed for the uplinks.
+ *        1 Hz clock up to 4095 seconds, 1/60 Hz clock for longer intervals
+ *
+ * @param interval send interval in seconds
+ */
+static void rtc_wake_countdown(uint32_t interval)
+{
+	uint8_t clock = RTC_CTRL1_TD_1HZ;
+	uint32_t count = interval;
+	if (interval > RTC_TIMER_MAX)
+	{
+		clock = RTC_CTRL1_TD_1_60HZ;
+		count = (interval + 30) / 60;
+		count = count > RTC_TIMER_MAX ? RTC_TIMER_MAX : count;
+	}
+	rtc_wake_stop();
+	rtc.writeToRegister(RTC_REG_TIMER0, (uint8_t)(count & 0xFF));
+	rtc.writeToRegister(RTC_REG_TIMER1, (uint8_t)(count >> 8));
+	rtc_update_register(RTC_REG_CONTROL1, RTC_CTRL1_TRPT | RTC_CTRL1_TD, RTC_CTRL1_TRPT | clock);
+	rtc_update_register(RTC_REG_CONTROL2, RTC_CTRL2_TIE, RTC_CTRL2_TIE);
+	rtc_update_register(RTC_REG_CONTROL1, RTC_CTRL1_TE, RTC_CTRL1_TE);
+	rtc_wake_interval = interval;
+	MYLOG("RTC", "Countdown wake up every %ld %s", count, clock == RTC_CTRL1_TD_1HZ ? "s" : "min");
+}
+
+/**
+ * @brief Program the alarm of the RTC to the next wall clock boundary
+ *        Date, hour and minute must match, the boundary is on a full minute
+ *
+ * @param wake_time Unix time of the next boundary
+ */
+static void rtc_wake_alarm(uint32_t wake_time)
+{
+	date_time_s wake;
+	rtc_unix_to_date(wake_time, &wake);
+
+	rtc_wake_stop();
+	rtc_update_register(RTC_REG_CONTROL1, RTC_CTRL1_WADA, RTC_CTRL1_WADA);
+	rtc.writeToRegister(RTC_REG_ALARM_MIN, rtc_to_bcd(wake.minute));
+	rtc.writeToRegister(RTC_REG_ALARM_HOUR, rtc_to_bcd(wake.hour));
+	rtc.writeToRegister(RTC_REG_ALARM_DATE, rtc_to_bcd(wake.date));
+	rtc_update_register(RTC_REG_CONTROL2, RTC_CTRL2_AIE, RTC_CTRL2_AIE);
+	MYLOG("RTC", "Alarm wake up on day %d at %d:%02d", wake.date, wake.hour, wake.minute);
+}
+
+/**
+ * @brief Check if a WisBlock IO can be used for the RTC interrupt
+ *        The pin must not be used by an event sensor or a module
+ *
+ * @param io WisBlock IO number 1 to 6, 0 = RTC wake up off
+ * @return true if the pin is free
+ * @return false if the pin is not selectable or already used
+ */
+bool rtc_wake_pin_free(uint8_t io)
+{
+	if (io == 0)
+	{
+		return true;
+	}
+	if ((io >= sizeof(rtc_wake_pins)) || (rtc_wake_pins[io] == 0) || wb_io_used(rtc_wake_pins[io]))
+	{
+		return false;
+	}
+	for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+	{
+		if (g_event_thr[sensor].pin == io)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Restart the send interval timer, aligned to the wall clock or by the
+ *        RTC wake up if enabled, otherwise with the plain send interval
+ *
+ */
+void rtc_restart_uplink_timer(void)
+{
+	if (!rtc_schedule_uplink())
+	{
+		// Stop the timer
+		api.system.timer.stop(RAK_TIMER_0);
+		if (g_send_interval_time != 0)
+		{
+			// Restart the timer
+			api.system.timer.start(RAK_TIMER_0, g_send_interval_time, NULL);
+		}
+	}
+}
+
+/**
+ * @brief Attach or detach the RTC interrupt after the wake up setting changed
+ *        The wake up itself is programmed by rtc_schedule_uplink()
+ *
+ */
+void rtc_wake_setup(void)
+{
+	if (rtc_wake_int_pin != 0)
+	{
+		detachInterrupt(rtc_wake_int_pin);
+		// Software timers are used again, restore the previous low power mode
+		api.system.lpm.set(rtc_wake_prev_lpm);
+	}
+	rtc_wake_int_pin = 0;
+	if (found_sensors[RTC_ID].found_sensor)
+	{
+		rtc_wake_stop();
+	}
+	if (!found_sensors[RTC_ID].found_sensor || (g_rtc_wake_pin == 0) || (g_rtc_wake_pin >= sizeof(rtc_wake_pins)) ||
+		(rtc_wake_pins[g_rtc_wake_pin] == 0))
+	{
+		return;
+	}
+	rtc_wake_int_pin = rtc_wake_pins[g_rtc_wake_pin];
+	rtc_wake_ref_time = 0;
+	pinMode(rtc_wake_int_pin, INPUT_PULLUP);
+	attachInterrupt(rtc_wake_int_pin, rtc_wake_callback, FALLING);
+	// No software timer is pending, the MCU can stay in its lowest power mode between the wake ups
+	rtc_wake_prev_lpm = api.system.lpm.get();
+	api.system.lpm.set(1);
+	MYLOG("RTC", "RTC wake up on WB_IO%d", g_rtc_wake_pin);
+}
+
+/**
+ * @brief Restart the send interval timer or reprogram the RTC wake up.
+ *        With RTC wake up the RUI3 timer is stopped and the RV3028 interrupt wakes the node,
+ *        aligned uplinks use the alarm, otherwise the periodic countdown timer.
+ *        With alignment only the RUI3 timer is restarted so that the next uplink is on a wall clock
+ *        boundary. The boundaries are multiples of the send interval since midnight UTC,
+ *        e.g. :00, :15, :30, :45 for 15 minutes. Resolution is one second.
+ *
+ * @return true if the timer was restarted aligned or the RTC wakes up the node
+ * @return false if alignment and RTC wake up are off or no valid RTC time, the caller restarts the timer
+ */
+bool rtc_schedule_uplink(void)
+{
+	if (!found_sensors[RTC_ID].found_sensor)
+	{
+		return false;
+	}
+	if (g_send_interval_time < 1000)
+	{
+		if (rtc_wake_interval != 0)
+		{
+			rtc_wake_stop();
+		}
+		return false;
+	}
+	uint32_t interval = g_send_interval_time / 1000;
+
+	if (rtc_wake_int_pin != 0)
+	{
+		api.system.timer.stop(RAK_TIMER_0);
+		uint32_t unix_time = 0;
+		if (g_rtc_align && ((interval % 60) == 0))
+		{
+			unix_time = get_unix_rak12002();
+		}
+		if (unix_time != 0)
+		{
+			rtc_wake_alarm(unix_time + rtc_next_boundary(unix_time, interval));
+		}
+		else if (rtc_wake_interval != interval)
+		{
+			// The countdown repeats by itself, only restart it if the interval changed
+			rtc_wake_countdown(interval);
+		}
+		return true;
+	}
+
+	if (!g_rtc_align)
+	{
+		return false;
+	}
+	uint32_t unix_time = get_unix_rak12002();
+	if (unix_time == 0)
+	{
+		return false;
+	}
+	uint32_t remaining = rtc_next_boundary(unix_time, interval);
+	MYLOG("RTC", "Next aligned uplink in %lds", remaining);
+	api.system.timer.stop(RAK_TIMER_0);
+	api.system.timer.start(RAK_TIMER_0, remaining * 1000, NULL);
+	return true;
+}
+
+/**
+ * @brief Request to set the RTC from an external time source
+ *        Only stores the time, the RTC is set by rtc_sync_process() from the main loop
+ *        because the synchronisation blocks up to 2 seconds.
+ *        Runs once per RTC_SYNC_INTERVAL per time source, a better source synchronises immediately.
+ *
+ * @param unix_time UTC seconds since 1970 of the time source
+ * @param millisecond milliseconds of the time source
+ * @param stamp millis() when the time source had this time
+ * @param source RTC_SYNC_GNSS or RTC_SYNC_LORAWAN
+ * @return true if the synchronisation is scheduled
+ * @return false if no RTC, the time is invalid or no synchronisation needed
+ */
+bool rtc_sync(uint32_t unix_time, uint16_t millisecond, time_t stamp, uint8_t source)
+{
+	if (!found_sensors[RTC_ID].found_sensor || (date_to_unix(RTC_MIN_YEAR, 1, 1, 0, 0, 0) > unix_time))
+	{
+		return false;
+	}
+	uint32_t source_now = unix_time + (millis() - stamp + millisecond) / 1000;
+	if ((g_rtc_sync.last_time != 0) && (source >= g_rtc_sync.source) && (source_now - g_rtc_sync.last_time < RTC_SYNC_INTERVAL))
+	{
+		return false;
+	}
+	if ((rtc_pending_source != RTC_SYNC_NONE) && (source > rtc_pending_source))
+	{
+		// A better time source is already waiting
+		return false;
+	}
+	rtc_pending_time = unix_time;
+	rtc_pending_ms = millisecond;
+	rtc_pending_stamp = stamp;
+	rtc_pending_source = source;
+	return true;
+}
+
+/**
+ * @brief Get the network time at the change of its second
+ *        RUI3 keeps the network time with second resolution, the change of the second is
+ *        used as reference for a sub-second accurate time.
+ *        Blocks up to RTC_TICK_TIMEOUT, called from rtc_sync_process()
+ *
+ */
+static void rtc_lorawan_edge(void)
+{
+	int hour, minute, second, month, date, year;
+	int start_second = -1;
+	time_t start = millis();
+	while ((millis() - start) < RTC_TICK_TIMEOUT)
+	{
+		// Format is "LTIME:00h00m00s on 01/01/2000", the prefix is optional
+		String ltime = api.lorawan.ltime.get();
+		const char *time_str = strchr(ltime.c_str(), ':');
+		time_str = time_str != NULL ? time_str + 1 : ltime.c_str();
+		if (sscanf(time_str, "%dh%dm%ds on %d/%d/%d", &hour, &minute, &second, &month, &date, &year) != 6)
+		{
+			MYLOG("RTC", "Invalid network time %s", ltime.c_str());
+			return;
+		}
+		if ((start_second != -1) && (second != start_second))
+		{
+			rtc_sync(date_to_unix(year, month, date, hour, minute, second), 0, millis(), RTC_SYNC_LORAWAN);
+			return;
+		}
+		start_second = second;
+		delay(1);
+	}
+	MYLOG("RTC", "Network time not running");
+}
+
+/**
+ * @brief Set the RTC from the time source stored by rtc_sync()
+ *        The offset of the RTC is measured at its second tick with ms resolution,
+ *        then the new time is written at the next full second of the time source.
+ *        The offsets between two synchronisations give the drift of the RTC.
+ *        Blocks up to 3 seconds, call it only from the main loop.
+ *
+ */
+void rtc_sync_process(void)
+{
+	if (rtc_lorawan_pending)
+	{
+		rtc_lorawan_pending = false;
+		rtc_lorawan_edge();
+	}
+	if (rtc_pending_source == RTC_SYNC_NONE)
+	{
+		return;
+	}
+	uint32_t unix_time = rtc_pending_time;
+	uint16_t millisecond = rtc_pending_ms;
+	time_t stamp = rtc_pending_stamp;
+	uint8_t source = rtc_pending_source;
+	rtc_pending_source = RTC_SYNC_NONE;
+	uint32_t source_now = unix_time + (millis() - stamp + millisecond) / 1000;
+
+	// Wait for the second tick of the RTC to get its offset with ms resolution
+	uint8_t start_second = rtc.readFromRegister(RTC_REG_SECONDS);
+	time_t tick = millis();
+	while ((rtc.readFromRegister(RTC_REG_SECONDS) == start_second) && ((millis() - tick) < RTC_TICK_TIMEOUT))
+	{
+		delay(1);
+	}
+	tick = millis();
+	bool rtc_valid = get_unix_rak12002() != 0;
+	uint32_t rtc_time = date_to_unix(g_date_time.year, g_date_time.month, g_date_time.date,
+									 g_date_time.hour, g_date_time.minute, g_date_time.second);
+	uint32_t source_ms = tick - stamp + millisecond;
+	int32_t offset_ms = (int32_t)(rtc_time - (unix_time + source_ms / 1000)) * 1000 - (int32_t)(source_ms % 1000);
+
+	// Set the RTC at the next full second of the time source
+	source_ms = millis() - stamp + millisecond;
+	delay(1000 - source_ms % 1000);
+	if (!rtc_write_time(unix_time + source_ms / 1000 + 1))
+	{
+		return;
+	}
+
+	if (rtc_valid && (g_rtc_sync.last_time != 0))
+	{
+		g_rtc_sync.drift_ppm = offset_ms * 1000.0f / (float)(source_now - g_rtc_sync.last_time);
+	}
+	g_rtc_sync.offset_ms = rtc_valid ? offset_ms : 0;
+	g_rtc_sync.last_time = unix_time + source_ms / 1000 + 1;
+	g_rtc_sync.count++;
+	g_rtc_sync.source = source;
+	MYLOG("RTC", "Synced from %s, offset %+ld ms, drift %+.2f ppm", source == RTC_SYNC_GNSS ? "GNSS" : "LoRaWAN",
+		  g_rtc_sync.offset_ms, g_rtc_sync.drift_ppm);
+
+	// A time jump moves the wall clock boundaries
+	if (!rtc_valid || (abs(offset_ms) > 1000))
+	{
+		rtc_restart_uplink_timer();
+	}
+}
+
+/**
+ * @brief Request the network time with the next uplink if the RTC was not synchronised recently
+ *        GNSS trackers usually get the time from the fixes before a request is due
+ *
+ */
+void rtc_sync_request(void)
+{
+	if (!found_sensors[RTC_ID].found_sensor)
+	{
+		return;
+	}
+	if ((g_rtc_sync.last_time != 0) && (get_unix_rak12002() - g_rtc_sync.last_time < RTC_SYNC_INTERVAL))
+	{
+		return;
+	}
+	if ((rtc_sync_req_time != 0) && ((millis() - rtc_sync_req_time) < RTC_SYNC_RETRY * 1000))
+	{
+		return;
+	}
+	MYLOG("RTC", "Request network time");
+	rtc_sync_req_time = millis();
+	api.lorawan.timereq.set(1);
+}
+
+/**
+ * @brief Network time was received after a DeviceTimeReq, called from the LoRaWAN callback
+ *        Only records it, the network time is read and the RTC set by rtc_sync_process() from the main loop
+ *
+ */
+void rtc_sync_lorawan(void)
+{
+	if (!found_sensors[RTC_ID].found_sensor)
+	{
+		return;
+	}
+	rtc_lorawan_pending = true;
+}
@@ -69,5 +69,7 @@ void read_rak12003(void)
 
 	g_solution_data.addTemperature(LPP_CHANNEL_TEMP_3, sensor_temp);
 	g_solution_data.addTemperature(LPP_CHANNEL_TEMP_4, object_temp);
+	// Die temperature of the sensor is the best guess for the ambient temperature
+	sensor_cache_set(CACHE_TEMP, sensor_temp, FIR_ID, QUALITY_RAK12003);
 }
 
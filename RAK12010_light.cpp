@@ -2,6 +2,7 @@
  * @file RAK12010_light.cpp
  * @author Bernd Giesecke (bernd@giesecke.tk)
  * @brief Initialize and read values from the VEML7700 sensor
+ *        Gain and integration time are auto ranged
  * @version 0.1
  * @date 2022-04-11
  *
@@ -14,6 +15,35 @@
 /** Light sensor instance */
 Light_VEML7700 VEML = Light_VEML7700();
 
+/** Ranges of the VEML7700, resolution 0.0036 lux/count at gain 2 and 800 ms */
+static const light_step_s veml_steps[] = {
+	{VEML7700_GAIN_1_8, VEML7700_IT_25MS, 25, 65535, 1.8432},
+	{VEML7700_GAIN_1_4, VEML7700_IT_25MS, 25, 65535, 0.9216},
+	{VEML7700_GAIN_1, VEML7700_IT_25MS, 25, 65535, 0.2304},
+	{VEML7700_GAIN_2, VEML7700_IT_25MS, 25, 65535, 0.1152},
+	{VEML7700_GAIN_2, VEML7700_IT_50MS, 50, 65535, 0.0576},
+	{VEML7700_GAIN_2, VEML7700_IT_100MS, 100, 65535, 0.0288},
+	{VEML7700_GAIN_2, VEML7700_IT_200MS, 200, 65535, 0.0144},
+	{VEML7700_GAIN_2, VEML7700_IT_400MS, 400, 65535, 0.0072},
+	{VEML7700_GAIN_2, VEML7700_IT_800MS, 800, 65535, 0.0036}};
+
+/** Auto ranging status, starts in the middle */
+light_range_s veml_range = {veml_steps, sizeof(veml_steps) / sizeof(light_step_s), 4, 1000, 0, 0, 0};
+
+/** Max range changes per reading */
+#define VEML_MAX_TRIES 4
+
+/**
+ * @brief Write the current range to the sensor
+ *
+ */
+static void veml_set_range(void)
+{
+	VEML.setGain(veml_steps[veml_range.step].gain);
+	VEML.setIntegrationTime(veml_steps[veml_range.step].integration);
+	veml_range.changed = millis();
+}
+
 /**
  * @brief Initialize light sensor
  *
@@ -29,8 +59,7 @@ bool init_rak12010(void)
 		return false;
 	}
 	MYLOG("VEML", "Found VEML7700");
-	VEML.setGain(VEML7700_GAIN_1_8);
-	VEML.setIntegrationTime(VEML7700_IT_25MS);
+	veml_set_range();
 
 	// VEML.powerSaveEnable(true);
 	// VEML.setPowerSaveMode(VEML7700_POWERSAVE_MODE4);
@@ -45,12 +74,28 @@ bool init_rak12010(void)
  */
 void read_rak12010(void)
 {
-	float light_lux = VEML.readLux();
-#if MY_DEBUG > 0
-	float light_white = VEML.readWhite();
-	float light_als = VEML.readALS();
-	MYLOG("VEML", "L: %.2fLux W: %.2f ALS: %.2f", light_lux, light_white, light_als);
-#endif
+	uint16_t light_als = 0;
+	uint8_t used_step = veml_range.step;
+	for (uint8_t tries = 0; tries < VEML_MAX_TRIES; tries++)
+	{
+		light_range_wait(&veml_range);
+		light_als = VEML.readALS();
+		used_step = veml_range.step;
+		if (!light_range_check(&veml_range, light_als))
+		{
+			break;
+		}
+		veml_set_range();
+	}
+
+	float light_lux = light_als * veml_steps[used_step].scale;
+	// Non linearity correction from the VEML7700 application note
+	if (light_lux > 1000.0)
+	{
+		light_lux = (((6.0135e-13 * light_lux - 9.3924e-9) * light_lux + 8.1488e-5) * light_lux + 1.0023) * light_lux;
+	}
+	MYLOG("VEML", "L: %.2fLux ALS: %d range %d, saturated %d underflow %d", light_lux, light_als, used_step,
+		  veml_range.saturated, veml_range.underflow);
 
 	g_solution_data.addLuminosity(LPP_CHANNEL_LIGHT2, light_lux);
 }
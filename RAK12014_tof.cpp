@@ -11,6 +11,9 @@
 #include "main.h"
 #include <VL53L0X.h>
 
+// Forward declarations
+bool rak12014_setup(void);
+
 /** Instance of sensor class */
 VL53L0X tof_sensor;
 
@@ -27,6 +30,22 @@ analog_s analog_val;
 // Power pin for RAK12014
 uint8_t xshut_pin = WB_IO4;
 
+/** Timing budget per reading in ms, set with ATC+TOFBUDGET */
+uint16_t g_tof_budget = TOF_BUDGET_DEFAULT;
+
+/** Max number of readings per measurement */
+#define TOF_MAX_READINGS 30
+/** Max number of readings used for the estimate */
+#define TOF_MAX_SAMPLES 20
+/** Min number of readings before outliers are gated and the estimate is checked */
+#define TOF_MIN_SAMPLES 5
+/** Readings more than TOF_GATE_MAD * MAD away from the median are outliers */
+#define TOF_GATE_MAD 4
+/** Min outlier gate in mm */
+#define TOF_GATE_MIN 15
+/** Stop when the standard error of the estimate is below this value in mm */
+#define TOF_CONVERGED_MM 2
+
 /**
  * @brief Initialize the VL53L01 sensor
  *
@@ -50,7 +69,7 @@ bool init_rak12014(void)
 	}
 
 	tof_sensor.setTimeout(500);
-	if (!tof_sensor.init())
+	if (!rak12014_setup())
 	{
 		MYLOG("ToF", "Failed to detect and initialize sensor!");
 		// Sensor off
@@ -60,13 +79,6 @@ bool init_rak12014(void)
 		return false;
 	}
 
-	// Set to long range
-	// lower the return signal rate limit (default is 0.25 MCPS)
-	tof_sensor.setSignalRateLimit(0.1);
-	// increase laser pulse periods (defaults are 14 and 10 PCLKs)
-	tof_sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
-	tof_sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
-
 	// Sensor off
 	digitalWrite(xshut_pin, LOW);
 
@@ -74,87 +86,197 @@ bool init_rak12014(void)
 }
 
 /**
- * @brief Read ToF data from VL53L01
- *     Data is added to Cayenne LPP payload as channels
- *     LPP_CHANNEL_TOF
+ * @brief Configure the sensor for long range
+ *     Settings are lost when the sensor is switched off with XSHUT,
+ *     so this is required after each power up
  *
+ * @return true if the sensor is ready
+ * @return false if the sensor didn't respond
  */
-void read_rak12014(void)
+bool rak12014_setup(void)
 {
-	// Sensor on
-	digitalWrite(xshut_pin, HIGH);
-	delay(300);
-
+	if (!tof_sensor.init())
+	{
+		return false;
+	}
 	// Set to long range
 	// lower the return signal rate limit (default is 0.25 MCPS)
 	tof_sensor.setSignalRateLimit(0.1);
 	// increase laser pulse periods (defaults are 14 and 10 PCLKs)
 	tof_sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
 	tof_sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
+	// Longer budget gives less noise per reading
+	tof_sensor.setMeasurementTimingBudget(g_tof_budget * 1000UL);
+	return true;
+}
 
-	uint64_t collected = 0;
-	bool got_valid_data = false;
+/**
+ * @brief Insert a reading into the sorted sample array
+ *
+ * @param samples sorted samples
+ * @param num_samples number of samples in the array
+ * @param value new reading
+ */
+static void tof_insert(uint16_t *samples, uint8_t num_samples, uint16_t value)
+{
+	uint8_t idx = num_samples;
+	while ((idx > 0) && (samples[idx - 1] > value))
+	{
+		samples[idx] = samples[idx - 1];
+		idx--;
+	}
+	samples[idx] = value;
+}
 
-	// uint64_t single_reading = (uint64_t)tof_sensor.readRangeContinuousMillimeters();
-	uint64_t single_reading = (uint64_t)tof_sensor.readRangeSingleMillimeters();
-	if (tof_sensor.timeoutOccurred() || (single_reading == 65535))
+/**
+ * @brief Median absolute deviation of the sorted samples
+ *
+ * @param samples sorted samples
+ * @param num_samples number of samples
+ * @param median median of the samples
+ * @return uint16_t MAD in mm
+ */
+static uint16_t tof_mad(uint16_t *samples, uint8_t num_samples, uint16_t median)
+{
+	uint16_t deviation[TOF_MAX_SAMPLES];
+	for (uint8_t idx = 0; idx < num_samples; idx++)
 	{
-		collected = analog_val.analog16;
-		MYLOG("ToF", "Timeout");
+		uint16_t dev = samples[idx] > median ? samples[idx] - median : median - samples[idx];
+		tof_insert(deviation, idx, dev);
 	}
-	else
+	return deviation[num_samples / 2];
+}
+
+/**
+ * @brief Trimmed mean of the sorted samples, lowest and highest quarter are dropped
+ *
+ * @param samples sorted samples
+ * @param num_samples number of samples
+ * @return uint16_t trimmed mean in mm
+ */
+static uint16_t tof_trimmed_mean(uint16_t *samples, uint8_t num_samples)
+{
+	uint8_t trim = num_samples / 4;
+	uint32_t sum = 0;
+	for (uint8_t idx = trim; idx < num_samples - trim; idx++)
 	{
-		// We are measuring against water surface, sometimes waves or reflections can give too high values
-		// The tank is only 1200mm deep, so any value above should be discarded
-		if (single_reading < 1100)
-		{
-			collected = single_reading;
-			// We got at least one measurement
-			got_valid_data = true;
-		}
-		else
-		{
-			collected = analog_val.analog16;
-			// We got at least one measurement
-			got_valid_data = true;
-			MYLOG("ToF", "Measured > 1100mm");
-		}
+		sum += samples[idx];
+	}
+	return (sum + (num_samples - 2 * trim) / 2) / (num_samples - 2 * trim);
+}
+
+/**
+ * @brief Measure the distance with the VL53L01
+ *     Back-to-back ranging in continuous mode, the readings go into
+ *     a trimmed mean estimator with outlier gating. Ranging stops as
+ *     soon as the estimate is stable.
+ *
+ * @param distance pointer for the distance in mm
+ * @return true if a valid distance was measured
+ * @return false if the sensor didn't respond or all readings were rejected
+ */
+bool rak12014_measure(uint16_t *distance)
+{
+	// Sensor on
+	digitalWrite(xshut_pin, HIGH);
+	// Boot time of the VL53L0X is 1.2 ms
+	delay(2);
+
+	if (!rak12014_setup())
+	{
+		MYLOG("ToF", "Sensor not responding");
+		digitalWrite(xshut_pin, LOW);
+		return false;
 	}
-	delay(100);
 
-	for (int reading = 0; reading < 10; reading++)
+	uint16_t samples[TOF_MAX_SAMPLES];
+	uint8_t num_samples = 0;
+	uint8_t num_rejected = 0;
+	uint8_t num_readings = 0;
+	uint16_t median = 0;
+	uint16_t mad = 0;
+
+	time_t start = millis();
+	tof_sensor.startContinuous(0);
+	for (num_readings = 0; num_readings < TOF_MAX_READINGS; num_readings++)
 	{
-		single_reading = (uint64_t)tof_sensor.readRangeSingleMillimeters();
+		uint16_t single_reading = tof_sensor.readRangeContinuousMillimeters();
 		if (tof_sensor.timeoutOccurred() || (single_reading == 65535))
 		{
 			MYLOG("ToF", "Timeout");
+			continue;
+		}
+
+		// We are measuring against water surface, sometimes waves or reflections can give too high values
+		// Any value above the tank depth (ATC+TANK) should be discarded
+		if (single_reading >= g_tank.depth)
+		{
+			num_rejected++;
+			continue;
 		}
-		else
+
+		// Outlier gating against the running median
+		if (num_samples >= TOF_MIN_SAMPLES)
 		{
-			// We are measuring against water surface, sometimes waves or reflections can give too high values
-			// The tank is only 1100mm deep, so any value above should be discarded
-			if (single_reading < 1100)
+			uint16_t gate = mad * TOF_GATE_MAD < TOF_GATE_MIN ? TOF_GATE_MIN : mad * TOF_GATE_MAD;
+			uint16_t deviation = single_reading > median ? single_reading - median : median - single_reading;
+			if (deviation > gate)
 			{
-				collected += single_reading;
-				collected = collected / 2;
-				// We got at least one measurement
-				got_valid_data = true;
+				num_rejected++;
+				continue;
 			}
 		}
-		delay(100);
+
+		tof_insert(samples, num_samples, single_reading);
+		num_samples++;
+		median = samples[num_samples / 2];
+		mad = tof_mad(samples, num_samples, median);
+
+		if (num_samples >= TOF_MAX_SAMPLES)
+		{
+			break;
+		}
+		// Standard error of the estimate, sigma ~ 1.4826 * MAD
+		if ((num_samples >= TOF_MIN_SAMPLES) && ((mad * 1483UL) / 1000 <= TOF_CONVERGED_MM * (uint32_t)sqrtf(num_samples)))
+		{
+			break;
+		}
 	}
+	tof_sensor.stopContinuous();
 
-	// If we failed to get a valid reading, we set it to the last measured value
-	if (!got_valid_data)
+	// Sensor off
+	digitalWrite(xshut_pin, LOW);
+
+	MYLOG("ToF", "%d readings, %d used, %d rejected, MAD %d mm, %ld ms", num_readings, num_samples, num_rejected, mad, millis() - start);
+	if (num_samples == 0)
 	{
-		collected = analog_val.analog16;
+		return false;
 	}
+	*distance = tof_trimmed_mean(samples, num_samples);
+	return true;
+}
+
+/**
+ * @brief Read ToF data from VL53L01
+ *     Data is added to Cayenne LPP payload as channels
+ *     LPP_CHANNEL_TOF
+ *
+ */
+void read_rak12014(void)
+{
+	uint16_t collected = analog_val.analog16;
+	bool got_valid_data = rak12014_measure(&collected);
+	if (got_valid_data)
+	{
+		analog_val.analog16 = collected;
+	}
+	// If we failed to get a valid reading, we use the last measured value
 
-	MYLOG("ToF", "Water level %d mm", 1100 - (uint16_t)collected);
 	g_solution_data.addAnalogInput(LPP_CHANNEL_TOF, (float)(collected));
 	g_solution_data.addPresence(LPP_CHANNEL_TOF_VALID, got_valid_data);
-
-	// Sensor off
-	digitalWrite(xshut_pin, LOW);
+	if (got_valid_data)
+	{
+		tank_add_payload(collected);
+	}
 	return;
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
  * @file RAK12019_uv.cpp
  * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
  * @brief Functions for RAK12019 UV light sensor
+ *        Gain and resolution are auto ranged
  * @version 0.1
  * @date 2022-02-20
  *
@@ -14,6 +15,74 @@
 /** Light sensor instance using Wire*/
 UVlight_LTR390 ltr = UVlight_LTR390();
 
+/** UVS counts per UVI at gain 18 and 20 bit resolution (400 ms) */
+#define LTR_UV_SENSITIVITY 2300.0
+
+/** Ranges of the LTR390, UVI per count, max 100 ms conversion time */
+static const light_step_s ltr_steps[] = {
+	{LTR390_GAIN_1, LTR390_RESOLUTION_16BIT, 25, 65535, 0.125217},
+	{LTR390_GAIN_3, LTR390_RESOLUTION_16BIT, 25, 65535, 0.041739},
+	{LTR390_GAIN_9, LTR390_RESOLUTION_16BIT, 25, 65535, 0.013913},
+	{LTR390_GAIN_18, LTR390_RESOLUTION_16BIT, 25, 65535, 0.0069565},
+	{LTR390_GAIN_18, LTR390_RESOLUTION_17BIT, 50, 131071, 0.0034783},
+	{LTR390_GAIN_18, LTR390_RESOLUTION_18BIT, 100, 262143, 0.0017391}};
+
+/** Auto ranging status, starts with the most sensitive range */
+light_range_s ltr_range = {ltr_steps, sizeof(ltr_steps) / sizeof(light_step_s), 5, 100, 0, 0, 0};
+
+/** Max range changes per reading */
+#define LTR_MAX_TRIES 4
+/** Max UVS count of the threshold registers */
+#define LTR_MAX_THRESHOLD 0xFFFFF
+/** I2C address of the LTR390 */
+#define LTR_ADDRESS 0x53
+/** MEAS_RATE register, bits 6:4 resolution, bits 2:0 measurement rate */
+#define LTR_REG_MEAS_RATE 0x04
+
+/** Interrupt pin in event mode, 0 = not attached */
+uint8_t rak12019_int_pin = 0;
+
+/**
+ * @brief Set the measurement rate to the conversion time of the range
+ *        The driver only sets the resolution, with the default rate of 100 ms
+ *        the 16 bit ranges have no new data after the wait of light_range_wait()
+ *
+ * @param time_ms conversion time in ms
+ */
+static void ltr_set_meas_rate(uint16_t time_ms)
+{
+	// Measurement rate 0 = 25 ms, 1 = 50 ms, 2 = 100 ms
+	uint8_t rate = time_ms <= 25 ? 0 : (time_ms <= 50 ? 1 : 2);
+	Wire.beginTransmission(LTR_ADDRESS);
+	Wire.write(LTR_REG_MEAS_RATE);
+	if (Wire.endTransmission(false) != 0)
+	{
+		return;
+	}
+	if (Wire.requestFrom((uint8_t)LTR_ADDRESS, (uint8_t)1) != 1)
+	{
+		return;
+	}
+	uint8_t meas_rate = (Wire.read() & 0xF8) | rate;
+	Wire.beginTransmission(LTR_ADDRESS);
+	Wire.write(LTR_REG_MEAS_RATE);
+	Wire.write(meas_rate);
+	Wire.endTransmission();
+}
+
+/**
+ * @brief Write the current range to the sensor
+ *        Measurement rate and conversion time are the same, light_range_wait() covers both
+ *
+ */
+static void ltr_set_range(void)
+{
+	ltr.setGain((ltr390_gain_t)ltr_steps[ltr_range.step].gain);
+	ltr.setResolution((ltr390_resolution_t)ltr_steps[ltr_range.step].integration);
+	ltr_set_meas_rate(ltr_steps[ltr_range.step].time_ms);
+	ltr_range.changed = millis();
+}
+
 /**
  * @brief Initialize UV light sensor
  *
@@ -41,28 +110,75 @@ bool init_rak12019(void)
 		MYLOG("LTR", "In UVS mode");
 	}
 
-	// Set gain level
-	ltr.setGain(LTR390_GAIN_18);
+	// Set gain level and resolution
+	ltr_set_range();
+
+	// Threshold interrupt is only used in event mode
+	ltr.configInterrupt(false, LTR390_MODE_UVS);
+	return true;
+}
+
+/**
+ * @brief Program the UVS thresholds for the current UV level and clear the interrupt
+ *        Thresholds are in counts of the current range
+ *
+ * @param uvi current UV index
+ */
+static void rak12019_event_arm(float uvi)
+{
+	float low;
+	float high;
+	event_window(EVENT_UV, uvi, &low, &high);
+	float scale = ltr_steps[ltr_range.step].scale;
+	uint32_t low_counts = low <= 0.0 ? 0 : (uint32_t)(low / scale);
+	uint32_t high_counts = high / scale >= LTR_MAX_THRESHOLD ? LTR_MAX_THRESHOLD : (uint32_t)(high / scale);
+	ltr.setThresholds(low_counts, high_counts);
+	// Reading the status clears the interrupt
+	ltr.newDataAvailable();
+}
 
-	// Set resolution
-	ltr.setResolution(LTR390_RESOLUTION_20BIT);
+/**
+ * @brief UV threshold interrupt
+ *
+ */
+static void int_callback_rak12019(void)
+{
+	if (!event_trigger(EVENT_UV))
+	{
+		// No uplink, arm for the current level
+		rak12019_event_arm(ltr.readUVS() * ltr_steps[ltr_range.step].scale);
+	}
+}
 
-	ltr.setThresholds(100, 1000); // Set the interrupt output threshold range for lower and upper.
-	if (ltr.getMode() == LTR390_MODE_ALS)
+/**
+ * @brief Enable or disable the event mode after the thresholds changed
+ *        The INT pin of the LTR390 is active low
+ *
+ */
+void rak12019_event_setup(void)
+{
+	if (rak12019_int_pin != 0)
 	{
-		ltr.configInterrupt(true, LTR390_MODE_ALS); // Configure the interrupt based on the thresholds in setThresholds()
+		detachInterrupt(rak12019_int_pin);
 	}
-	else
+	rak12019_int_pin = event_pin(EVENT_UV);
+	if (rak12019_int_pin == 0)
 	{
-		ltr.configInterrupt(true, LTR390_MODE_UVS);
+		ltr.configInterrupt(false, LTR390_MODE_UVS);
+		return;
 	}
-	return true;
+	rak12019_event_arm(ltr.readUVS() * ltr_steps[ltr_range.step].scale);
+	ltr.configInterrupt(true, LTR390_MODE_UVS);
+	pinMode(rak12019_int_pin, INPUT_PULLUP);
+	attachInterrupt(rak12019_int_pin, int_callback_rak12019, FALLING);
+	MYLOG("LTR", "Event mode on WB_IO%d", g_event_thr[EVENT_UV].pin);
 }
 
 /**
  * @brief Read value from UV light sensor
  *     Data is added to Cayenne LPP payload as channel
  *     LPP_CHANNEL_UVI, LPP_CHANNEL_UVS
+ *     UVS is scaled to counts at gain 18 and 20 bit resolution, independent of the range
  *
  */
 void read_rak12019(void)
@@ -70,22 +186,30 @@ void read_rak12019(void)
 	float _uvi_read = 0.0;
 	uint32_t _uvs_read = 0;
 
-	if (ltr.newDataAvailable())
+	for (uint8_t tries = 0; tries < LTR_MAX_TRIES; tries++)
 	{
-		if (ltr.getMode() == LTR390_MODE_ALS)
+		light_range_wait(&ltr_range);
+		if (!ltr.newDataAvailable())
 		{
-			MYLOG("LTR", "Lux Data:%0.2f-----Als Data:%ld", ltr.getLUX(), ltr.readALS()); // calculate the lux
+			MYLOG("LTR", "No Data available");
+			break;
 		}
-		else
+		uint32_t counts = ltr.readUVS();
+		uint8_t used_step = ltr_range.step;
+		_uvi_read = counts * ltr_steps[used_step].scale;
+		_uvs_read = (uint32_t)(_uvi_read * LTR_UV_SENSITIVITY);
+		MYLOG("LTR", "Uvi Data:%0.2f-----Uvs Data:%ld counts %ld range %d", _uvi_read, _uvs_read, counts, used_step);
+		if (!light_range_check(&ltr_range, counts))
 		{
-			_uvi_read = ltr.getUVI();
-			_uvs_read = ltr.readUVS();
-			MYLOG("LTR", "Uvi Data:%0.2f-----Uvs Data:%ld", _uvi_read, _uvs_read);
+			break;
 		}
+		ltr_set_range();
 	}
-	else
+	MYLOG("LTR", "Saturated %d underflow %d", ltr_range.saturated, ltr_range.underflow);
+
+	if (rak12019_int_pin != 0)
 	{
-		MYLOG("LTR", "No Data available");
+		rak12019_event_arm(_uvi_read);
 	}
 
 	g_solution_data.addAnalogInput(LPP_CHANNEL_UVI, _uvi_read);
@@ -14,6 +14,23 @@
 /** Sensor instance */
 SCD30 scd30;
 
+/** Measurement interval limits of the SCD30 in seconds */
+#define SCD30_MIN_INTERVAL 2
+#define SCD30_MAX_INTERVAL 1800
+/** Measurement interval if the send interval is off */
+#define SCD30_DEFAULT_INTERVAL 60
+
+/** Measurement interval in ms */
+uint32_t scd30_interval = SCD30_DEFAULT_INTERVAL * 1000;
+/** Time when the next measurement is ready */
+time_t scd30_next_ready = 0;
+/** Last values */
+uint16_t scd30_co2 = 0;
+float scd30_temp = 0.0;
+float scd30_humid = 0.0;
+/** Flag if the last values are valid */
+bool scd30_valid = false;
+
 /**
  * @brief Initialize MQ2 gas sensor
  *
@@ -35,49 +52,93 @@ bool init_rak12037(void)
 	}
 
 	//**************init SCD30 sensor *****************************************************
-	// Change number of seconds between measurements: 2 to 1800 (30 minutes), stored in non-volatile memory of SCD30
-	scd30.setMeasurementInterval(10000);
+	// Measurement interval follows the send interval, it is set with rak12037_set_interval()
+	// after the send interval was read from flash
 
 	// Enable self calibration
 	scd30.setAutoSelfCalibration(true);
 
 	// Start the measurements
 	scd30.beginMeasuring();
+	scd30_next_ready = millis() + scd30_interval;
 
 	return true;
 }
 
+/**
+ * @brief Set the measurement interval from the send interval
+ *        Two measurements per send interval, so the value used
+ *        for an uplink is never older than half the send interval
+ *        The interval is stored in the non-volatile memory of the SCD30,
+ *        it is only written if it changed
+ */
+void rak12037_set_interval(void)
+{
+	uint32_t interval_s = g_send_interval_time / 2000;
+	if (interval_s == 0)
+	{
+		interval_s = SCD30_DEFAULT_INTERVAL;
+	}
+	if (interval_s < SCD30_MIN_INTERVAL)
+	{
+		interval_s = SCD30_MIN_INTERVAL;
+	}
+	if (interval_s > SCD30_MAX_INTERVAL)
+	{
+		interval_s = SCD30_MAX_INTERVAL;
+	}
+
+	uint16_t current_interval = 0;
+	if (!scd30.getMeasurementInterval(&current_interval) || (current_interval != interval_s))
+	{
+		// Change number of seconds between measurements: 2 to 1800 (30 minutes), stored in non-volatile memory of SCD30
+		scd30.setMeasurementInterval(interval_s);
+		scd30_next_ready = millis() + interval_s * 1000;
+	}
+	scd30_interval = interval_s * 1000;
+	MYLOG("SCD30", "Measurement interval %ld s", interval_s);
+}
+
 /**
  * @brief Read CO2 sensor data
+ *     The sensor is only read when a new measurement is due,
+ *     otherwise the last values are used, there is no waiting
  *     Data is added to Cayenne LPP payload as channels
  *     LPP_CHANNEL_CO2_2, LPP_CHANNEL_CO2_Temp_2 and LPP_CHANNEL_CO2_HUMID_2
  *
  */
 void read_rak12037(void)
 {
-	time_t start_time = millis();
-	while (!scd30.dataAvailable())
+	if ((int32_t)(millis() - scd30_next_ready) >= 0)
 	{
-		MYLOG("SCD30", "Waiting for data");
-		delay(500);
-		if ((millis() - start_time) > 5000)
+		if (scd30.dataAvailable())
 		{
-			// timeout, no data available
-			MYLOG("SCD30", "Timeout");
-			return;
+			scd30_co2 = scd30.getCO2();
+			scd30_temp = scd30.getTemperature();
+			scd30_humid = scd30.getHumidity();
+			scd30_valid = true;
+			// Next measurement is ready one interval after this one
+			scd30_next_ready = millis() + scd30_interval;
+			sensor_cache_set(CACHE_TEMP, scd30_temp, CO2_ID, QUALITY_RAK12037);
+			sensor_cache_set(CACHE_HUMID, scd30_humid, CO2_ID, QUALITY_RAK12037);
+		}
+		else
+		{
+			MYLOG("SCD30", "No data yet, using last values");
 		}
 	}
 
-	uint16_t co2_reading = scd30.getCO2();
-	float temp_reading = scd30.getTemperature();
-	float humid_reading = scd30.getHumidity();
+	if (!scd30_valid)
+	{
+		MYLOG("SCD30", "No valid values");
+		return;
+	}
 
-	MYLOG("SCD30", "CO2 level %dppm", co2_reading);
-	MYLOG("SCD30", "Temperature %.2f", temp_reading);
-	MYLOG("SCD30", "Humidity %.2f", humid_reading);
+	MYLOG("SCD30", "CO2 level %dppm", scd30_co2);
+	MYLOG("SCD30", "Temperature %.2f", scd30_temp);
+	MYLOG("SCD30", "Humidity %.2f", scd30_humid);
 
-	g_solution_data.addConcentration(LPP_CHANNEL_CO2_2, co2_reading);
-	g_solution_data.addTemperature(LPP_CHANNEL_CO2_Temp_2, temp_reading);
-	g_solution_data.addRelativeHumidity(LPP_CHANNEL_CO2_HUMID_2, humid_reading);
+	g_solution_data.addConcentration(LPP_CHANNEL_CO2_2, scd30_co2);
+	g_solution_data.addTemperature(LPP_CHANNEL_CO2_Temp_2, scd30_temp);
+	g_solution_data.addRelativeHumidity(LPP_CHANNEL_CO2_HUMID_2, scd30_humid);
 }
-
@@ -2,11 +2,12 @@
  * @file RAK12040_temp_arr.cpp
  * @author Bernd Giesecke (bernd@giesecke.tk)
  * @brief Initialization and sensor read function for RAK12040 IR array
+ *        Background model, hotspot detection and occupancy counting
  * @version 0.1
  * @date 2022-04-12
- * 
+ *
  * @copyright Copyright (c) 2022
- * 
+ *
  */
 #include "main.h"
 #include <Melopero_AMG8833.h>
@@ -14,18 +15,52 @@
 /** Sensor instance */
 Melopero_AMG8833 amg8833;
 
-/** HOT value (in degrees C) to adjust the contrast */
-#define HOT 30.0
-/** COLD value (in degrees C) to adjust the contrast */
-#define COLD 25.0
+/** Size of the frame */
+#define THERMAL_SIZE 8
+/** Number of frames processed per reading */
+#define THERMAL_FRAMES 5
+/** Number of frames for the first background, the median removes moving persons */
+#define THERMAL_SEED_FRAMES 5
+/** Time between two frames in ms, sensor runs with 10 FPS */
+#define THERMAL_FRAME_TIME 100
+/** Pixels warmer than the background by this value (in degrees C) are foreground */
+#define THERMAL_DELTA 1.5
+/** Background update rate for background pixels */
+#define THERMAL_ALPHA_BG 0.1
+/** Background update rate for foreground pixels, absorbs objects that do not move */
+#define THERMAL_ALPHA_FG 0.005
+/** Min number of pixels of a hotspot to count as a person */
+#define THERMAL_MIN_PIXELS 2
 
-/**
- * @brief This table can be of type int because we map the pixel
- * temperature to 0-3. Temperatures are reported by the
- * library as floats
- *
- */
-int pixelTable[64];
+/** Interrupt registers of the AMG8833 */
+#define AMG_REG_INTC 0x03
+#define AMG_REG_SCLR 0x05
+#define AMG_REG_INTHL 0x08
+#define AMG_REG_INTLL 0x0A
+#define AMG_REG_IHYSL 0x0C
+/** INTC absolute value mode and interrupt enable */
+#define AMG_INT_ABSOLUTE 0x03
+/** SCLR clear the interrupt flag */
+#define AMG_CLEAR_INT 0x02
+/** Lowest interrupt level, 12 bit two's complement */
+#define AMG_MIN_LEVEL 0x800
+
+/** Interrupt pin in event mode, 0 = not attached */
+uint8_t rak12040_int_pin = 0;
+
+/** Background model in degrees C, [row][column] */
+float thermal_background[THERMAL_SIZE][THERMAL_SIZE];
+/** Flag if the background model is initialized */
+bool thermal_has_background = false;
+/** Hotspot label of each pixel, 0 = background */
+uint8_t thermal_labels[THERMAL_SIZE][THERMAL_SIZE];
+
+/** Results of the last reading */
+uint8_t thermal_count = 0;
+float thermal_max_temp = 0.0;
+uint8_t thermal_max_pixel = 0;
+/** Processing time of the last frame in us */
+uint32_t thermal_frame_time = 0;
 
 /**
  * @brief Initialize the AMG8833 sensor
@@ -42,59 +77,318 @@ bool init_rak12040(void)
 	MYLOG("IR_ARR", "Reset result %s", amg8833.getErrorDescription(amg8833.resetFlagsAndSettings()).c_str());
 	MYLOG("IR_ARR", "Setting FPS result %s", amg8833.getErrorDescription(amg8833.setFPSMode(FPS_MODE::FPS_10)).c_str());
 
+	thermal_has_background = false;
 	return true;
 }
 
 /**
- * @brief Read and display measured values
+ * @brief Write a register pair of the AMG8833, low byte first
  *
+ * @param reg first register
+ * @param value 12 bit value
+ * @return true if written
+ * @return false if I2C error
  */
-void read_rak12040()
+static bool amg_write_level(uint8_t reg, uint16_t value)
 {
-	MYLOG("IR_ARR", "Updating thermistor temperature result %s", amg8833.getErrorDescription(amg8833.updateThermistorTemperature()).c_str());
-	MYLOG("IR_ARR", "Updating pixel matrix result %s", amg8833.getErrorDescription(amg8833.updatePixelMatrix()).c_str());
+	Wire.beginTransmission(AMG8833_I2C_ADDRESS_A);
+	Wire.write(reg);
+	Wire.write((uint8_t)(value & 0xFF));
+	Wire.write((uint8_t)((value >> 8) & 0x0F));
+	return Wire.endTransmission() == 0;
+}
 
-	// loop through all 64 pixels on the device and map each float value to a number
-	// between 0 and 3 using the HOT and COLD values we set at the top of the sketch
-	for (int x = 0; x < 8; x++)
+/**
+ * @brief Write a single register of the AMG8833
+ *
+ * @param reg register
+ * @param value register value
+ * @return true if written
+ * @return false if I2C error
+ */
+static bool amg_write_register(uint8_t reg, uint8_t value)
+{
+	Wire.beginTransmission(AMG8833_I2C_ADDRESS_A);
+	Wire.write(reg);
+	Wire.write(value);
+	return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Program the pixel interrupt for the current max temperature and clear the interrupt
+ *        The AMG8833 compares each pixel, only the upper level is used.
+ *        While the alarm is active the interrupt is off, the return to normal is reported by the next reading
+ *
+ * @param max_temp current max pixel temperature
+ */
+static void rak12040_event_arm(float max_temp)
+{
+	float low;
+	float high;
+	event_window(EVENT_IR, max_temp, &low, &high);
+	if (high >= EVENT_NO_HIGH)
+	{
+		amg_write_register(AMG_REG_INTC, 0x00);
+	}
+	else
+	{
+		int16_t level = (int16_t)(high * 4.0);
+		amg_write_level(AMG_REG_INTHL, (uint16_t)level & 0x0FFF);
+		amg_write_level(AMG_REG_INTLL, AMG_MIN_LEVEL);
+		amg_write_level(AMG_REG_IHYSL, 0);
+		amg_write_register(AMG_REG_INTC, AMG_INT_ABSOLUTE);
+	}
+	amg_write_register(AMG_REG_SCLR, AMG_CLEAR_INT);
+}
+
+/**
+ * @brief Max pixel temperature of the current frame
+ *
+ * @return float max temperature in degrees C
+ */
+static float rak12040_max_pixel(void)
+{
+	float max_temp = -100.0;
+	amg8833.updatePixelMatrix();
+	for (uint8_t row = 0; row < THERMAL_SIZE; row++)
 	{
-		for (int y = 0; y < 8; y++)
+		for (uint8_t col = 0; col < THERMAL_SIZE; col++)
 		{
-			pixelTable[x + y] = map(amg8833.pixelMatrix[y][x], COLD, HOT, 0, 3);
-			Serial.print(amg8833.pixelMatrix[y][x]);
-			Serial.print(" ");
+			if (amg8833.pixelMatrix[row][col] > max_temp)
+			{
+				max_temp = amg8833.pixelMatrix[row][col];
+			}
 		}
-		Serial.println();
 	}
-	Serial.println();
+	return max_temp;
+}
+
+/**
+ * @brief Pixel temperature interrupt
+ *
+ */
+static void int_callback_rak12040(void)
+{
+	if (!event_trigger(EVENT_IR))
+	{
+		// No uplink, arm for the current temperature
+		rak12040_event_arm(rak12040_max_pixel());
+	}
+}
+
+/**
+ * @brief Enable or disable the event mode after the thresholds changed
+ *        The INT pin of the AMG8833 is active low
+ *
+ */
+void rak12040_event_setup(void)
+{
+	if (rak12040_int_pin != 0)
+	{
+		detachInterrupt(rak12040_int_pin);
+	}
+	rak12040_int_pin = event_pin(EVENT_IR);
+	if (rak12040_int_pin == 0)
+	{
+		amg_write_register(AMG_REG_INTC, 0x00);
+		return;
+	}
+	rak12040_event_arm(rak12040_max_pixel());
+	pinMode(rak12040_int_pin, INPUT_PULLUP);
+	attachInterrupt(rak12040_int_pin, int_callback_rak12040, FALLING);
+	MYLOG("IR_ARR", "Event mode on WB_IO%d", g_event_thr[EVENT_IR].pin);
+}
+
+/**
+ * @brief Label the connected foreground pixels (4-neighbourhood)
+ *
+ * @param foreground foreground flags of the frame
+ * @return uint8_t number of hotspots with at least THERMAL_MIN_PIXELS pixels
+ */
+static uint8_t thermal_label(bool foreground[THERMAL_SIZE][THERMAL_SIZE])
+{
+	uint8_t stack[THERMAL_SIZE * THERMAL_SIZE];
+	uint8_t num_labels = 0;
+	uint8_t num_hotspots = 0;
 
-	// loop through the table of mapped values and print a character corresponding to each
-	// pixel's temperature. Add a space between each. Start a new line every 8 in order to
-	// create an 8x8 grid
-	for (int x = 0; x < 8; x++)
+	memset(thermal_labels, 0, sizeof(thermal_labels));
+	for (uint8_t start = 0; start < THERMAL_SIZE * THERMAL_SIZE; start++)
 	{
-		for (int y = 0; y < 8; y++)
+		if (!foreground[start / THERMAL_SIZE][start % THERMAL_SIZE] || (thermal_labels[start / THERMAL_SIZE][start % THERMAL_SIZE] != 0))
 		{
-		if (pixelTable[x+y] == 0)
+			continue;
+		}
+
+		// Flood fill a new hotspot
+		num_labels++;
+		uint8_t num_pixels = 0;
+		uint8_t stack_size = 0;
+		stack[stack_size++] = start;
+		thermal_labels[start / THERMAL_SIZE][start % THERMAL_SIZE] = num_labels;
+		while (stack_size != 0)
 		{
-			Serial.print(".");
+			uint8_t pixel = stack[--stack_size];
+			int8_t row = pixel / THERMAL_SIZE;
+			int8_t col = pixel % THERMAL_SIZE;
+			num_pixels++;
+
+			const int8_t neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+			for (uint8_t idx = 0; idx < 4; idx++)
+			{
+				int8_t n_row = row + neighbours[idx][0];
+				int8_t n_col = col + neighbours[idx][1];
+				if ((n_row < 0) || (n_row >= THERMAL_SIZE) || (n_col < 0) || (n_col >= THERMAL_SIZE))
+				{
+					continue;
+				}
+				if (foreground[n_row][n_col] && (thermal_labels[n_row][n_col] == 0))
+				{
+					thermal_labels[n_row][n_col] = num_labels;
+					stack[stack_size++] = n_row * THERMAL_SIZE + n_col;
+				}
+			}
 		}
-		else if (pixelTable[x+y] == 1)
+		if (num_pixels >= THERMAL_MIN_PIXELS)
 		{
-			Serial.print("o");
+			num_hotspots++;
 		}
-		else if (pixelTable[x+y] == 2)
+	}
+	return num_hotspots;
+}
+
+/**
+ * @brief Initialize the background model with the median of several frames
+ *        A person walking through the view during the first reading
+ *        is only in some frames and does not end up in the background
+ *
+ */
+static void thermal_seed_background(void)
+{
+	// Pixels in 0.01 degrees C, sorted per pixel while the frames come in
+	int16_t seed[THERMAL_SIZE * THERMAL_SIZE][THERMAL_SEED_FRAMES];
+	for (uint8_t frame = 0; frame < THERMAL_SEED_FRAMES; frame++)
+	{
+		if (frame != 0)
 		{
-			Serial.print("0");
+			delay(THERMAL_FRAME_TIME);
 		}
-		else if (pixelTable[x+y] == 3)
+		amg8833.updatePixelMatrix();
+		for (uint8_t pixel = 0; pixel < THERMAL_SIZE * THERMAL_SIZE; pixel++)
 		{
-			Serial.print("O");
+			int16_t value = (int16_t)(amg8833.pixelMatrix[pixel / THERMAL_SIZE][pixel % THERMAL_SIZE] * 100.0);
+			uint8_t idx = frame;
+			while ((idx > 0) && (seed[pixel][idx - 1] > value))
+			{
+				seed[pixel][idx] = seed[pixel][idx - 1];
+				idx--;
+			}
+			seed[pixel][idx] = value;
 		}
-		Serial.print(" ");
+	}
+	for (uint8_t pixel = 0; pixel < THERMAL_SIZE * THERMAL_SIZE; pixel++)
+	{
+		thermal_background[pixel / THERMAL_SIZE][pixel % THERMAL_SIZE] = seed[pixel][THERMAL_SEED_FRAMES / 2] / 100.0;
+	}
+	thermal_has_background = true;
+	MYLOG("IR_ARR", "Background from the median of %d frames", THERMAL_SEED_FRAMES);
+}
+
+/**
+ * @brief Process one frame of the sensor
+ *        Background subtraction, hotspot labelling and background update
+ *
+ * @return uint8_t number of hotspots in the frame
+ */
+static uint8_t thermal_process_frame(void)
+{
+	time_t start = micros();
+
+	bool foreground[THERMAL_SIZE][THERMAL_SIZE];
+	for (uint8_t row = 0; row < THERMAL_SIZE; row++)
+	{
+		for (uint8_t col = 0; col < THERMAL_SIZE; col++)
+		{
+			float pixel = amg8833.pixelMatrix[row][col];
+			foreground[row][col] = (pixel - thermal_background[row][col]) > THERMAL_DELTA;
+			if (pixel > thermal_max_temp)
+			{
+				thermal_max_temp = pixel;
+				thermal_max_pixel = row * THERMAL_SIZE + col;
+			}
+			// Exponential running background, foreground pixels adapt much slower
+			float alpha = foreground[row][col] ? THERMAL_ALPHA_FG : THERMAL_ALPHA_BG;
+			thermal_background[row][col] += alpha * (pixel - thermal_background[row][col]);
 		}
-		Serial.println();
 	}
-	Serial.println();
+
+	uint8_t num_hotspots = thermal_label(foreground);
+
+	thermal_frame_time = micros() - start;
+	return num_hotspots;
 }
 
+/**
+ * @brief Read frames and add the occupancy results to the payload
+ *     Data is added to Cayenne LPP payload as channels
+ *     LPP_CHANNEL_IR_COUNT, LPP_CHANNEL_IR_MAX_TEMP,
+ *     LPP_CHANNEL_IR_MAX_PIXEL and LPP_CHANNEL_IR_BACKGROUND
+ *
+ */
+void read_rak12040()
+{
+	amg8833.updateThermistorTemperature();
+
+	if (!thermal_has_background)
+	{
+		thermal_seed_background();
+		delay(THERMAL_FRAME_TIME);
+	}
+
+	thermal_count = 0;
+	thermal_max_temp = -100.0;
+	thermal_max_pixel = 0;
+	for (uint8_t frame = 0; frame < THERMAL_FRAMES; frame++)
+	{
+		if (frame != 0)
+		{
+			delay(THERMAL_FRAME_TIME);
+		}
+		amg8833.updatePixelMatrix();
+		uint8_t num_hotspots = thermal_process_frame();
+		// Highest count of all frames, persons can be hidden behind each other in single frames
+		if (num_hotspots > thermal_count)
+		{
+			thermal_count = num_hotspots;
+		}
+	}
+
+	float background_mean = 0.0;
+	for (uint8_t row = 0; row < THERMAL_SIZE; row++)
+	{
+		for (uint8_t col = 0; col < THERMAL_SIZE; col++)
+		{
+			background_mean += thermal_background[row][col];
+		}
+	}
+	background_mean /= THERMAL_SIZE * THERMAL_SIZE;
+
+	MYLOG("IR_ARR", "Thermistor %.2f'C background %.2f'C", amg8833.thermistorTemperature, background_mean);
+	MYLOG("IR_ARR", "%d hotspots, max %.2f'C at %d/%d, %ld us per frame", thermal_count, thermal_max_temp,
+		  thermal_max_pixel / THERMAL_SIZE, thermal_max_pixel % THERMAL_SIZE, thermal_frame_time);
+
+	g_solution_data.addDigitalInput(LPP_CHANNEL_IR_COUNT, thermal_count);
+	g_solution_data.addTemperature(LPP_CHANNEL_IR_MAX_TEMP, thermal_max_temp);
+	g_solution_data.addDigitalInput(LPP_CHANNEL_IR_MAX_PIXEL, thermal_max_pixel);
+	g_solution_data.addTemperature(LPP_CHANNEL_IR_BACKGROUND, background_mean);
+
+	if (rak12040_int_pin != 0)
+	{
+		rak12040_event_arm(thermal_max_temp);
+	}
+
+	// Full frame is sent in fragments after the sensor uplink
+	if (thermal_frame_due())
+	{
+		thermal_encode_frame(amg8833.pixelMatrix);
+	}
+}
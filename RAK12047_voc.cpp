@@ -146,18 +146,13 @@ void do_read_rak12047(void *)
 	uint16_t srawVoc = 0;
 	uint16_t defaultRh = 0x8000;
 	uint16_t defaultT = 0x6666;
-	float rak1901_values[2] = {0.0};
 
-	if (found_sensors[TEMP_ID].found_sensor)
+	// Compensate with the latest values of any humidity and temperature sensor, no extra reading
+	if (sensor_cache_get(CACHE_TEMP, &temperature) && sensor_cache_get(CACHE_HUMID, &humidity))
 	{
-		get_rak1901_values(rak1901_values);
 		// MYLOG("VOC", "Rh: %.2f T: %.2f", humidity, temperature);
-
-		if ((temperature != 0.0) && (temperature != 0.0))
-		{
-			defaultRh = (uint16_t)(humidity * 65535 / 100);
-			defaultT = (uint16_t)((temperature + 45) * 65535 / 175);
-		}
+		defaultRh = (uint16_t)(humidity * 65535 / 100);
+		defaultT = (uint16_t)((temperature + 45) * 65535 / 175);
 	}
 
 	// 2. Measure SGP4x signals
@@ -14,13 +14,6 @@
 /** Sensor instance */
 rak1901 shtc3;
 
-/** Last temperature read */
-float _last_temp = 0;
-/** Last humidity read */
-float _last_humid = 0;
-/** Flag if values were read already (used by RAK12047 VOC sensor) */
-bool _has_last_values = false;
-
 /**
  * @brief Initialize the temperature and humidity sensor
  *
@@ -55,31 +48,6 @@ void read_rak1901(void)
 
 	g_solution_data.addRelativeHumidity(LPP_CHANNEL_HUMID, humid_f);
 	g_solution_data.addTemperature(LPP_CHANNEL_TEMP, temp_f);
-	_last_temp = temp_f;
-	_last_humid = humid_f;
-	_has_last_values = true;
-}
-
-/**
- * @brief Returns the latest values from the sensor
- *        or starts a new reading
- *
- * @param values array for temperature [0] and humidity [1]
- */
-void get_rak1901_values(float *values)
-{
-	if (_has_last_values)
-	{
-		_has_last_values = false;
-		values[0] = _last_temp;
-		values[1] = _last_humid;
-		return;
-	}
-	else
-	{
-		shtc3.update();
-		values[0] = shtc3.temperature();
-		values[1] = shtc3.humidity();
-	}
-	return;
+	sensor_cache_set(CACHE_TEMP, temp_f, TEMP_ID, QUALITY_RAK1901);
+	sensor_cache_set(CACHE_HUMID, humid_f, TEMP_ID, QUALITY_RAK1901);
 }
@@ -14,6 +14,146 @@
 /** Sensor instance */
 LPS35HW lps;
 
+// LPS22HB registers
+#define LPS22HB_CTRL_REG1 0x10
+#define LPS22HB_CTRL_REG2 0x11
+#define LPS22HB_FIFO_CTRL 0x14
+#define LPS22HB_RES_CONF 0x1A
+#define LPS22HB_FIFO_STATUS 0x26
+#define LPS22HB_STATUS 0x27
+#define LPS22HB_PRESS_OUT_XL 0x28
+
+/** CTRL_REG1 ODR 1 Hz, low pass filter ODR/20, block data update */
+#define LPS22HB_CTRL1_1HZ 0x1E
+/** CTRL_REG1 power down (one shot), low pass filter ODR/20, block data update */
+#define LPS22HB_CTRL1_ONE_SHOT 0x0E
+/** CTRL_REG2 FIFO enable, register auto increment */
+#define LPS22HB_CTRL2_FIFO 0x50
+/** CTRL_REG2 register auto increment */
+#define LPS22HB_CTRL2_DEFAULT 0x10
+/** CTRL_REG2 start one shot conversion */
+#define LPS22HB_ONE_SHOT 0x01
+/** FIFO_CTRL stream mode */
+#define LPS22HB_FIFO_STREAM 0x40
+/** FIFO_CTRL bypass mode */
+#define LPS22HB_FIFO_BYPASS 0x00
+
+/** Number of samples read in one burst, 5 bytes per sample */
+#define LPS22HB_BURST_SAMPLES 6
+/** Max time for a one shot conversion in ms */
+#define LPS22HB_ONE_SHOT_TIMEOUT 100
+
+/** Time between two samples of the pressure history in ms (10 minutes) */
+#define PRESS_HIST_INTERVAL 600000
+/** Number of history samples, covers 3 hours */
+#define PRESS_HIST_SIZE 19
+/** Minimum history span for the trend in ms (1 hour) */
+#define PRESS_HIST_MIN_SPAN 3600000
+
+/** Pressure sensor mode, 0 = one shot, 1 = continuous 1 Hz with FIFO */
+uint8_t g_press_mode = PRESS_ONE_SHOT;
+
+/** Last pressure in hPa */
+float rak1902_pressure = 0.0;
+/** Pressure trend over the last 1 to 3 hours in hPa/h */
+float rak1902_trend = 0.0;
+
+/** Pressure history for the trend, time stamps in ms */
+time_t press_hist_time[PRESS_HIST_SIZE];
+float press_hist_value[PRESS_HIST_SIZE];
+uint8_t press_hist_num = 0;
+uint8_t press_hist_idx = 0;
+
+/**
+ * @brief Write a LPS22HB register
+ *
+ * @param chip_reg register address
+ * @param data value to write
+ * @return true write success
+ * @return false write failed
+ */
+static bool rak1902_writeRegister(uint8_t chip_reg, uint8_t data)
+{
+	Wire.beginTransmission(found_sensors[PRESS_ID].i2c_addr);
+	Wire.write(chip_reg);
+	Wire.write(data);
+	return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Read a block of LPS22HB registers
+ *     With FIFO enabled, reading from PRESS_OUT_XL rolls over
+ *     after TEMP_OUT_H, so several samples can be read in one go
+ *
+ * @param buffer buffer for the data
+ * @param chip_reg start register address
+ * @param len number of bytes to read
+ * @return true read success
+ * @return false read failed
+ */
+static bool rak1902_readBlock(uint8_t *buffer, uint8_t chip_reg, uint8_t len)
+{
+	Wire.beginTransmission(found_sensors[PRESS_ID].i2c_addr);
+	Wire.write(chip_reg);
+	if (Wire.endTransmission() != 0)
+	{
+		return false;
+	}
+	if (Wire.requestFrom(found_sensors[PRESS_ID].i2c_addr, len) != len)
+	{
+		return false;
+	}
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		buffer[idx] = Wire.read();
+	}
+	return true;
+}
+
+/**
+ * @brief Convert the raw pressure of a sample to hPa
+ *
+ * @param raw 5 bytes sample, pressure XL, L, H, temperature L, H
+ * @return float pressure in hPa
+ */
+static float rak1902_convert(uint8_t *raw)
+{
+	int32_t value = (int32_t)((uint32_t)raw[2] << 24 | (uint32_t)raw[1] << 16 | (uint32_t)raw[0] << 8) >> 8;
+	return value / 4096.0;
+}
+
+/**
+ * @brief Set the pressure sensor mode
+ *
+ * @param mode PRESS_ONE_SHOT or PRESS_CONTINUOUS
+ * @return true if the sensor was configured
+ * @return false if the sensor didn't respond
+ */
+bool rak1902_set_mode(uint8_t mode)
+{
+	bool result = true;
+	if (mode == PRESS_CONTINUOUS)
+	{
+		// Low current mode, FIFO in stream mode keeps the last 32 samples
+		result &= rak1902_writeRegister(LPS22HB_RES_CONF, 0x01);
+		result &= rak1902_writeRegister(LPS22HB_FIFO_CTRL, LPS22HB_FIFO_STREAM);
+		result &= rak1902_writeRegister(LPS22HB_CTRL_REG2, LPS22HB_CTRL2_FIFO);
+		result &= rak1902_writeRegister(LPS22HB_CTRL_REG1, LPS22HB_CTRL1_1HZ);
+	}
+	else
+	{
+		result &= rak1902_writeRegister(LPS22HB_CTRL_REG1, LPS22HB_CTRL1_ONE_SHOT);
+		result &= rak1902_writeRegister(LPS22HB_FIFO_CTRL, LPS22HB_FIFO_BYPASS);
+		result &= rak1902_writeRegister(LPS22HB_CTRL_REG2, LPS22HB_CTRL2_DEFAULT);
+		result &= rak1902_writeRegister(LPS22HB_RES_CONF, 0x01);
+	}
+	if (result)
+	{
+		g_press_mode = mode;
+	}
+	return result;
+}
+
 /**
  * @brief Initialize barometric pressure sensor
  *
@@ -29,57 +169,185 @@ bool init_rak1902(void)
 		return false;
 	}
 
-	lps.setLowPower(true);
-	lps.setOutputRate(LPS35HW::OutputRate_OneShot);	   // get results on demand
-	lps.setLowPassFilter(LPS35HW::LowPassFilter_ODR9); // default is off
+	return rak1902_set_mode(g_press_mode);
+}
+
+/**
+ * @brief One shot conversion, polls the status register until the result is ready
+ *
+ * @return true if a new pressure value was read
+ * @return false if the conversion timed out
+ */
+static bool rak1902_one_shot(void)
+{
+	if (!rak1902_writeRegister(LPS22HB_CTRL_REG2, LPS22HB_CTRL2_DEFAULT | LPS22HB_ONE_SHOT))
+	{
+		return false;
+	}
+	time_t start = millis();
+	uint8_t status = 0;
+	while ((millis() - start) < LPS22HB_ONE_SHOT_TIMEOUT)
+	{
+		if (rak1902_readBlock(&status, LPS22HB_STATUS, 1) && (status & 0x01))
+		{
+			uint8_t raw[5];
+			if (!rak1902_readBlock(raw, LPS22HB_PRESS_OUT_XL, 5))
+			{
+				return false;
+			}
+			rak1902_pressure = rak1902_convert(raw);
+			MYLOG("PRESS", "One shot ready after %ld ms", millis() - start);
+			return true;
+		}
+	}
+	MYLOG("PRESS", "One shot timeout");
+	return false;
+}
+
+/**
+ * @brief Read all samples from the FIFO
+ *     Calculates the average of the window
+ *
+ * @return true if samples were read
+ * @return false if the FIFO was empty or the read failed
+ */
+static bool rak1902_read_fifo(void)
+{
+	uint8_t fifo_status = 0;
+	if (!rak1902_readBlock(&fifo_status, LPS22HB_FIFO_STATUS, 1))
+	{
+		return false;
+	}
+	uint8_t num_samples = fifo_status & 0x3F;
+	if (num_samples == 0)
+	{
+		return false;
+	}
+
+	float sum_p = 0.0;
+	uint8_t read_samples = 0;
+	uint8_t raw[LPS22HB_BURST_SAMPLES * 5];
+	while (read_samples < num_samples)
+	{
+		uint8_t burst = num_samples - read_samples;
+		if (burst > LPS22HB_BURST_SAMPLES)
+		{
+			burst = LPS22HB_BURST_SAMPLES;
+		}
+		if (!rak1902_readBlock(raw, LPS22HB_PRESS_OUT_XL, burst * 5))
+		{
+			break;
+		}
+		for (uint8_t idx = 0; idx < burst; idx++)
+		{
+			float pressure = rak1902_convert(&raw[idx * 5]);
+			sum_p += pressure;
+			read_samples++;
+		}
+	}
+	if (read_samples == 0)
+	{
+		return false;
+	}
+
+	rak1902_pressure = sum_p / read_samples;
+	MYLOG("PRESS", "%d samples from FIFO", read_samples);
 	return true;
 }
 
+/**
+ * @brief Add the current pressure to the history and calculate the trend
+ *     A new sample is stored every PRESS_HIST_INTERVAL, the trend is the
+ *     difference to the oldest sample of the last 3 hours
+ *
+ * @return true if the history covers at least 1 hour
+ * @return false if the history is too short for a trend
+ */
+static bool rak1902_history(void)
+{
+	time_t now = millis();
+	uint8_t last = (press_hist_idx + PRESS_HIST_SIZE - 1) % PRESS_HIST_SIZE;
+	if ((press_hist_num == 0) || ((now - press_hist_time[last]) >= PRESS_HIST_INTERVAL))
+	{
+		press_hist_time[press_hist_idx] = now;
+		press_hist_value[press_hist_idx] = rak1902_pressure;
+		press_hist_idx = (press_hist_idx + 1) % PRESS_HIST_SIZE;
+		if (press_hist_num < PRESS_HIST_SIZE)
+		{
+			press_hist_num++;
+		}
+	}
+
+	uint8_t oldest = (press_hist_idx + PRESS_HIST_SIZE - press_hist_num) % PRESS_HIST_SIZE;
+	time_t span = now - press_hist_time[oldest];
+	if (span < PRESS_HIST_MIN_SPAN)
+	{
+		MYLOG("PRESS", "History %ld s, too short for a trend", span / 1000);
+		return false;
+	}
+	// hPa per ms to hPa per hour
+	rak1902_trend = (rak1902_pressure - press_hist_value[oldest]) / span * 3600000.0;
+	MYLOG("PRESS", "Trend %.2f hPa/h over %ld min", rak1902_trend, span / 60000);
+	return true;
+}
+
+/**
+ * @brief Get a new pressure value depending on the sensor mode
+ *
+ * @return true if a new value was read
+ * @return false if no new value is available
+ */
+static bool rak1902_update(void)
+{
+	if (g_press_mode == PRESS_CONTINUOUS)
+	{
+		return rak1902_read_fifo();
+	}
+	return rak1902_one_shot();
+}
+
 /**
  * @brief Read the barometric pressure
  *     Data is added to Cayenne LPP payload as channel
- *     LPP_CHANNEL_PRESS
+ *     LPP_CHANNEL_PRESS and, once the history covers 1 hour, LPP_CHANNEL_PRESS_TREND
  *
  */
 void read_rak1902(void)
 {
 	MYLOG("PRESS", "Reading LPS22HB");
 
-	lps.requestOneShot(); // important to request new data before reading
-	delay(1000);		  // Give the sensor some time
-
-	float pressure = lps.readPressure(); // hPa
+	if (!rak1902_update())
+	{
+		MYLOG("PRESS", "No new pressure value");
+		return;
+	}
 
-	MYLOG("PRESS", "P: %.2f MSL: %.2f", pressure, mean_seal_level_press);
+	MYLOG("PRESS", "P: %.2f MSL: %.2f", rak1902_pressure, mean_seal_level_press);
 
-	g_solution_data.addBarometricPressure(LPP_CHANNEL_PRESS, pressure);
+	g_solution_data.addBarometricPressure(LPP_CHANNEL_PRESS, rak1902_pressure);
+	if (rak1902_history())
+	{
+		g_solution_data.addAnalogInput(LPP_CHANNEL_PRESS_TREND, rak1902_trend);
+	}
+	sensor_cache_set(CACHE_PRESS, rak1902_pressure, PRESS_ID, QUALITY_RAK1902);
 }
 
 /**
- * @brief Calculate and return the altitude
- *        based on the barometric pressure
- *        Requires to have MSL set
+ * @brief Read the barometric pressure for the altitude
+ *        without adding it to the payload
  *
- * @return uint16_t altitude in cm
+ * @param pressure pointer for the pressure in hPa
+ * @return true if a pressure is available
+ * @return false if reading failed
  */
-uint16_t get_alt_rak1902(void)
+bool get_press_rak1902(float *pressure)
 {
-	// Get latest values
-	read_rak1902();
-	delay(250);
-
-	MYLOG("PRESS", "Compute altitude");
-	// pressure in HPa
-	float pressure = lps.readPressure(); // hPa
-	MYLOG("PRESS", "P: %.2f", pressure);
-
-	float A = pressure / mean_seal_level_press; // (1013.25) by default;
-	float B = 1 / 5.25588;
-	float C = pow(A, B);
-	C = 1.0 - C;
-	C = C / 0.0000225577;
-	uint16_t new_val = C * 100;
-	MYLOG("PRESS", "Altitude: %.2f m / %d cm", C, new_val);
-	return new_val;
+	if (!rak1902_update() && (rak1902_pressure == 0.0))
+	{
+		return false;
+	}
+	sensor_cache_set(CACHE_PRESS, rak1902_pressure, PRESS_ID, QUALITY_RAK1902);
+	*pressure = rak1902_pressure;
+	return true;
 }
 
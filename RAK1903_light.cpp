@@ -15,6 +15,78 @@
 ClosedCube_OPT3001 opt3001;
 /** Sensor I2C address */
 #define OPT3001_ADDRESS 0x44
+/** Limit registers of the window comparator */
+#define OPT3001_REG_LOW_LIMIT 0x02
+#define OPT3001_REG_HIGH_LIMIT 0x03
+/** Highest limit value (83865 lux) */
+#define OPT3001_MAX_LIMIT 0xBFFF
+
+/** Interrupt pin in event mode, 0 = not attached */
+uint8_t rak1903_int_pin = 0;
+
+/**
+ * @brief Write a limit register, lux = 0.01 * 2^exponent * mantissa
+ *
+ * @param reg OPT3001_REG_LOW_LIMIT or OPT3001_REG_HIGH_LIMIT
+ * @param lux limit in lux
+ * @return true if written
+ * @return false if I2C error
+ */
+static bool rak1903_write_limit(uint8_t reg, float lux)
+{
+	uint16_t limit = OPT3001_MAX_LIMIT;
+	if (lux <= 0.0)
+	{
+		limit = 0;
+	}
+	else
+	{
+		for (uint8_t exponent = 0; exponent < 12; exponent++)
+		{
+			float mantissa = lux / (0.01 * (1 << exponent));
+			if (mantissa < 4096.0)
+			{
+				limit = (exponent << 12) | (uint16_t)mantissa;
+				break;
+			}
+		}
+	}
+	Wire.beginTransmission(OPT3001_ADDRESS);
+	Wire.write(reg);
+	Wire.write((uint8_t)(limit >> 8));
+	Wire.write((uint8_t)(limit & 0xFF));
+	return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Program the window comparator for the current light level and clear the latched interrupt
+ *
+ * @param lux current light level
+ */
+static void rak1903_event_arm(float lux)
+{
+	float low;
+	float high;
+	event_window(EVENT_LIGHT, lux, &low, &high);
+	rak1903_write_limit(OPT3001_REG_LOW_LIMIT, low);
+	rak1903_write_limit(OPT3001_REG_HIGH_LIMIT, high);
+	// Reading the configuration clears the latched interrupt
+	opt3001.readConfig();
+}
+
+/**
+ * @brief Light threshold interrupt
+ *
+ */
+static void int_callback_rak1903(void)
+{
+	if (!event_trigger(EVENT_LIGHT))
+	{
+		// No uplink, arm for the current level
+		OPT3001 result = opt3001.readResult();
+		rak1903_event_arm(result.error == NO_ERROR ? result.lux : 0.0);
+	}
+}
 
 /**
  * @brief Initialize the Light sensor
@@ -64,6 +136,11 @@ void read_rak1903()
 		MYLOG("LIGHT", "L: %.2f", (float)light_int / 1.0);
 
 		g_solution_data.addLuminosity(LPP_CHANNEL_LIGHT, light_int);
+
+		if (rak1903_int_pin != 0)
+		{
+			rak1903_event_arm(result.lux);
+		}
 	}
 	else
 	{
@@ -71,3 +148,29 @@ void read_rak1903()
 		g_solution_data.addLuminosity(LPP_CHANNEL_LIGHT, 0);
 	}
 }
+
+/**
+ * @brief Enable or disable the event mode after the thresholds changed
+ *        The OPT3001 runs in latched window mode, the INT pin is active low
+ *
+ */
+void rak1903_event_setup(void)
+{
+	if (rak1903_int_pin != 0)
+	{
+		detachInterrupt(rak1903_int_pin);
+	}
+	rak1903_int_pin = event_pin(EVENT_LIGHT);
+	if (rak1903_int_pin == 0)
+	{
+		// Window that never triggers
+		rak1903_write_limit(OPT3001_REG_LOW_LIMIT, 0.0);
+		rak1903_write_limit(OPT3001_REG_HIGH_LIMIT, EVENT_NO_HIGH);
+		return;
+	}
+	OPT3001 result = opt3001.readResult();
+	rak1903_event_arm(result.error == NO_ERROR ? result.lux : 0.0);
+	pinMode(rak1903_int_pin, INPUT_PULLUP);
+	attachInterrupt(rak1903_int_pin, int_callback_rak1903, FALLING);
+	MYLOG("LIGHT", "Event mode on WB_IO%d", g_event_thr[EVENT_LIGHT].pin);
+}
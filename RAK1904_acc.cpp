@@ -30,6 +30,35 @@ time_t last_trigger = 0;
 /** Flag if motion was detected */
 bool motion_detected = false;
 
+/** FIFO streaming ODR, 0 = off, 1 to 7 = LIS3DH ODR 1, 10, 25, 50, 100, 200, 400 Hz */
+uint8_t g_acc_stream_odr = 0;
+
+/** FIFO watermark level, interrupt is triggered when the FIFO holds more samples */
+#define ACC_FIFO_WTM 24
+/** Samples per I2C read, 6 bytes each, limited by the Wire buffer size */
+#define ACC_BURST_SAMPLES 5
+/** Size of the sample ring buffer, must be a power of 2 */
+#define ACC_RING_SIZE 256
+/** Full scale in streaming mode, CTRL_REG4 FS bits, 1 = +/-4g */
+#define ACC_STREAM_FS 1
+
+/** mg/digit in normal mode (10 bit) for full scale +/-2, 4, 8 and 16g */
+static const uint8_t acc_stream_mg[4] = {4, 8, 16, 48};
+/** mg/digit of the streamed samples */
+uint8_t acc_stream_scale = 8;
+/** CTRL_REG4 and INT1_THS of the motion detection, restored when streaming is switched off */
+uint8_t acc_saved_ctrl4 = 0;
+uint8_t acc_saved_ths = 0;
+
+/** Ring buffer for streamed samples in mg */
+int16_t acc_ring[ACC_RING_SIZE][3];
+/** Write index of the ring buffer */
+volatile uint16_t acc_ring_head = 0;
+/** Read index of the ring buffer */
+volatile uint16_t acc_ring_tail = 0;
+/** Number of samples dropped because the ring buffer was full */
+volatile uint32_t acc_ring_overrun = 0;
+
 /**
  * @brief Read RAK1904 register
  *     Added here because Adafruit made that function private :-(
@@ -84,6 +113,197 @@ bool rak1904_readRegister(uint8_t *outputPointer, uint8_t chip_reg)
 	return true;
 }
 
+/**
+ * @brief Read a block of RAK1904 registers with auto increment
+ *     In FIFO mode reading from LIS3DH_REG_OUT_X_L wraps
+ *     around after the Z value, so the whole FIFO can be read in one go
+ *
+ * @param buffer buffer for the data
+ * @param chip_reg start register address
+ * @param len number of bytes to read
+ * @return true read success
+ * @return false read failed
+ */
+bool rak1904_readBlock(uint8_t *buffer, uint8_t chip_reg, uint8_t len)
+{
+	usedWire->beginTransmission(LIS3DH_DEFAULT_ADDRESS);
+	usedWire->write(chip_reg | 0x80); // MSB set = auto increment
+	if (usedWire->endTransmission() != 0)
+	{
+		return false;
+	}
+	if (usedWire->requestFrom(LIS3DH_DEFAULT_ADDRESS, len) != len)
+	{
+		return false;
+	}
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		buffer[idx] = usedWire->read();
+	}
+	return true;
+}
+
+/**
+ * @brief Enable or disable FIFO streaming
+ *     In streaming mode the LIS3DH runs in normal mode (10 bit) at +/-4g
+ *     with the FIFO in stream mode and the watermark interrupt on INT1.
+ *     The motion threshold is adjusted to the range, so it stays the same in mg.
+ *
+ * @param odr 0 = off, 1 to 7 = LIS3DH ODR 1, 10, 25, 50, 100, 200, 400 Hz
+ * @return true if the sensor was configured
+ * @return false if the ODR is invalid or the sensor didn't respond
+ */
+bool rak1904_set_stream(uint8_t odr)
+{
+	uint8_t data_to_write = 0;
+	bool result = true;
+
+	if (odr > 7)
+	{
+		return false;
+	}
+
+	if (odr == 0)
+	{
+		// Back to bypass mode, low power 10 Hz
+		result &= rak1904_writeRegister(LIS3DH_REG_FIFOCTRL, 0x00);
+		rak1904_readRegister(&data_to_write, LIS3DH_REG_CTRL5);
+		result &= rak1904_writeRegister(LIS3DH_REG_CTRL5, data_to_write & ~0x40);
+		result &= rak1904_writeRegister(LIS3DH_REG_CTRL3, 0x60);
+		result &= rak1904_writeRegister(LIS3DH_REG_CTRL1, (LIS3DH_DATARATE_10_HZ << 4) | 0x0F);
+		if (g_acc_stream_odr != 0)
+		{
+			// Range and threshold of the motion detection
+			result &= rak1904_writeRegister(LIS3DH_REG_CTRL4, acc_saved_ctrl4);
+			result &= rak1904_writeRegister(LIS3DH_REG_INT1THS, acc_saved_ths);
+		}
+		g_acc_stream_odr = 0;
+		return result;
+	}
+
+	if (g_acc_stream_odr == 0)
+	{
+		rak1904_readRegister(&acc_saved_ctrl4, LIS3DH_REG_CTRL4);
+		rak1904_readRegister(&acc_saved_ths, LIS3DH_REG_INT1THS);
+	}
+
+	// Block data update, full scale, high resolution off (normal mode with LPen = 0)
+	result &= rak1904_writeRegister(LIS3DH_REG_CTRL4, 0x80 | (ACC_STREAM_FS << 4));
+	acc_stream_scale = acc_stream_mg[ACC_STREAM_FS];
+
+	// Threshold LSB doubles with each range step, keep the motion threshold in mg
+	uint8_t saved_fs = (acc_saved_ctrl4 >> 4) & 0x03;
+	uint8_t ths = acc_saved_ths & 0x7F;
+	if (ACC_STREAM_FS > saved_fs)
+	{
+		ths = (ths + (1 << (ACC_STREAM_FS - saved_fs)) - 1) >> (ACC_STREAM_FS - saved_fs);
+	}
+	result &= rak1904_writeRegister(LIS3DH_REG_INT1THS, ths == 0 ? 1 : ths);
+
+	// ODR, normal mode, X, Y and Z enabled
+	result &= rak1904_writeRegister(LIS3DH_REG_CTRL1, (odr << 4) | 0x07);
+
+	// Reset FIFO by going through bypass mode
+	result &= rak1904_writeRegister(LIS3DH_REG_FIFOCTRL, 0x00);
+
+	// Enable FIFO, keep the latched AOI interrupt
+	rak1904_readRegister(&data_to_write, LIS3DH_REG_CTRL5);
+	result &= rak1904_writeRegister(LIS3DH_REG_CTRL5, data_to_write | 0x40);
+
+	// Stream mode with watermark level
+	result &= rak1904_writeRegister(LIS3DH_REG_FIFOCTRL, 0x80 | ACC_FIFO_WTM);
+
+	// AOI1, AOI2 and FIFO watermark on INT1
+	result &= rak1904_writeRegister(LIS3DH_REG_CTRL3, 0x64);
+
+	acc_ring_head = 0;
+	acc_ring_tail = 0;
+	g_acc_stream_odr = odr;
+	MYLOG("ACC", "FIFO streaming %s", result ? "enabled" : "failed");
+	return result;
+}
+
+/**
+ * @brief Move all samples from the LIS3DH FIFO into the ring buffer
+ *
+ * @return uint8_t number of samples read
+ */
+uint8_t rak1904_drain_fifo(void)
+{
+	uint8_t fifo_src = 0;
+	if (!rak1904_readRegister(&fifo_src, LIS3DH_REG_FIFOSRC))
+	{
+		return 0;
+	}
+	// Number of unread samples, OVRN means the FIFO is full (32)
+	uint8_t num_samples = (fifo_src & 0x40) ? 32 : (fifo_src & 0x1F);
+	uint8_t read_samples = 0;
+
+	uint8_t raw[ACC_BURST_SAMPLES * 6];
+	while (read_samples < num_samples)
+	{
+		uint8_t burst = num_samples - read_samples;
+		if (burst > ACC_BURST_SAMPLES)
+		{
+			burst = ACC_BURST_SAMPLES;
+		}
+		if (!rak1904_readBlock(raw, LIS3DH_REG_OUT_X_L, burst * 6))
+		{
+			break;
+		}
+		for (uint8_t idx = 0; idx < burst; idx++)
+		{
+			if ((uint16_t)(acc_ring_head - acc_ring_tail) >= ACC_RING_SIZE)
+			{
+				// Buffer full, drop the new sample, the read index belongs to the consumer
+				acc_ring_overrun++;
+				continue;
+			}
+			int16_t *sample = acc_ring[acc_ring_head & (ACC_RING_SIZE - 1)];
+			for (uint8_t axis = 0; axis < 3; axis++)
+			{
+				// 10 bit left aligned
+				int16_t value = (int16_t)((uint16_t)raw[idx * 6 + axis * 2] | ((uint16_t)raw[idx * 6 + axis * 2 + 1] << 8));
+				sample[axis] = (value >> 6) * acc_stream_scale;
+			}
+			acc_ring_head++;
+		}
+		read_samples += burst;
+	}
+	return read_samples;
+}
+
+/**
+ * @brief Get number of samples in the ring buffer
+ *
+ * @return uint16_t number of samples available
+ */
+uint16_t rak1904_stream_available(void)
+{
+	return (uint16_t)(acc_ring_head - acc_ring_tail);
+}
+
+/**
+ * @brief Get the oldest sample from the ring buffer
+ *
+ * @param xyz array for X, Y and Z in mg
+ * @return true if a sample was available
+ * @return false if the ring buffer is empty
+ */
+bool rak1904_stream_get(int16_t *xyz)
+{
+	if (acc_ring_head == acc_ring_tail)
+	{
+		return false;
+	}
+	int16_t *sample = acc_ring[acc_ring_tail & (ACC_RING_SIZE - 1)];
+	xyz[0] = sample[0];
+	xyz[1] = sample[1];
+	xyz[2] = sample[2];
+	acc_ring_tail++;
+	return true;
+}
+
 /**
  * @brief Initialize LIS3DH 3-axis
  * acceleration sensor
@@ -182,6 +402,13 @@ bool init_rak1904(void)
  */
 void read_rak1904(void)
 {
+	if (g_acc_stream_odr != 0)
+	{
+		MYLOG("ACC", "%d samples buffered, %ld lost", rak1904_stream_available(), acc_ring_overrun);
+		vib_process();
+		vib_add_payload();
+		return;
+	}
 	sensors_event_t event;
 	acc_sensor.getEvent(&event);
 	MYLOG("ACC", "Acceleration in g (x,y,z): %f %f %f", event.acceleration.x, event.acceleration.y, event.acceleration.z);
@@ -206,18 +433,35 @@ void int_assign_rak1904(uint8_t new_irq_pin)
  */
 void int_callback_rak1904(void)
 {
+	if (g_acc_stream_odr != 0)
+	{
+		uint8_t fifo_src = 0;
+		rak1904_readRegister(&fifo_src, LIS3DH_REG_FIFOSRC);
+		if (fifo_src & 0x80)
+		{
+			// FIFO watermark reached, the samples are analysed in the loop
+			rak1904_drain_fifo();
+		}
+		uint8_t int1_src = 0;
+		rak1904_readRegister(&int1_src, LIS3DH_REG_INT1SRC);
+		if ((int1_src & 0x40) == 0)
+		{
+			// No motion interrupt
+			attachInterrupt(acc_int_pin, int_callback_rak1904, RISING);
+			return;
+		}
+	}
 	MYLOG("ACC", "Interrupt triggered");
+	// Last location is outdated
+	gnss_motion_detected();
 	// detachInterrupt(acc_int_pin);
 	if ((millis() - last_trigger) > (g_send_interval_time / 2) && !gnss_active)
 	{
 		motion_detected = true;
 		last_trigger = millis();
 		// Read the sensors and trigger a packet
+		// Restarts the send interval timer as well
 		sensor_handler(NULL);
-		// Stop a timer.
-		api.system.timer.stop(RAK_TIMER_0);
-		// Start a timer.
-		api.system.timer.start(RAK_TIMER_0, g_send_interval_time, NULL);
 	}
 	else
 	{
@@ -20,6 +20,283 @@ MPU9250_WE mpu_sensor = MPU9250_WE();
 /** Interrupt pin, depends on slot */
 uint8_t mpu_int_pin = WB_IO5;
 
+/** I2C address of the MPU9250 */
+#define MPU9250_ADDRESS 0x68
+// MPU9250 registers used for the FIFO
+#define MPU9250_REG_SMPLRT_DIV 0x19
+#define MPU9250_REG_FIFO_EN 0x23
+#define MPU9250_REG_INT_STATUS 0x3A
+#define MPU9250_REG_USER_CTRL 0x6A
+#define MPU9250_REG_FIFO_COUNT 0x72
+#define MPU9250_REG_FIFO_R_W 0x74
+
+/** Bytes per FIFO sample, accelerometer and gyroscope */
+#define MPU_FIFO_SAMPLE 12
+/** Samples per I2C read, limited by the Wire buffer size */
+#define MPU_BURST_SAMPLES 2
+/** Interval to drain the FIFO in ms, the 512 byte FIFO holds 42 samples */
+#define MPU_DRAIN_INTERVAL 100
+/** Accelerometer scale at 2 g range in LSB/g */
+#define MPU_ACC_SCALE 16384.0f
+/** Gyroscope scale at 500 deg/s range in LSB/(rad/s) */
+#define MPU_GYR_SCALE (65.5f * RAD_TO_DEG)
+/** Offsets are measured at 250 deg/s range, the FIFO runs at 500 deg/s */
+#define MPU_GYR_OFFSET_DIV 2.0f
+/** Number of readings for the stillness check after the offsets were measured */
+#define MPU_STILL_SAMPLES 20
+/** Max corrected gyroscope reading in deg/s of a device lying still */
+#define MPU_STILL_GYR 2.0f
+/** Max deviation of the corrected acceleration from 1 g of a device lying still */
+#define MPU_STILL_ACC 0.05f
+
+/** Fusion sample rate in Hz, 0 = fusion off */
+uint8_t g_fusion_rate = 0;
+
+/** Flag if the FIFO timer was created */
+bool mpu_timer_created = false;
+
+/** Offsets in FIFO counts, the library applies its offsets only in its getter functions */
+float mpu_acc_offset[3] = {0.0, 0.0, 0.0};
+float mpu_gyr_offset[3] = {0.0, 0.0, 0.0};
+
+/**
+ * @brief Write a MPU9250 register
+ *
+ * @param chip_reg register address
+ * @param value data to write
+ * @return true write success
+ * @return false write failed
+ */
+bool rak1905_writeRegister(uint8_t chip_reg, uint8_t value)
+{
+	Wire.beginTransmission(MPU9250_ADDRESS);
+	Wire.write(chip_reg);
+	Wire.write(value);
+	return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Read a block of bytes from the MPU9250
+ *     Reading from MPU9250_REG_FIFO_R_W reads the next bytes from the FIFO
+ *
+ * @param buffer buffer for the data
+ * @param chip_reg start register address
+ * @param len number of bytes to read
+ * @return true read success
+ * @return false read failed
+ */
+bool rak1905_readBlock(uint8_t *buffer, uint8_t chip_reg, uint8_t len)
+{
+	Wire.beginTransmission(MPU9250_ADDRESS);
+	Wire.write(chip_reg);
+	if (Wire.endTransmission(false) != 0)
+	{
+		return false;
+	}
+	if (Wire.requestFrom((uint8_t)MPU9250_ADDRESS, len) != len)
+	{
+		return false;
+	}
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		buffer[idx] = Wire.read();
+	}
+	return true;
+}
+
+/**
+ * @brief Get a big endian 16 bit value
+ *
+ * @param buffer pointer to the MSB
+ * @return int16_t value
+ */
+static int16_t rak1905_value(uint8_t *buffer)
+{
+	return (int16_t)(((uint16_t)buffer[0] << 8) | buffer[1]);
+}
+
+/**
+ * @brief Read all samples from the MPU9250 FIFO and feed them into the fusion filter
+ *     The magnetometer is read once per call, it changes slowly
+ *
+ * @param data unused
+ */
+void rak1905_drain_fifo(void *data)
+{
+	uint8_t raw[MPU_BURST_SAMPLES * MPU_FIFO_SAMPLE];
+	uint8_t int_status = 0;
+
+	rak1905_readBlock(&int_status, MPU9250_REG_INT_STATUS, 1);
+	if (int_status & 0x10)
+	{
+		// FIFO overflow, samples are not aligned anymore
+		MYLOG("9DOF", "FIFO overflow");
+		rak1905_readBlock(raw, MPU9250_REG_USER_CTRL, 1);
+		rak1905_writeRegister(MPU9250_REG_USER_CTRL, raw[0] | 0x04);
+		return;
+	}
+
+	if (!rak1905_readBlock(raw, MPU9250_REG_FIFO_COUNT, 2))
+	{
+		return;
+	}
+	uint16_t num_samples = (((uint16_t)(raw[0] & 0x1F) << 8) | raw[1]) / MPU_FIFO_SAMPLE;
+
+	xyzFloat mag_raw = mpu_sensor.getMagValues();
+	float mag[3] = {mag_raw.x, mag_raw.y, mag_raw.z};
+	mag_cal_add(mag);
+	mag_cal_apply(mag);
+
+	while (num_samples != 0)
+	{
+		uint8_t burst = num_samples > MPU_BURST_SAMPLES ? MPU_BURST_SAMPLES : num_samples;
+		if (!rak1905_readBlock(raw, MPU9250_REG_FIFO_R_W, burst * MPU_FIFO_SAMPLE))
+		{
+			return;
+		}
+		for (uint8_t idx = 0; idx < burst; idx++)
+		{
+			uint8_t *sample = &raw[idx * MPU_FIFO_SAMPLE];
+			fusion_update((rak1905_value(&sample[6]) - mpu_gyr_offset[0]) / MPU_GYR_SCALE,
+						  (rak1905_value(&sample[8]) - mpu_gyr_offset[1]) / MPU_GYR_SCALE,
+						  (rak1905_value(&sample[10]) - mpu_gyr_offset[2]) / MPU_GYR_SCALE,
+						  (rak1905_value(&sample[0]) - mpu_acc_offset[0]) / MPU_ACC_SCALE,
+						  (rak1905_value(&sample[2]) - mpu_acc_offset[1]) / MPU_ACC_SCALE,
+						  (rak1905_value(&sample[4]) - mpu_acc_offset[2]) / MPU_ACC_SCALE,
+						  // MPU9250 magnetometer axes are X <-> Y swapped and Z inverted
+						  mag[1], mag[0], -mag[2]);
+		}
+		num_samples -= burst;
+	}
+}
+
+/**
+ * @brief Enable or disable the orientation fusion
+ *     The accelerometer and gyroscope samples are collected in the FIFO
+ *     of the MPU9250 and read in bursts by a timer
+ *
+ * @param rate sample rate in Hz, 0 = off, 4 to 200 Hz
+ * @return true if the sensor was configured
+ * @return false if the rate is invalid or the sensor didn't respond
+ */
+bool rak1905_set_fusion(uint8_t rate)
+{
+	uint8_t user_ctrl = 0;
+	bool result = true;
+
+	if ((rate != 0) && ((rate < 4) || (rate > 200)))
+	{
+		return false;
+	}
+
+	if (!mpu_timer_created)
+	{
+		if (!api.system.timer.create(RAK_TIMER_4, rak1905_drain_fifo, RAK_TIMER_PERIODIC))
+		{
+			MYLOG("9DOF", "Creating FIFO timer failed.");
+			return false;
+		}
+		mpu_timer_created = true;
+	}
+	api.system.timer.stop(RAK_TIMER_4);
+
+	// Keep the I2C master bit, it is used to read the magnetometer
+	result &= rak1905_readBlock(&user_ctrl, MPU9250_REG_USER_CTRL, 1);
+	user_ctrl &= ~0x40;
+	result &= rak1905_writeRegister(MPU9250_REG_FIFO_EN, 0x00);
+	result &= rak1905_writeRegister(MPU9250_REG_USER_CTRL, user_ctrl | 0x04); // FIFO reset
+
+	g_fusion_rate = rate;
+	if (rate == 0)
+	{
+		mpu_sensor.setSampleRateDivider(5);
+		// Back to the motion detection filter of init_rak1905()
+		mpu_sensor.setAccDLPF(MPU9250_DLPF_6);
+		return result;
+	}
+
+	// Same DLPF for accelerometer and gyroscope, so both have the same delay in the fusion.
+	// Bandwidth below half of the sample rate against aliasing.
+	MPU9250_dlpf dlpf = MPU9250_DLPF_6;
+	if (rate >= 200)
+	{
+		dlpf = MPU9250_DLPF_2; // 92 Hz
+	}
+	else if (rate >= 100)
+	{
+		dlpf = MPU9250_DLPF_3; // 41 Hz
+	}
+	else if (rate >= 50)
+	{
+		dlpf = MPU9250_DLPF_4; // 20 Hz
+	}
+	else if (rate >= 20)
+	{
+		dlpf = MPU9250_DLPF_5; // 10 Hz
+	}
+	mpu_sensor.enableAccDLPF(true);
+	mpu_sensor.setAccDLPF(dlpf);
+	// Gyroscope DLPF is required for the sample rate divider, 1 kHz / (1 + divider)
+	mpu_sensor.enableGyrDLPF();
+	mpu_sensor.setGyrDLPF(dlpf);
+	mpu_sensor.setGyrRange(MPU9250_GYRO_RANGE_500);
+	result &= rak1905_writeRegister(MPU9250_REG_SMPLRT_DIV, (1000 / rate) - 1);
+
+	// Offsets of the library are raw values at 2 g and 250 deg/s, scale them to the FIFO ranges
+	xyzFloat acc_offset = mpu_sensor.getAccOffsets();
+	xyzFloat gyr_offset = mpu_sensor.getGyrOffsets();
+	mpu_acc_offset[0] = acc_offset.x;
+	mpu_acc_offset[1] = acc_offset.y;
+	mpu_acc_offset[2] = acc_offset.z;
+	mpu_gyr_offset[0] = gyr_offset.x / MPU_GYR_OFFSET_DIV;
+	mpu_gyr_offset[1] = gyr_offset.y / MPU_GYR_OFFSET_DIV;
+	mpu_gyr_offset[2] = gyr_offset.z / MPU_GYR_OFFSET_DIV;
+
+	// Accelerometer and gyroscope X, Y, Z into the FIFO
+	result &= rak1905_writeRegister(MPU9250_REG_FIFO_EN, 0x78);
+	result &= rak1905_writeRegister(MPU9250_REG_USER_CTRL, user_ctrl | 0x40);
+
+	fusion_init(1000 / (1000 / rate));
+	api.system.timer.start(RAK_TIMER_4, MPU_DRAIN_INTERVAL, NULL);
+	MYLOG("9DOF", "Fusion %s with %d Hz", result ? "enabled" : "failed", 1000 / (1000 / rate));
+	return result;
+}
+
+/**
+ * @brief Measure the accelerometer and gyroscope offsets
+ *        The offsets are only saved if the device was lying still,
+ *        with wrong offsets the corrected readings of a device at rest
+ *        show a rotation or an acceleration different from 1 g
+ *
+ * @return true if the device was still and the offsets were saved
+ * @return false if the device moved, the offsets are used until the next boot
+ */
+bool rak1905_calibrate_offsets(void)
+{
+	mpu_sensor.autoOffsets();
+
+	for (uint8_t idx = 0; idx < MPU_STILL_SAMPLES; idx++)
+	{
+		xyzFloat gyr = mpu_sensor.getGyrValues();
+		float acc = mpu_sensor.getResultantG(mpu_sensor.getGValues());
+		if ((fabsf(gyr.x) > MPU_STILL_GYR) || (fabsf(gyr.y) > MPU_STILL_GYR) || (fabsf(gyr.z) > MPU_STILL_GYR) ||
+			(fabsf(acc - 1.0f) > MPU_STILL_ACC))
+		{
+			MYLOG("9DOF", "Device moved, offsets not saved. Gyr %.1f %.1f %.1f deg/s, acc %.2f g", gyr.x, gyr.y, gyr.z, acc);
+			return false;
+		}
+		delay(10);
+	}
+
+	xyzFloat acc = mpu_sensor.getAccOffsets();
+	xyzFloat gyr = mpu_sensor.getGyrOffsets();
+	float acc_offset[3] = {acc.x, acc.y, acc.z};
+	float gyr_offset[3] = {gyr.x, gyr.y, gyr.z};
+	mag_cal_set_offsets(acc_offset, gyr_offset);
+	MYLOG("9DOF", "Offsets saved");
+	return true;
+}
+
 /**
  * @brief Initialize MPU9250 9-axis
  * acceleration sensor
@@ -49,8 +326,20 @@ bool init_rak1905(void)
 
 	MYLOG("9DOF", "Chip ID %02x %02x", mpu_sensor.whoAmI(), mpu_sensor.whoAmIMag());
 
-	// Auto offsets
-	mpu_sensor.autoOffsets();
+	mag_cal_load();
+	float acc_offset[3];
+	float gyr_offset[3];
+	if (mag_cal_get_offsets(acc_offset, gyr_offset))
+	{
+		// Use the stored offsets, no need to lie still
+		mpu_sensor.setAccOffsets(xyzFloat{acc_offset[0], acc_offset[1], acc_offset[2]});
+		mpu_sensor.setGyrOffsets(xyzFloat{gyr_offset[0], gyr_offset[1], gyr_offset[2]});
+	}
+	else
+	{
+		// Auto offsets, saved only if the device is lying still, otherwise measured again on the next boot
+		rak1905_calibrate_offsets();
+	}
 
 	/*  Sample rate divider divides the output rate of the gyroscope and accelerometer.
 	 *  Sample rate = Internal sample rate / (1 + divider)
@@ -171,9 +460,19 @@ bool init_rak1905(void)
  */
 void read_rak1905(void)
 {
+	if (g_fusion_rate != 0)
+	{
+		rak1905_drain_fifo(NULL);
+		fusion_add_payload();
+		return;
+	}
+
 	xyzFloat gValue = mpu_sensor.getGValues();
 	xyzFloat gyr = mpu_sensor.getGyrValues();
 	xyzFloat magValue = mpu_sensor.getMagValues();
+	float mag[3] = {magValue.x, magValue.y, magValue.z};
+	mag_cal_add(mag);
+	mag_cal_apply(mag);
 	float temp = mpu_sensor.getTemperature();
 	float resultantG = mpu_sensor.getResultantG(gValue);
 
@@ -182,7 +481,7 @@ void read_rak1905(void)
 
 	MYLOG("9DOF", "Gyroscope data in degrees/s: %f %f %f", gyr.x, gyr.y, gyr.z);
 
-	MYLOG("9DOF", "Magnetometer Data in μTesla: %f %f %f", magValue.x, magValue.y, magValue.z);
+	MYLOG("9DOF", "Magnetometer Data in μTesla: %f %f %f", mag[0], mag[1], mag[2]);
 
 	MYLOG("9DOF", "Temperature in °C: %f", temp);
 }
@@ -206,6 +505,8 @@ void int_assign_rak1905(uint8_t new_irq_pin)
  */
 void int_callback_rak1905(void)
 {
+	// Last location is outdated
+	gnss_motion_detected();
 	if ((millis() - last_trigger) > 15000)
 	{
 		MYLOG("9DOF", "Interrupt triggered");
@@ -2,6 +2,7 @@
  * @file RAK1906_env.cpp
  * @author Bernd Giesecke (bernd@giesecke.tk)
  * @brief BME680 sensor functions
+ *        T/P/H only or gas measurements with a heater profile and duty cycle
  * @version 0.1
  * @date 2022-04-10
  *
@@ -15,8 +16,61 @@
 /** BME680 instance for Wire */
 Adafruit_BME680 bme(&Wire);
 
-/** Mean Sea Level Pressure */
-float mean_seal_level_press = 1013.25;
+/** Gas heater profile, default 320 degrees C for 150 ms on every reading */
+bme_gas_s g_bme_gas = {320, 150, 1};
+
+/** Readings since the last gas measurement */
+uint8_t bme_gas_count = 0;
+/** Flag if the running measurement includes the gas resistance */
+bool bme_gas_running = false;
+/** Flag if a measurement is running */
+bool bme_running = false;
+
+/**
+ * @brief Start a forced mode measurement
+ *        The heater is only switched on if the gas resistance is needed
+ *
+ * @param with_gas true to measure the gas resistance with the heater profile
+ * @return true if the measurement was started
+ * @return false if the measurement could not be started
+ */
+static bool bme_start(bool with_gas)
+{
+	if (with_gas)
+	{
+		bme.setGasHeater(g_bme_gas.heater_temp, g_bme_gas.heater_time);
+	}
+	else
+	{
+		// Heater off, T/P/H only
+		bme.setGasHeater(0, 0);
+	}
+	bme_gas_running = with_gas;
+	bme_running = bme.beginReading() != 0;
+	return bme_running;
+}
+
+/**
+ * @brief Finish the running measurement
+ *        Sleeps for the remaining measurement time calculated by the driver instead of polling the sensor
+ *
+ * @return true if the measurement results were read
+ * @return false if no measurement was running or reading failed
+ */
+static bool bme_finish(void)
+{
+	if (!bme_running)
+	{
+		return false;
+	}
+	bme_running = false;
+	int remaining = bme.remainingReadingMillis();
+	if (remaining > 0)
+	{
+		api.system.sleep.cpu(remaining);
+	}
+	return bme.endReading();
+}
 
 /**
  * @brief Initialize the BME680 sensor
@@ -39,26 +93,42 @@ bool init_rak1906(void)
 	bme.setHumidityOversampling(BME680_OS_2X);
 	bme.setPressureOversampling(BME680_OS_4X);
 	bme.setIIRFilterSize(BME680_FILTER_SIZE_3);
-	bme.setGasHeater(320, 150); // 320*C for 150 ms
+	// Heater profile is set before each measurement
+	bme.setGasHeater(0, 0);
 
 	return true;
 }
 
 /**
- * @brief Start sensing on the BME6860
+ * @brief Start sensing on the BME680
+ *        Gas is measured every g_bme_gas.duty readings, heater temperature 0 = no gas measurement
+ *        The conversion runs while the other sensors are read
  *
  */
 void start_rak1906(void)
 {
-	MYLOG("BME", "Start BME measuring");
-	bme.beginReading();
+	bool with_gas = false;
+	if ((g_bme_gas.heater_temp != 0) && (g_bme_gas.duty != 0))
+	{
+		bme_gas_count++;
+		if (bme_gas_count >= g_bme_gas.duty)
+		{
+			bme_gas_count = 0;
+			with_gas = true;
+		}
+	}
+	MYLOG("BME", "Start BME measuring %s", with_gas ? "with gas" : "T/P/H only");
+	if (!bme_start(with_gas))
+	{
+		MYLOG("BME", "BME start failed");
+	}
 }
 
 /**
  * @brief Read environment data from BME680
  *     Data is added to Cayenne LPP payload as channels
  *     LPP_CHANNEL_HUMID_2, LPP_CHANNEL_TEMP_2,
- *     LPP_CHANNEL_PRESS_2 and LPP_CHANNEL_GAS_2
+ *     LPP_CHANNEL_PRESS_2 and, if gas was measured, LPP_CHANNEL_GAS_2
  *
  *
  * @return true if reading was successful
@@ -67,20 +137,13 @@ void start_rak1906(void)
 bool read_rak1906()
 {
 	MYLOG("BME", "Reading BME680");
-	time_t wait_start = millis();
-	bool read_success = false;
-	while ((millis() - wait_start) < 5000)
+	if (!bme_running)
 	{
-		if (bme.endReading())
-		{
-			read_success = true;
-			break;
-		}
+		start_rak1906();
 	}
-
-	if (!read_success)
+	if (!bme_finish())
 	{
-		MYLOG("BME", "BME reading timeout");
+		MYLOG("BME", "BME reading failed");
 		return false;
 	}
 
@@ -93,44 +156,41 @@ bool read_rak1906()
 
 	g_solution_data.addRelativeHumidity(LPP_CHANNEL_HUMID_2, bme.humidity);
 	g_solution_data.addTemperature(LPP_CHANNEL_TEMP_2, bme.temperature);
+	sensor_cache_set(CACHE_TEMP, bme.temperature, ENV_ID, QUALITY_RAK1906);
+	sensor_cache_set(CACHE_HUMID, bme.humidity, ENV_ID, QUALITY_RAK1906);
+	sensor_cache_set(CACHE_PRESS, bme.pressure / 100.0, ENV_ID, QUALITY_RAK1906);
 	g_solution_data.addBarometricPressure(LPP_CHANNEL_PRESS_2, bme.pressure / 100);
-	g_solution_data.addAnalogInput(LPP_CHANNEL_GAS_2, (float)(bme.gas_resistance) / 1000.0);
+	if (bme_gas_running)
+	{
+		g_solution_data.addAnalogInput(LPP_CHANNEL_GAS_2, (float)(bme.gas_resistance) / 1000.0);
+	}
 
 #if MY_DEBUG > 0
 	MYLOG("BME", "RH= %.2f T= %.2f", bme.humidity, bme.temperature);
-	MYLOG("BME", "P= %.2f R= %.2f", bme.pressure / 100.0, (float)(bme.gas_resistance) / 1000.0);
+	MYLOG("BME", "P= %.2f R= %.2f", bme.pressure / 100.0, bme_gas_running ? (float)(bme.gas_resistance) / 1000.0 : 0.0);
 #endif
 	return true;
 }
 
 /**
- * @brief Calculate and return the altitude
- *        based on the barometric pressure
- *        Requires to have MSL set
+ * @brief Read the barometric pressure for the altitude
+ *        without adding it to the payload
  *
- * @return uint16_t altitude in cm
+ * @param pressure pointer for the pressure in hPa
+ * @return true if reading was successful
+ * @return false if reading failed
  */
-uint16_t get_alt_rak1906(void)
+bool get_press_rak1906(float *pressure)
 {
-	// Get latest values
-	start_rak1906();
-	delay(250);
-	if (!read_rak1906())
+	// No heater needed for the pressure
+	if (bme_running || !bme_start(false) || !bme_finish())
 	{
-		return 0xFFFF;
+		MYLOG("BME", "BME reading failed");
+		return false;
 	}
-
-	MYLOG("BME", "Compute altitude\n");
-	// pressure in HPa
-	float pressure = bme.pressure / 100.0;
-	MYLOG("BME", "P: %.2f MSL: %.2f", bme.pressure / 100.0, mean_seal_level_press);
-
-	float A = pressure / mean_seal_level_press; // (1013.25) by default;
-	float B = 1 / 5.25588;
-	float C = pow(A, B);
-	C = 1.0 - C;
-	C = C / 0.0000225577;
-	uint16_t new_val = C * 100;
-	MYLOG("BME", "Altitude: %.2f m / %d cm", C, new_val);
-	return new_val;
+	sensor_cache_set(CACHE_TEMP, bme.temperature, ENV_ID, QUALITY_RAK1906);
+	sensor_cache_set(CACHE_HUMID, bme.humidity, ENV_ID, QUALITY_RAK1906);
+	sensor_cache_set(CACHE_PRESS, bme.pressure / 100.0, ENV_ID, QUALITY_RAK1906);
+	*pressure = bme.pressure / 100.0;
+	return true;
 }
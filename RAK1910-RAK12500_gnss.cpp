@@ -17,14 +17,6 @@
 /** Instance for RAK12500 GNSS sensor */
 SFE_UBLOX_GNSS my_gnss;
 
-// GNSS functions
-#define NO_GNSS_INIT 0
-#define RAK1910_GNSS 1
-#define RAK12500_GNSS 2
-
-// Fake GPS Enable (1) Disable (0)
-#define FAKE_GPS 1
-
 /** GNSS polling function */
 bool poll_gnss(void);
 
@@ -37,6 +29,86 @@ bool i2c_gnss = false;
 /** The GPS module to use */
 uint8_t g_gnss_option = 0;
 
+/** RAK1910 UART baudrate used by the application */
+#define RAK1910_BAUD 115200
+/** RAK1910 UART baudrate after power up (u-blox MAX-7Q default) */
+#define RAK1910_DEFAULT_BAUD 9600
+/** Interval to drain the UART into the parser, must be shorter than the time to fill the UART RX buffer */
+#define RAK1910_DRAIN_INTERVAL 10
+/** Time to wait for valid NMEA sentences when probing for a RAK1910, the module sends one burst per second */
+#define RAK1910_PROBE_TIME 1100
+
+/** Flag if the UART drain timer was created */
+bool rak1910_timer_created = false;
+
+/**
+ * @brief Move all received bytes from the UART into the parser
+ *
+ * @param data unused
+ */
+void rak1910_drain(void *data)
+{
+	while (Serial1.available())
+	{
+		gnss_parser_feed(Serial1.read());
+	}
+}
+
+/**
+ * @brief Switch the RAK1910 UART from the default baudrate to RAK1910_BAUD
+ *        The MAX-7Q falls back to 9600 Baud after a power cycle.
+ *        A module that is already on RAK1910_BAUD ignores the command.
+ *
+ */
+void rak1910_set_baud(void)
+{
+	Serial1.end();
+	Serial1.begin(RAK1910_DEFAULT_BAUD);
+	// UART1, in UBX+NMEA+RTCM, out UBX+NMEA, 115200 Baud, no autobauding
+	Serial1.print("$PUBX,41,1,0007,0003,115200,0*18\r\n");
+	Serial1.flush();
+	delay(10);
+	Serial1.end();
+	Serial1.begin(RAK1910_BAUD);
+}
+
+/**
+ * @brief Check if a RAK1910 is connected to the UART
+ *        The RAK1910 is not found by the I2C scan, only called if no RAK12500 answered on I2C
+ *        The power supply (WB_IO2) is already on and stays on, it is shared with other modules
+ *
+ * @return true if valid NMEA sentences were received
+ * @return false if no RAK1910 was found
+ */
+bool probe_rak1910(void)
+{
+	rak1910_set_baud();
+
+	time_t probe_start = millis();
+	while ((millis() - probe_start) < RAK1910_PROBE_TIME)
+	{
+		rak1910_drain(NULL);
+		if (gnss_parser_valid() != 0)
+		{
+			MYLOG("GNSS", "RAK1910 found on Serial1");
+			g_gnss_option = RAK1910_GNSS;
+			return true;
+		}
+		delay(10);
+	}
+	Serial1.end();
+	return false;
+}
+
+/**
+ * @brief Stop draining the UART while the RAK1910 is powered down
+ *
+ */
+void stop_rak1910(void)
+{
+	api.system.timer.stop(RAK_TIMER_3);
+}
+
 /**
  * @brief Initialize GNSS module
  *
@@ -45,11 +117,14 @@ uint8_t g_gnss_option = 0;
  */
 bool init_gnss(void)
 {
-	// Power on the GNSS module
-	digitalWrite(WB_IO2, HIGH);
+	// Power on or wake up the GNSS module
+	gnss_power_up();
 
-	// Give the module some time to power up
-	delay(500);
+#if GNSS_SIM > 0
+	// Recorded trace instead of a GNSS module
+	g_gnss_option = SIM_GNSS;
+	return init_gnss_sim();
+#endif
 
 	if (g_gnss_option == NO_GNSS_INIT)
 	{
@@ -73,6 +148,9 @@ bool init_gnss(void)
 
 				my_gnss.setMeasurementRate(500);
 
+				// Push last location and time for a fast start
+				gnss_restore_assist();
+
 				return true;
 			}
 		}
@@ -80,6 +158,26 @@ bool init_gnss(void)
 	}
 	else
 	{
+		if (g_gnss_option == RAK1910_GNSS)
+		{
+			// Module stays powered, but if it restarted (e.g. brown out) it is back on the default baudrate
+			rak1910_set_baud();
+			// Drain the UART in the background while the module is searching
+			if (!rak1910_timer_created)
+			{
+				if (!api.system.timer.create(RAK_TIMER_3, rak1910_drain, RAK_TIMER_PERIODIC))
+				{
+					MYLOG("GNSS", "Creating UART timer failed.");
+					return false;
+				}
+				rak1910_timer_created = true;
+			}
+			// Skip sentences from before the power up
+			rak1910_drain(NULL);
+			gnss_fix_s old_fix;
+			gnss_parser_get_fix(&old_fix);
+			api.system.timer.start(RAK_TIMER_3, RAK1910_DRAIN_INTERVAL, NULL);
+		}
 		if (g_gnss_option == RAK12500_GNSS)
 		{
 			if (found_sensors[GNSS_ID].i2c_num == 1)
@@ -100,6 +198,32 @@ bool init_gnss(void)
 	return false;
 }
 
+/**
+ * @brief Add a location to the payload in the selected format
+ *
+ * @param fix location to add
+ */
+void gnss_add_payload(gnss_fix_s *fix)
+{
+	// Barometric altitude calibrated by the GNSS, falls back to the GNSS altitude without barometer
+	int32_t altitude = altitude_get(fix);
+	switch (gnss_format)
+	{
+	case LPP_4_DIGIT:
+		g_solution_data.addGNSS_4(LPP_CHANNEL_GPS, fix->latitude, fix->longitude, altitude);
+		break;
+	case LPP_6_DIGIT:
+		g_solution_data.addGNSS_6(LPP_CHANNEL_GPS, fix->latitude, fix->longitude, altitude);
+		break;
+	case HELIUM_MAPPER:
+		g_solution_data.addGNSS_H(fix->latitude, fix->longitude, altitude, fix->hdop, api.system.bat.get());
+		break;
+	case FIELD_TESTER:
+		g_solution_data.addGNSS_T(fix->latitude, fix->longitude, altitude, fix->hdop, fix->satellites);
+		break;
+	}
+}
+
 /**
  * @brief Check GNSS module for position
  *
@@ -117,8 +241,6 @@ bool poll_gnss(void)
 	int16_t accuracy = 0;
 	uint8_t satellites = 0;
 
-	time_t check_limit = g_send_interval_time / 2;
-
 	bool has_pos = false;
 	bool has_alt = false;
 
@@ -147,10 +269,24 @@ bool poll_gnss(void)
 				last_read_ok = true;
 				latitude = my_gnss.getLatitude();
 				longitude = my_gnss.getLongitude();
-				altitude = my_gnss.getAltitude();
+				altitude = my_gnss.getAltitudeMSL();
 				accuracy = my_gnss.getHorizontalDOP();
 				satellites = my_gnss.getSIV();
 
+				g_last_fix.latitude = latitude;
+				g_last_fix.longitude = longitude;
+				g_last_fix.altitude = altitude;
+				g_last_fix.hdop = accuracy;
+				g_last_fix.satellites = satellites;
+				g_last_fix.fix_type = fix_type;
+				// Poll a new PVT packet, the time is read from this packet and stamped with its arrival
+				my_gnss.getPVT();
+				time_t pvt_stamp = millis();
+				uint32_t fix_us = 0;
+				g_last_fix.unix_time = my_gnss.getUnixEpoch(fix_us);
+				// Set the RTC from the GNSS time
+				rtc_sync(g_last_fix.unix_time, fix_us / 1000, pvt_stamp, RTC_SYNC_GNSS);
+
 				// MYLOG("GNSS", "Fixtype: %d %s", my_gnss.getFixType(), fix_type_str);
 				// MYLOG("GNSS", "Lat: %.4f Lon: %.4f", latitude / 10000000.0, longitude / 10000000.0);
 				// MYLOG("GNSS", "Alt: %.2f", altitude / 1000.0);
@@ -159,66 +295,57 @@ bool poll_gnss(void)
 		}
 	}
 
-	char disp_str[255];
-	if (last_read_ok)
+	if (g_gnss_option == RAK1910_GNSS)
 	{
-		if ((latitude == 0) && (longitude == 0))
+		gnss_fix_s uart_fix;
+		rak1910_drain(NULL);
+		if (gnss_parser_get_fix(&uart_fix) && (uart_fix.fix_type >= 3) && (uart_fix.satellites >= 5))
 		{
-			last_read_ok = false;
-			return false;
+			last_read_ok = true;
+			latitude = uart_fix.latitude;
+			longitude = uart_fix.longitude;
+			altitude = uart_fix.altitude;
+			accuracy = uart_fix.hdop;
+			satellites = uart_fix.satellites;
+			g_last_fix = uart_fix;
+			// Set the RTC from the GNSS time, NMEA has no sub-second part, the time is from the second tick before the RMC
+			rtc_sync(g_last_fix.unix_time, 0, gnss_parser_fix_stamp(), RTC_SYNC_GNSS);
 		}
+	}
 
-		switch (gnss_format)
+#if GNSS_SIM > 0
+	if (g_gnss_option == SIM_GNSS)
+	{
+		gnss_fix_s sim_fix;
+		if (poll_gnss_sim(&sim_fix) && (sim_fix.fix_type >= 3) && (sim_fix.satellites >= 5))
 		{
-		case LPP_4_DIGIT:
-			g_solution_data.addGNSS_4(LPP_CHANNEL_GPS, latitude, longitude, altitude);
-			break;
-		case LPP_6_DIGIT:
-			g_solution_data.addGNSS_6(LPP_CHANNEL_GPS, latitude, longitude, altitude);
-			break;
-		case HELIUM_MAPPER:
-			g_solution_data.addGNSS_H(latitude, longitude, altitude, accuracy, api.system.bat.get());
-			break;
-		case FIELD_TESTER:
-			g_solution_data.addGNSS_T(latitude, longitude, altitude, accuracy, satellites);
-			break;
+			last_read_ok = true;
+			latitude = sim_fix.latitude;
+			longitude = sim_fix.longitude;
+			altitude = sim_fix.altitude;
+			accuracy = sim_fix.hdop;
+			satellites = sim_fix.satellites;
+			g_last_fix = sim_fix;
 		}
-
-		// if (found_sensors[OLED_ID].found_sensor)
-		// {
-		// 	sprintf(disp_str, "%.2f %.2f %.2f", latitude / 10000000.0, longitude / 10000000.0, altitude / 1000.0, accuracy / 100.0);
-		// 	rak1921_add_line(disp_str);
-		// }
-		return true;
 	}
-	else
+#endif
+
+	char disp_str[255];
+	if (last_read_ok)
 	{
-		// No location found
-#if FAKE_GPS > 0
-		MYLOG("GNSS", "Faking GPS");
-		// 14.4213730, 121.0069140, 35.000
-		latitude = 144213730;
-		longitude = 1210069140;
-		altitude = 35000;
-		accuracy = 1;
-		satellites = 5;
-
-		switch (gnss_format)
+		if ((latitude == 0) && (longitude == 0))
 		{
-		case LPP_4_DIGIT:
-			g_solution_data.addGNSS_4(LPP_CHANNEL_GPS, latitude, longitude, altitude);
-			break;
-		case LPP_6_DIGIT:
-			g_solution_data.addGNSS_6(LPP_CHANNEL_GPS, latitude, longitude, altitude);
-			break;
-		case HELIUM_MAPPER:
-			g_solution_data.addGNSS_H(latitude, longitude, altitude, accuracy, api.system.bat.get());
-			break;
-		case FIELD_TESTER:
-			g_solution_data.addGNSS_T(latitude, longitude, altitude, accuracy, satellites);
-			break;
+			last_read_ok = false;
+			return false;
 		}
-		last_read_ok = true;
+
+		// Update TTFF statistics and location cache
+		gnss_fix_acquired();
+
+		// Calibrate the MSL pressure with the new fix
+		altitude_gnss_update(&g_last_fix);
+
+		gnss_add_payload(&g_last_fix);
 
 		// if (found_sensors[OLED_ID].found_sensor)
 		// {
@@ -226,7 +353,6 @@ bool poll_gnss(void)
 		// 	rak1921_add_line(disp_str);
 		// }
 		return true;
-#endif
 	}
 
 	// if (found_sensors[OLED_ID].found_sensor)
@@ -35,6 +35,8 @@ uint16_t check_gnss_max_try = 0;
 
 /** Flag for GNSS readings active */
 bool gnss_active = false;
+/** Flag for sensor uplink waiting for its TX callback */
+volatile bool sensor_uplink_pending = false;
 
 /**
  * @brief Callback after packet was received
@@ -69,11 +71,34 @@ void receiveCallback(SERVICE_LORA_RECEIVE_T *data)
  */
 void sendCallback(int32_t status)
 {
-	gnss_active = false;
+	// Thermal frame fragments (fPort 12) must not end a running location acquisition
+	if (sensor_uplink_pending)
+	{
+		sensor_uplink_pending = false;
+		gnss_active = false;
+	}
 	MYLOG("TX-CB", "TX status %d", status);
 	digitalWrite(LED_BLUE, LOW);
 }
 
+/**
+ * @brief Callback after a DeviceTimeReq
+ *
+ * @param status GET_DEVICE_TIME_OK if the network time was received
+ */
+void timeReqCallback(int32_t status)
+{
+	if (status == GET_DEVICE_TIME_OK)
+	{
+		MYLOG("TIME-CB", "Network time received");
+		rtc_sync_lorawan();
+	}
+	else
+	{
+		MYLOG("TIME-CB", "Network time request failed");
+	}
+}
+
 /**
  * @brief Callback after join request cycle
  *
@@ -123,6 +148,7 @@ void setup()
 	api.lorawan.registerRecvCallback(receiveCallback);
 	api.lorawan.registerSendCallback(sendCallback);
 	api.lorawan.registerJoinCallback(joinCallback);
+	api.lorawan.registerTimereqCallback(timeReqCallback);
 
 	pinMode(LED_GREEN, OUTPUT);
 	digitalWrite(LED_GREEN, HIGH);
@@ -231,14 +257,23 @@ void setup()
 	// Get saved sending frequency from flash
 	get_at_setting(SEND_INTERVAL_OFFSET);
 
-	// Create a timer.
-	api.system.timer.create(RAK_TIMER_0, sensor_handler, RAK_TIMER_PERIODIC);
-	if (g_send_interval_time != 0)
+	// Register the custom AT command for the report-on-change rules
+	if (!init_report_at())
 	{
-		// Start a timer.
-		api.system.timer.start(RAK_TIMER_0, g_send_interval_time, NULL);
+		MYLOG("SETUP", "Add custom AT command RULE fail");
 	}
 
+	// SCD30 measurement interval follows the send interval
+	if (found_sensors[CO2_ID].found_sensor)
+	{
+		rak12037_set_interval();
+	}
+
+	// Create a timer.
+	api.system.timer.create(RAK_TIMER_0, sensor_handler, RAK_TIMER_PERIODIC);
+	// Move the first uplink to the next wall clock boundary if enabled
+	rtc_restart_uplink_timer();
+
 	// If a GNSS module was found, setup a timer for the GNSS aqcuisions
 	if (found_sensors[GNSS_ID].found_sensor)
 	{
@@ -272,9 +307,8 @@ void gnss_handler(void *)
 	digitalWrite(LED_GREEN, HIGH);
 	if (poll_gnss())
 	{
-		// Power down the module
-		digitalWrite(WB_IO2, LOW);
-		delay(100);
+		// Power down the module or put it into backup mode
+		gnss_power_down();
 		MYLOG("GNSS", "Got location");
 		api.system.timer.stop(RAK_TIMER_1);
 		send_packet();
@@ -283,9 +317,8 @@ void gnss_handler(void *)
 	{
 		if (check_gnss_counter >= check_gnss_max_try)
 		{
-			// Power down the module
-			digitalWrite(WB_IO2, LOW);
-			delay(100);
+			// Power down the module or put it into backup mode
+			gnss_power_down();
 			MYLOG("GNSS", "Location timeout");
 			api.system.timer.stop(RAK_TIMER_1);
 			if (gnss_format != HELIUM_MAPPER)
@@ -312,6 +345,9 @@ void sensor_handler(void *)
 	// Reset trigger time
 	last_trigger = millis();
 
+	// Keep the uplinks on the wall clock boundaries, corrects the timer drift every cycle
+	rtc_restart_uplink_timer();
+
 	// Check if the node has joined the network
 	if (!api.lorawan.njs.get())
 	{
@@ -319,6 +355,12 @@ void sensor_handler(void *)
 		return;
 	}
 
+	// Request the network time with this uplink if the RTC needs it
+	rtc_sync_request();
+
+	// Uplinks started by motion or events are always sent
+	bool triggered = motion_detected || g_event_triggered;
+
 	// Just for debug, show if the call is because of a motion detection
 	if (motion_detected)
 	{
@@ -335,6 +377,9 @@ void sensor_handler(void *)
 
 	// Clear payload
 	g_solution_data.reset();
+	// Sensors can request to skip this uplink if nothing changed
+	g_uplink_suppress = false;
+	g_uplink_force = triggered;
 
 	// Helium Mapper ignores sensor and sends only location data
 	if ((gnss_format != HELIUM_MAPPER) && (gnss_format != FIELD_TESTER))
@@ -344,6 +389,46 @@ void sensor_handler(void *)
 
 		// Add battery voltage
 		g_solution_data.addVoltage(LPP_CHANNEL_BATT, api.system.bat.get());
+
+		// Report-on-change rules decide if the values are worth an uplink
+		report_check();
+	}
+
+	// The GNSS polling timer uses only the cached pressure for the altitude
+	if (found_sensors[GNSS_ID].found_sensor)
+	{
+		altitude_refresh();
+	}
+
+	// Sensors and report rules found nothing worth an uplink, the location is not needed either
+	if (!gnss_active && g_uplink_suppress && !g_uplink_force)
+	{
+		if (found_sensors[GNSS_ID].found_sensor)
+		{
+			// The module might have woken up from backup mode, put it back to sleep
+			gnss_skip_acquisition();
+		}
+		MYLOG("UPLINK", "Values unchanged, skip sending");
+		return;
+	}
+
+	// Check if the location needs to be aquired in this cycle
+	if ((found_sensors[GNSS_ID].found_sensor) && !gnss_active && !gnss_acquisition_needed())
+	{
+		// The module might have woken up from backup mode, put it back to sleep
+		gnss_skip_acquisition();
+		// Device did not move, reuse the last location
+		if (gnss_is_static())
+		{
+			gnss_add_payload(&g_last_fix);
+		}
+		else if (gnss_format == HELIUM_MAPPER)
+		{
+			// Helium Mapper without location makes no sense
+			return;
+		}
+		send_packet();
+		return;
 	}
 
 	// If it is a GNSS location tracker, start the timer to aquire the location
@@ -353,11 +438,12 @@ void sensor_handler(void *)
 		gnss_active = true;
 		// Startup GNSS module
 		init_gnss();
+		gnss_acquisition_start();
 		// Start the timer
 		api.system.timer.start(RAK_TIMER_1, 2500, NULL);
 		check_gnss_counter = 0;
-		// Max location aquisition time is half of send interval
-		check_gnss_max_try = g_send_interval_time / 2 / 2500;
+		// Max location aquisition time is learned from previous TTFF's, max half of send interval
+		check_gnss_max_try = gnss_acquisition_timeout() / 2500;
 	}
 	else if (gnss_active)
 	{
@@ -372,14 +458,45 @@ void sensor_handler(void *)
 
 /**
  * @brief This example is complete timer
- * driven. The loop() does nothing than
- * sleep.
+ * driven. The loop() only sets the RTC,
+ * analyses vibration samples, sends thermal
+ * frame fragments, checks the tank level
+ * and sleeps.
  *
  */
 void loop()
 {
-	// api.system.sleep.all();
-	api.system.scheduler.task.destroy();
+	// Set the RTC outside of the timer and LoRaWAN callbacks, it blocks up to 3 seconds
+	rtc_sync_process();
+
+	// Analyse the RAK1904 samples the FIFO interrupt moved into the ring buffer
+	if (found_sensors[ACC_ID].found_sensor)
+	{
+		vib_process();
+	}
+
+	// Send pending fragments of a RAK12040 thermal frame, wake up when the next one is due
+	uint32_t next_wakeup = 0;
+	if (found_sensors[TEMP_ARR_ID].found_sensor)
+	{
+		next_wakeup = thermal_send_fragment();
+	}
+	// Check the RAK12014 tank level for alarms between the uplinks
+	if (found_sensors[TOF_ID].found_sensor)
+	{
+		uint32_t next_check = tank_check();
+		if ((next_check != 0) && ((next_wakeup == 0) || (next_check < next_wakeup)))
+		{
+			next_wakeup = next_check;
+		}
+	}
+	if (next_wakeup != 0)
+	{
+		api.system.sleep.cpu(next_wakeup);
+		return;
+	}
+	// Sleep until the next timer or interrupt
+	api.system.sleep.cpu();
 }
 
 /**
@@ -406,9 +523,14 @@ void send_packet(void)
 	if (api.lorawan.send(g_solution_data.getSize(), g_solution_data.getBuffer(), set_fPort, g_confirmed_mode, g_confirmed_retry))
 	{
 		MYLOG("UPLINK", "Packet enqueued");
+		sensor_uplink_pending = true;
+		// Values are reported, the report rules compare against them from now on
+		report_sent();
 	}
 	else
 	{
 		MYLOG("UPLINK", "Send failed");
+		// No TX callback will come, the acquisition cycle ends here
+		gnss_active = false;
 	}
 }
@@ -0,0 +1,244 @@
+/**
+ * @file altitude.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Barometric altitude with MSL pressure calibrated from GNSS fixes
+ *        Kalman filter on the MSL pressure, barometric formula from a lookup table
+ * @version 0.1
+ * @date 2022-07-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** First pressure ratio p/p0 of the lookup table */
+#define ALT_LUT_START 0.40f
+/** Pressure ratio step of the lookup table */
+#define ALT_LUT_STEP 0.01f
+/** Number of lookup table entries, p/p0 0.40 ... 1.10 covers ~7100 m to ~ -800 m */
+#define ALT_LUT_SIZE 71
+/** Altitude scale of the barometric formula in m */
+#define ALT_SCALE 44330.8f
+/** Exponent of the barometric formula (1 / 5.25588) */
+#define ALT_EXPONENT 0.190263f
+
+/** Min satellites of a fix used for the calibration */
+#define ALT_CAL_MIN_SAT 6
+/** Max HDOP (0.01) of a fix used for the calibration */
+#define ALT_CAL_MAX_HDOP 300
+/** Vertical error of the GNSS in m per HDOP */
+#define ALT_GNSS_SIGMA 5.0f
+/** Initial uncertainty of the MSL pressure in hPa, standard atmosphere vs. weather */
+#define ALT_P0_SIGMA 30.0f
+/** Drift of the MSL pressure with the weather in hPa^2 per hour */
+#define ALT_P0_DRIFT 0.5f
+/** Noise of a pressure reading converted to altitude in m^2 */
+#define ALT_BARO_NOISE 1.0f
+/** Max age of a cached pressure reading in ms before the barometer is read again */
+#define ALT_PRESS_MAX_AGE 60000
+
+/** (p/p0)^(1/5.25588) for p/p0 = 0.40 ... 1.10 */
+static const float alt_lut[ALT_LUT_SIZE] = {
+	0.840014f, 0.843970f, 0.847849f, 0.851653f, 0.855386f, 0.859051f,
+	0.862651f, 0.866188f, 0.869665f, 0.873083f, 0.876446f, 0.879754f,
+	0.883011f, 0.886217f, 0.889374f, 0.892484f, 0.895549f, 0.898570f,
+	0.901549f, 0.904486f, 0.907382f, 0.910241f, 0.913061f, 0.915845f,
+	0.918593f, 0.921307f, 0.923987f, 0.926635f, 0.929250f, 0.931835f,
+	0.934389f, 0.936915f, 0.939411f, 0.941880f, 0.944321f, 0.946736f,
+	0.949125f, 0.951488f, 0.953827f, 0.956142f, 0.958433f, 0.960701f,
+	0.962946f, 0.965169f, 0.967371f, 0.969552f, 0.971712f, 0.973852f,
+	0.975971f, 0.978072f, 0.980153f, 0.982216f, 0.984261f, 0.986287f,
+	0.988296f, 0.990288f, 0.992263f, 0.994221f, 0.996164f, 0.998090f,
+	1.000000f, 1.001895f, 1.003775f, 1.005640f, 1.007490f, 1.009326f,
+	1.011148f, 1.012956f, 1.014751f, 1.016532f, 1.018299f};
+
+/** Mean Sea Level Pressure, estimated from the GNSS fixes */
+float mean_seal_level_press = 1013.25;
+/** Variance of the MSL pressure estimate in hPa^2 */
+float alt_p0_var = ALT_P0_SIGMA * ALT_P0_SIGMA;
+/** millis() of the last prediction step */
+time_t alt_p0_time = 0;
+/** Last fix used for the calibration, already part of the MSL pressure estimate */
+gnss_fix_s alt_cal_fix = {0};
+
+/**
+ * @brief (p/p0)^(1/5.25588) from the lookup table, linear interpolation
+ *        Max error compared to pow(), converted to altitude:
+ *        ~0.12 m for p/p0 0.90 ... 1.10 (below ~900 m)
+ *        ~0.22 m for p/p0 0.60 ... 0.90 (up to ~4100 m)
+ *        ~0.45 m for p/p0 0.40 ... 0.60 (up to ~7100 m)
+ *        Outside of 0.40 ... 1.10 the ratio is clamped to the table limits
+ *
+ * @param ratio pressure ratio p/p0
+ * @return float (p/p0)^(1/5.25588)
+ */
+static float alt_ratio_pow(float ratio)
+{
+	float pos = (ratio - ALT_LUT_START) / ALT_LUT_STEP;
+	if (pos <= 0.0f)
+	{
+		return alt_lut[0];
+	}
+	if (pos >= ALT_LUT_SIZE - 1)
+	{
+		return alt_lut[ALT_LUT_SIZE - 1];
+	}
+	uint8_t idx = (uint8_t)pos;
+	float frac = pos - idx;
+	return alt_lut[idx] + frac * (alt_lut[idx + 1] - alt_lut[idx]);
+}
+
+/**
+ * @brief Altitude from the barometric formula
+ *
+ * @param pressure pressure in hPa
+ * @return float altitude above MSL in m
+ */
+float altitude_from_pressure(float pressure)
+{
+	return ALT_SCALE * (1.0f - alt_ratio_pow(pressure / mean_seal_level_press));
+}
+
+/**
+ * @brief Read the barometer if the cached pressure is too old
+ *        Helium Mapper and Field Tester do not read the sensors, the barometer is read here then.
+ *        Called from sensor_handler before the GNSS acquisition starts, the GNSS polling
+ *        runs in the timer context and must not access the I2C bus
+ *
+ */
+void altitude_refresh(void)
+{
+	float pressure;
+	if (sensor_cache_get(CACHE_PRESS, &pressure, ALT_PRESS_MAX_AGE))
+	{
+		return;
+	}
+	if (found_sensors[PRESS_ID].found_sensor)
+	{
+		get_press_rak1902(&pressure);
+	}
+	else if (found_sensors[ENV_ID].found_sensor)
+	{
+		get_press_rak1906(&pressure);
+	}
+}
+
+/**
+ * @brief Get the pressure reading from the cache
+ *        The acquisition takes max half of the send interval, the value
+ *        refreshed at the start of the cycle is accepted until then
+ *
+ * @param pressure pointer for the pressure in hPa
+ * @return true if a pressure is available
+ * @return false if no recent pressure is in the cache
+ */
+static bool alt_get_pressure(float *pressure)
+{
+	return sensor_cache_get(CACHE_PRESS, pressure, ALT_PRESS_MAX_AGE + g_send_interval_time / 2);
+}
+
+/**
+ * @brief Kalman prediction, the MSL pressure drifts with the weather
+ *
+ */
+static void alt_predict(void)
+{
+	time_t now = millis();
+	if (alt_p0_time != 0)
+	{
+		alt_p0_var += ALT_P0_DRIFT * (now - alt_p0_time) / 3600000.0f;
+	}
+	alt_p0_time = now;
+	if (alt_p0_var > ALT_P0_SIGMA * ALT_P0_SIGMA)
+	{
+		alt_p0_var = ALT_P0_SIGMA * ALT_P0_SIGMA;
+	}
+}
+
+/**
+ * @brief Variance of the barometric altitude in m^2
+ *
+ * @param pressure pressure in hPa
+ * @return float variance from the MSL pressure uncertainty and the sensor noise
+ */
+static float alt_baro_var(float pressure)
+{
+	// dh/dp0 = scale * exponent * (p/p0)^exponent / p0
+	float slope = ALT_SCALE * ALT_EXPONENT * alt_ratio_pow(pressure / mean_seal_level_press) / mean_seal_level_press;
+	return slope * slope * alt_p0_var + ALT_BARO_NOISE;
+}
+
+/**
+ * @brief Calibrate the MSL pressure with a new GNSS fix
+ *        Only 3D fixes with enough satellites and a good HDOP are used,
+ *        the GNSS altitude error is weighted with the HDOP
+ *
+ * @param fix new GNSS fix
+ */
+void altitude_gnss_update(gnss_fix_s *fix)
+{
+	float pressure;
+	if (!alt_get_pressure(&pressure))
+	{
+		return;
+	}
+
+	alt_predict();
+
+	if ((fix->fix_type < 3) || (fix->satellites < ALT_CAL_MIN_SAT) || (fix->hdop > ALT_CAL_MAX_HDOP))
+	{
+		MYLOG("ALT", "Fix not used for calibration, HDOP %.2f, %d sats", fix->hdop / 100.0, fix->satellites);
+		return;
+	}
+
+	float gnss_sigma = ALT_GNSS_SIGMA * (fix->hdop < 100 ? 1.0f : fix->hdop / 100.0f);
+	float ratio_pow = alt_ratio_pow(pressure / mean_seal_level_press);
+	float baro_alt = ALT_SCALE * (1.0f - ratio_pow);
+	float slope = ALT_SCALE * ALT_EXPONENT * ratio_pow / mean_seal_level_press;
+
+	// Extended Kalman update, the measurement is the GNSS altitude, the state the MSL pressure
+	float innovation = fix->altitude / 1000.0f - baro_alt;
+	float innovation_var = slope * slope * alt_p0_var + gnss_sigma * gnss_sigma + ALT_BARO_NOISE;
+	float gain = alt_p0_var * slope / innovation_var;
+	mean_seal_level_press += gain * innovation;
+	alt_p0_var *= 1.0f - gain * slope;
+	alt_cal_fix = *fix;
+
+	MYLOG("ALT", "P: %.2f GNSS: %.1f m Baro: %.1f m MSL: %.2f +/- %.2f hPa", pressure, fix->altitude / 1000.0,
+		  baro_alt, mean_seal_level_press, sqrtf(alt_p0_var));
+}
+
+/**
+ * @brief Fused altitude for the payload
+ *        Inverse variance weighted barometric and GNSS altitude,
+ *        fixes used for the calibration are already part of the barometric altitude.
+ *        Falls back to the GNSS altitude if no barometer is available
+ *
+ * @param fix GNSS fix
+ * @return int32_t altitude in mm above MSL
+ */
+int32_t altitude_get(gnss_fix_s *fix)
+{
+	float pressure;
+	if (!alt_get_pressure(&pressure))
+	{
+		return fix->altitude;
+	}
+
+	alt_predict();
+
+	float baro_alt = altitude_from_pressure(pressure);
+	float baro_var = alt_baro_var(pressure);
+	if (memcmp(fix, &alt_cal_fix, sizeof(gnss_fix_s)) == 0)
+	{
+		MYLOG("ALT", "Baro %.1f +/- %.1f m", baro_alt, sqrtf(baro_var));
+		return (int32_t)(baro_alt * 1000.0f);
+	}
+	float gnss_sigma = ALT_GNSS_SIGMA * (fix->hdop < 100 ? 1.0f : fix->hdop / 100.0f);
+	float gnss_var = gnss_sigma * gnss_sigma;
+	float altitude = (baro_alt * gnss_var + fix->altitude / 1000.0f * baro_var) / (baro_var + gnss_var);
+
+	MYLOG("ALT", "Baro %.1f +/- %.1f m GNSS %.1f +/- %.1f m fused %.1f m", baro_alt, sqrtf(baro_var),
+		  fix->altitude / 1000.0, gnss_sigma, altitude);
+	return (int32_t)(altitude * 1000.0f);
+}
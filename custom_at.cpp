@@ -13,8 +13,24 @@
 // Forward declarations
 int send_interval_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int rtc_command_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int rtc_align_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int rtc_wake_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int gnss_format_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int gnss_pwr_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int acc_stream_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int vib_band_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int fusion_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int mag_cal_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int tank_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int tank_alarm_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int tof_budget_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int thermal_img_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int press_mode_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int bme_gas_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int event_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int report_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int status_handler(SERIAL_PORT port, char *cmd, stParam *param);
+static bool at_check_digits(stParam *param);
 
 uint32_t g_send_interval_time = 0;
 
@@ -75,15 +91,15 @@ int send_interval_handler(SERIAL_PORT port, char *cmd, stParam *param)
 		g_send_interval_time = new_send_interval * 1000;
 
 		MYLOG("AT_CMD", "New interval %ld", g_send_interval_time);
-		// Stop the timer
-		api.system.timer.stop(RAK_TIMER_0);
-		if (g_send_interval_time != 0)
-		{
-			// Restart the timer
-			api.system.timer.start(RAK_TIMER_0, g_send_interval_time, NULL);
-		}
+		// Restart the timer, aligned to the wall clock if enabled
+		rtc_restart_uplink_timer();
 		// Save custom settings
 		save_at_setting(SEND_INTERVAL_OFFSET);
+		// SCD30 measurement interval follows the send interval
+		if (found_sensors[CO2_ID].found_sensor)
+		{
+			rak12037_set_interval();
+		}
 	}
 	else
 	{
@@ -101,9 +117,32 @@ int send_interval_handler(SERIAL_PORT port, char *cmd, stParam *param)
  */
 bool init_rtc_at(void)
 {
-	return api.system.atMode.add((char *)"RTC",
-								 (char *)"Set/Get time of RTC module RAK12002 format [yyyy:mm:dd:hh:MM]",
-								 (char *)"RTC", rtc_command_handler);
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"RTC",
+								   (char *)"Set/Get time of RTC module RAK12002 format [yyyy:mm:dd:hh:MM]",
+								   (char *)"RTC", rtc_command_handler);
+
+	result &= api.system.atMode.add((char *)"ALIGN",
+									(char *)"Set/Get alignment of the uplinks to the wall clock. 0 = off, 1 = on multiples of the send interval",
+									(char *)"ALIGN", rtc_align_handler);
+
+	result &= api.system.atMode.add((char *)"RTCWAKE",
+									(char *)"Set/Get RAK12002 interrupt as wake up source. 0 = off, 1 or 3 to 6 = WisBlock IO of the RTC interrupt",
+									(char *)"RTCWAKE", rtc_wake_handler);
+
+	if (!get_at_setting(RTC_ALIGN_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get alignment setting");
+		result = false;
+	}
+	if (!get_at_setting(RTC_WAKE_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get RTC wake up setting");
+		result = false;
+	}
+	rtc_wake_setup();
+	return result;
 }
 
 /**
@@ -127,6 +166,12 @@ int rtc_command_handler(SERIAL_PORT port, char *cmd, stParam *param)
 		Serial.printf("%d.%02d.%02d %d:%02d:%02d\n", g_date_time.year, g_date_time.month,
 					  g_date_time.date, g_date_time.hour,
 					  g_date_time.minute, g_date_time.second);
+		if (g_rtc_sync.count != 0)
+		{
+			Serial.printf("Synced %d times, last from %s, offset %+ld ms, drift %+.2f ppm\n", g_rtc_sync.count,
+						  g_rtc_sync.source == RTC_SYNC_GNSS ? "GNSS" : (g_rtc_sync.source == RTC_SYNC_LORAWAN ? "LoRaWAN" : "AT command"),
+						  g_rtc_sync.offset_ms, g_rtc_sync.drift_ppm);
+		}
 	}
 	else if (param->argc == 5)
 	{
@@ -171,36 +216,1098 @@ int rtc_command_handler(SERIAL_PORT port, char *cmd, stParam *param)
 			return AT_PARAM_ERROR;
 		}
 
-		// Check day
-		date = strtoul(param->argv[2], NULL, 0);
+		// Check day
+		date = strtoul(param->argv[2], NULL, 0);
+
+		if ((date < 1) || (date > 31))
+		{
+			// MYLOG("AT_CMD", "Day error %d", date);
+			return AT_PARAM_ERROR;
+		}
+
+		// Check hour
+		hour = strtoul(param->argv[3], NULL, 0);
+
+		if (hour > 24)
+		{
+			// MYLOG("AT_CMD", "Hour error %d", hour);
+			return AT_PARAM_ERROR;
+		}
+
+		// Check minute
+		minute = strtoul(param->argv[4], NULL, 0);
+
+		if (minute > 59)
+		{
+			// MYLOG("AT_CMD", "Minute error %d", minute);
+			return AT_PARAM_ERROR;
+		}
+
+		set_rak12002((uint16_t)year, (uint8_t)month, (uint8_t)date, (uint8_t)hour, (uint8_t)minute);
+		// The wall clock changed, move the next uplink to the new boundary
+		rtc_restart_uplink_timer();
+
+		return AT_OK;
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for custom AT command for the wall clock alignment of the uplinks
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int rtc_align_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_rtc_align ? 1 : 0);
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_align = strtoul(param->argv[0], NULL, 10);
+
+		if (new_align > 1)
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set wall clock alignment %s", new_align ? "on" : "off");
+		g_rtc_align = new_align == 1;
+		if (!save_at_setting(RTC_ALIGN_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+		rtc_restart_uplink_timer();
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for custom AT command for the RTC wake up
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int rtc_wake_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_rtc_wake_pin);
+		if (g_rtc_wake_pin != 0)
+		{
+			Serial.printf("MCU clock vs. RTC %+.0f ppm\r\n", g_rtc_drift_ppm);
+		}
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_pin = strtoul(param->argv[0], NULL, 10);
+
+		if (new_pin > 6)
+		{
+			return AT_PARAM_ERROR;
+		}
+		// Pin must not be used by an event sensor or a module
+		if (!rtc_wake_pin_free(new_pin))
+		{
+			MYLOG("AT_CMD", "WB_IO%d is already used", new_pin);
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set RTC wake up pin WB_IO%d", new_pin);
+		g_rtc_wake_pin = new_pin;
+		if (!save_at_setting(RTC_WAKE_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+		rtc_wake_setup();
+		rtc_restart_uplink_timer();
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom GNSS AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_gnss_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"GNSS",
+								   (char *)"Change GNSS precision and payload format. 0 = 4digit prec., 1 = 6digit prec, 2 = Helium Mapper format, 3 = Field Tester format",
+								   (char *)"GNSS", gnss_format_handler);
+
+	if (!get_at_setting(GNSS_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get default GNSS settings");
+		result = false;
+	}
+	switch (gnss_format)
+	{
+	case LPP_4_DIGIT:
+		MYLOG("AT_CMD", "GNSS 4 digit Cayenne LPP");
+		break;
+	case LPP_6_DIGIT:
+		MYLOG("AT_CMD", "GNSS 6 digit extended Cayenne LPP");
+		break;
+	case HELIUM_MAPPER:
+		MYLOG("AT_CMD", "GNSS Helium Mapper data format");
+		break;
+	case FIELD_TESTER:
+		MYLOG("AT_CMD", "GNSS Field Tester data format");
+		break;
+	}
+
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for GNSS settings
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int gnss_format_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.print("=");
+		switch (gnss_format)
+		{
+		case LPP_4_DIGIT:
+			Serial.println("4 digit Cayenne LPP");
+			break;
+		case LPP_6_DIGIT:
+			Serial.println("6 digit extended Cayenne LPP");
+			break;
+		case HELIUM_MAPPER:
+			Serial.println("Helium Mapper data format");
+			break;
+		case FIELD_TESTER:
+			Serial.println("Field Tester data format");
+			break;
+		}
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t gnss_format_new = strtoul(param->argv[0], NULL, 10);
+
+		MYLOG("AT_CMD", "Requested format %ld", gnss_format_new);
+
+		if (gnss_format_new > FIELD_TESTER)
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set format to %d", gnss_format_new);
+		gnss_format = gnss_format_new;
+		if (!save_at_setting(GNSS_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom GNSS power mode AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_gnss_pwr_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"GNSSPWR",
+								   (char *)"Set GNSS power mode between acquisitions. 0 = power off, 1 = backup (hot start), 2 = power save",
+								   (char *)"GNSSPWR", gnss_pwr_handler);
+
+	if (!get_at_setting(GNSS_PWR_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get GNSS power mode");
+		result = false;
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for GNSS power mode
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int gnss_pwr_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_gnss_power_mode);
+		gnss_print_stats();
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_mode = strtoul(param->argv[0], NULL, 10);
+
+		if (new_mode > GNSS_PWR_SAVE)
+		{
+			return AT_PARAM_ERROR;
+		}
+		// Backup and power save mode are only supported by the RAK12500
+		if ((g_gnss_option == RAK1910_GNSS) && (new_mode != GNSS_PWR_OFF))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set GNSS power mode to %d", new_mode);
+		g_gnss_power_mode = new_mode;
+		if (!save_at_setting(GNSS_PWR_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom acceleration streaming AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_acc_stream_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"ACCSTR",
+								   (char *)"Set RAK1904 FIFO streaming. 0 = off, 1 to 7 = 1, 10, 25, 50, 100, 200, 400 Hz",
+								   (char *)"ACCSTR", acc_stream_handler);
+	result &= api.system.atMode.add((char *)"VIBBAND",
+									(char *)"Set/Get vibration band edges in Hz [e0:e1:e2:e3:e4] ascending, max 200",
+									(char *)"VIBBAND", vib_band_handler);
+
+	if (!get_at_setting(ACC_STREAM_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get ACC streaming setting");
+		result = false;
+	}
+	if (!get_at_setting(VIB_BAND_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get vibration bands");
+		result = false;
+	}
+	if (g_acc_stream_odr != 0)
+	{
+		rak1904_set_stream(g_acc_stream_odr);
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for acceleration streaming
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int acc_stream_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_acc_stream_odr);
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_odr = strtoul(param->argv[0], NULL, 10);
+
+		if (new_odr > 7)
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set ACC streaming to %d", new_odr);
+		if (!rak1904_set_stream(new_odr))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (!save_at_setting(ACC_STREAM_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for custom AT command for the vibration band edges
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int vib_band_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d:%d:%d:%d:%d\r\n", g_vib_band_edges[0], g_vib_band_edges[1], g_vib_band_edges[2],
+					  g_vib_band_edges[3], g_vib_band_edges[4]);
+	}
+	else if (param->argc == 5)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t edges[5];
+		for (uint8_t edge = 0; edge < 5; edge++)
+		{
+			edges[edge] = strtoul(param->argv[edge], NULL, 10);
+			// Ascending and below the Nyquist frequency of the highest ODR
+			if ((edges[edge] > 200) || ((edge != 0) && (edges[edge] <= edges[edge - 1])))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		for (uint8_t edge = 0; edge < 5; edge++)
+		{
+			g_vib_band_edges[edge] = edges[edge];
+		}
+		MYLOG("AT_CMD", "Vibration bands %ld %ld %ld %ld %ld Hz", edges[0], edges[1], edges[2], edges[3], edges[4]);
+
+		if (!save_at_setting(VIB_BAND_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom orientation fusion AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_fusion_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"FUSION",
+								   (char *)"Set RAK1905 orientation fusion rate. 0 = off, 4 to 200 Hz",
+								   (char *)"FUSION", fusion_handler);
+
+	if (!get_at_setting(FUSION_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get fusion setting");
+		result = false;
+	}
+	if (g_fusion_rate != 0)
+	{
+		rak1905_set_fusion(g_fusion_rate);
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for orientation fusion
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int fusion_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_fusion_rate);
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_rate = strtoul(param->argv[0], NULL, 10);
+
+		if ((new_rate != 0) && ((new_rate < 4) || (new_rate > 200)))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set fusion rate to %d", new_rate);
+		if (!rak1905_set_fusion(new_rate))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (!save_at_setting(FUSION_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom tank model AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_tank_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"TANK",
+								   (char *)"Set/Get tank model [shape:depth:dim1:dim2] shape 0 = rectangular, 1 = vertical cylinder, 2 = horizontal cylinder, sizes in mm",
+								   (char *)"TANK", tank_handler);
+	result &= api.system.atMode.add((char *)"TANKALM",
+									(char *)"Set/Get tank alarms [low:high:rate] low and high level in %, rate in l/h, 0 = off",
+									(char *)"TANKALM", tank_alarm_handler);
+	result &= api.system.atMode.add((char *)"TOFBUDGET",
+									(char *)"Set/Get RAK12014 timing budget per reading in ms, 20 to 400, longer is less noisy but needs more power",
+									(char *)"TOFBUDGET", tof_budget_handler);
+
+	if (!get_at_setting(TANK_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get tank model");
+		result = false;
+	}
+	if (!get_at_setting(TANK_ALARM_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get tank alarms");
+		result = false;
+	}
+	if (!get_at_setting(TOF_BUDGET_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get ToF timing budget");
+		result = false;
+	}
+	return result;
+}
+
+/**
+ * @brief Check that all parameters are numbers
+ *
+ * @param param received AT command parameters
+ * @return true all parameters are numbers
+ * @return false a parameter is empty or has non digit characters
+ */
+static bool at_check_digits(stParam *param)
+{
+	for (int j = 0; j < param->argc; j++)
+	{
+		if (strlen(param->argv[j]) == 0)
+		{
+			return false;
+		}
+		for (int i = 0; i < strlen(param->argv[j]); i++)
+		{
+			if (!isdigit(*(param->argv[j] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit in param %d", i, j);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Handler for custom AT command for the tank model
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int tank_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d:%d:%d:%d\r\n", g_tank.shape, g_tank.depth, g_tank.dim1, g_tank.dim2);
+		Serial.printf("Capacity %.1f l\r\n", tank_volume(g_tank.depth));
+	}
+	else if (param->argc == 4)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t shape = strtoul(param->argv[0], NULL, 10);
+		uint32_t depth = strtoul(param->argv[1], NULL, 10);
+		uint32_t dim1 = strtoul(param->argv[2], NULL, 10);
+		uint32_t dim2 = strtoul(param->argv[3], NULL, 10);
+
+		if ((shape > TANK_HORIZ_CYLINDER) || (depth == 0) || (depth > 65535) || (dim1 == 0) || (dim1 > 65535) || (dim2 > 65535))
+		{
+			return AT_PARAM_ERROR;
+		}
+		// Only the rectangular tank needs the second dimension
+		if ((shape == TANK_RECTANGULAR) && (dim2 == 0))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		g_tank.shape = shape;
+		g_tank.depth = depth;
+		g_tank.dim1 = dim1;
+		g_tank.dim2 = dim2;
+		MYLOG("AT_CMD", "Tank shape %d depth %d dim %d %d", shape, depth, dim1, dim2);
+
+		if (!save_at_setting(TANK_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for custom AT command for the tank alarms
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int tank_alarm_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d:%d:%d\r\n", g_tank.low_pct, g_tank.high_pct, g_tank.rate_limit);
+	}
+	else if (param->argc == 3)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t low = strtoul(param->argv[0], NULL, 10);
+		uint32_t high = strtoul(param->argv[1], NULL, 10);
+		uint32_t rate = strtoul(param->argv[2], NULL, 10);
+
+		if ((high > 100) || (low > high) || (rate > 65535))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		g_tank.low_pct = low;
+		g_tank.high_pct = high;
+		g_tank.rate_limit = rate;
+		MYLOG("AT_CMD", "Tank alarms low %d%% high %d%% rate %d l/h", low, high, rate);
+
+		if (!save_at_setting(TANK_ALARM_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for custom AT command for the ToF timing budget
+ *        The new budget is used from the next reading, the sensor
+ *        is configured after each power up
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int tof_budget_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_tof_budget);
+	}
+	else if (param->argc == 1)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t budget = strtoul(param->argv[0], NULL, 10);
+		if ((budget < TOF_BUDGET_MIN) || (budget > TOF_BUDGET_MAX))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		g_tof_budget = budget;
+		MYLOG("AT_CMD", "ToF timing budget %d ms", budget);
+
+		if (!save_at_setting(TOF_BUDGET_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom thermal image AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_thermal_img_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"IRIMG",
+								   (char *)"Set/Get RAK12040 thermal image transfer. 0 = off, 1 to 255 = every n-th reading",
+								   (char *)"IRIMG", thermal_img_handler);
+
+	if (!get_at_setting(THERMAL_IMG_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get thermal image setting");
+		result = false;
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for the thermal image transfer
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int thermal_img_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_thermal_img_interval);
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				MYLOG("AT_CMD", "%d is no digit", i);
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint32_t new_interval = strtoul(param->argv[0], NULL, 10);
+
+		if (new_interval > 255)
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		MYLOG("AT_CMD", "Set thermal image interval to %d", new_interval);
+		g_thermal_img_interval = new_interval;
+		if (!save_at_setting(THERMAL_IMG_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom barometer mode AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_press_mode_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"BARO",
+								   (char *)"Set/Get RAK1902 mode. 0 = one shot, 1 = continuous 1 Hz with FIFO",
+								   (char *)"BARO", press_mode_handler);
+
+	if (!get_at_setting(PRESS_MODE_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get barometer mode");
+		result = false;
+	}
+	if (g_press_mode != PRESS_ONE_SHOT)
+	{
+		rak1902_set_mode(g_press_mode);
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for the barometer mode
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int press_mode_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d\r\n", g_press_mode);
+	}
+	else if (param->argc == 1)
+	{
+		if ((strlen(param->argv[0]) != 1) || (param->argv[0][0] < '0') || (param->argv[0][0] > '1'))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint8_t new_mode = param->argv[0][0] - '0';
+		MYLOG("AT_CMD", "Set barometer mode to %d", new_mode);
+		if (!rak1902_set_mode(new_mode))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (!save_at_setting(PRESS_MODE_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom BME680 gas heater AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_bme_gas_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"BMEGAS",
+								   (char *)"Set/Get RAK1906 gas heater [temp:time:duty] temp 200-400 degrees C or 0 = off, time in ms, gas every duty readings",
+								   (char *)"BMEGAS", bme_gas_handler);
+
+	if (!get_at_setting(BME_GAS_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get gas heater profile");
+		result = false;
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for the BME680 gas heater
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int bme_gas_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=%d:%d:%d\r\n", g_bme_gas.heater_temp, g_bme_gas.heater_time, g_bme_gas.duty);
+	}
+	else if (param->argc == 3)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t temp = strtoul(param->argv[0], NULL, 10);
+		uint32_t time = strtoul(param->argv[1], NULL, 10);
+		uint32_t duty = strtoul(param->argv[2], NULL, 10);
+
+		// 0 switches the gas measurement off
+		if ((temp != 0) && ((temp < 200) || (temp > 400) || (time == 0) || (time > 4032) || (duty == 0) || (duty > 255)))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		g_bme_gas.heater_temp = temp;
+		g_bme_gas.heater_time = temp == 0 ? 0 : time;
+		g_bme_gas.duty = temp == 0 ? 0 : duty;
+		MYLOG("AT_CMD", "Gas heater %d C %d ms every %d readings", g_bme_gas.heater_temp, g_bme_gas.heater_time, g_bme_gas.duty);
+
+		if (!save_at_setting(BME_GAS_OFFSET))
+		{
+			MYLOG("AT_CMD", "Save failed");
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom event mode AT commands
+ *        Called once after the event capable sensors are initialized
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_event_at(void)
+{
+	bool result = false;
+
+	result = api.system.atMode.add((char *)"EVENT",
+								   (char *)"Set/Get threshold events [sensor:low:high:hyst:pin] sensor 0 = RAK1903 (lux), 1 = RAK12019 (0.01 UVI), 2 = RAK12040 (0.1 C), pin = WB_IO1, 3 to 6, 0 = off",
+								   (char *)"EVENT", event_handler);
+
+	if (!get_at_setting(EVENT_OFFSET))
+	{
+		MYLOG("AT_CMD", "Could not get event thresholds");
+		result = false;
+	}
+	for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+	{
+		event_setup(sensor);
+	}
+	return result;
+}
+
+/**
+ * @brief Handler for custom AT command for the event mode
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int event_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+		{
+			Serial.print(cmd);
+			Serial.printf("=%d:%ld:%ld:%d:%d\r\n", sensor, g_event_thr[sensor].low, g_event_thr[sensor].high,
+						  g_event_thr[sensor].hyst, g_event_thr[sensor].pin);
+		}
+	}
+	else if (param->argc == 5)
+	{
+		if (!at_check_digits(param))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		uint32_t sensor = strtoul(param->argv[0], NULL, 10);
+		uint32_t low = strtoul(param->argv[1], NULL, 10);
+		uint32_t high = strtoul(param->argv[2], NULL, 10);
+		uint32_t hyst = strtoul(param->argv[3], NULL, 10);
+		uint32_t pin = strtoul(param->argv[4], NULL, 10);
 
-		if ((date < 1) || (date > 31))
+		if ((sensor >= EVENT_NUM) || (pin > 6) || (hyst > 65535) || ((high != 0) && (low >= high)))
 		{
-			// MYLOG("AT_CMD", "Day error %d", date);
 			return AT_PARAM_ERROR;
 		}
-
-		// Check hour
-		hour = strtoul(param->argv[3], NULL, 0);
-
-		if (hour > 24)
+		// Pin must not be used by another sensor, the RTC wake up or a module
+		if (!event_pin_free(sensor, pin))
 		{
-			// MYLOG("AT_CMD", "Hour error %d", hour);
+			MYLOG("AT_CMD", "WB_IO%ld is already used", pin);
 			return AT_PARAM_ERROR;
 		}
 
-		// Check minute
-		minute = strtoul(param->argv[4], NULL, 0);
+		g_event_thr[sensor].low = low;
+		g_event_thr[sensor].high = high;
+		g_event_thr[sensor].hyst = hyst;
+		g_event_thr[sensor].pin = pin;
+		MYLOG("AT_CMD", "Event sensor %d low %ld high %ld hyst %ld pin %ld", sensor, low, high, hyst, pin);
+		event_setup(sensor);
 
-		if (minute > 59)
+		if (!save_at_setting(EVENT_OFFSET))
 		{
-			// MYLOG("AT_CMD", "Minute error %d", minute);
+			MYLOG("AT_CMD", "Save failed");
 			return AT_PARAM_ERROR;
 		}
-
-		set_rak12002((uint16_t)year, (uint8_t)month, (uint8_t)date, (uint8_t)hour, (uint8_t)minute);
-
-		return AT_OK;
 	}
 	else
 	{
@@ -211,45 +1318,52 @@ int rtc_command_handler(SERIAL_PORT port, char *cmd, stParam *param)
 }
 
 /**
- * @brief Add custom GNSS AT commands
+ * @brief Add custom report-on-change AT commands
  *
  * @return true AT commands were added
  * @return false AT commands couldn't be added
  */
-bool init_gnss_at(void)
+bool init_report_at(void)
 {
 	bool result = false;
 
-	result = api.system.atMode.add((char *)"GNSS",
-								   (char *)"Change GNSS precision and payload format. 0 = 4digit prec., 1 = 6digit prec, 2 = Helium Mapper format, 3 = Field Tester format",
-								   (char *)"GNSS", gnss_format_handler);
+	result = api.system.atMode.add((char *)"RULE",
+								   (char *)"Set/Get report rules [channel:deadband:rel:min:max:low:high:hyst] values in 0.01 of the channel unit, rel = 1 deadband in 0.1 %, intervals in s, all 0 = remove",
+								   (char *)"RULE", report_handler);
 
-	if (!get_at_setting(GNSS_OFFSET))
+	if (!report_load())
 	{
-		MYLOG("AT_CMD", "Could not get default GNSS settings");
-		result = false;
+		MYLOG("AT_CMD", "No report rules");
 	}
-	switch (gnss_format)
+	return result;
+}
+
+/**
+ * @brief Check that a parameter is a number with optional sign
+ *
+ * @param param parameter string
+ * @return true parameter is a signed number
+ * @return false parameter is empty or has non digit characters
+ */
+static bool at_check_signed(char *param)
+{
+	char *digits = param[0] == '-' ? param + 1 : param;
+	if (strlen(digits) == 0)
 	{
-	case LPP_4_DIGIT:
-		MYLOG("AT_CMD", "GNSS 4 digit Cayenne LPP");
-		break;
-	case LPP_6_DIGIT:
-		MYLOG("AT_CMD", "GNSS 6 digit extended Cayenne LPP");
-		break;
-	case HELIUM_MAPPER:
-		MYLOG("AT_CMD", "GNSS Helium Mapper data format");
-		break;
-	case FIELD_TESTER:
-		MYLOG("AT_CMD", "GNSS Field Tester data format");
-		break;
+		return false;
 	}
-
-	return result;
+	for (int i = 0; i < strlen(digits); i++)
+	{
+		if (!isdigit(digits[i]))
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 /**
- * @brief Handler for custom AT command for GNSS settings
+ * @brief Handler for custom AT command for the report-on-change rules
  *
  * @param port Serial port used
  * @param cmd char array with the received AT command
@@ -258,53 +1372,123 @@ bool init_gnss_at(void)
  * 			AT_OK AT command & parameters valid
  * 			AT_PARAM_ERROR command or parameters invalid
  */
-int gnss_format_handler(SERIAL_PORT port, char *cmd, stParam *param)
+int report_handler(SERIAL_PORT port, char *cmd, stParam *param)
 {
 	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
 	{
-		Serial.print(cmd);
-		Serial.print("=");
-		switch (gnss_format)
+		for (uint8_t idx = 0; idx < REPORT_MAX_RULES; idx++)
 		{
-		case LPP_4_DIGIT:
-			Serial.println("4 digit Cayenne LPP");
-			break;
-		case LPP_6_DIGIT:
-			Serial.println("6 digit extended Cayenne LPP");
-			break;
-		case HELIUM_MAPPER:
-			Serial.println("Helium Mapper data format");
-			break;
-		case FIELD_TESTER:
-			Serial.println("Field Tester data format");
-			break;
+			report_rule_s *rule = report_get_rule(idx);
+			if (rule->channel == 0)
+			{
+				continue;
+			}
+			Serial.print(cmd);
+			Serial.printf("=%d:%ld:%d:%d:%ld:%ld:%ld:%ld\r\n", rule->channel, rule->deadband, rule->relative,
+						  rule->min_interval, rule->max_interval, rule->low, rule->high, rule->hyst);
 		}
 	}
-	else if (param->argc == 1)
+	else if (param->argc == 8)
 	{
-		for (int i = 0; i < strlen(param->argv[0]); i++)
+		for (int j = 0; j < param->argc; j++)
 		{
-			if (!isdigit(*(param->argv[0] + i)))
+			if (!at_check_signed(param->argv[j]) || ((j != 5) && (j != 6) && (param->argv[j][0] == '-')))
 			{
-				MYLOG("AT_CMD", "%d is no digit", i);
 				return AT_PARAM_ERROR;
 			}
 		}
 
-		uint32_t gnss_format_new = strtoul(param->argv[0], NULL, 10);
+		uint32_t channel = strtoul(param->argv[0], NULL, 10);
+		uint32_t relative = strtoul(param->argv[2], NULL, 10);
+		uint32_t min_interval = strtoul(param->argv[3], NULL, 10);
+		report_rule_s rule;
+		rule.deadband = strtoul(param->argv[1], NULL, 10);
+		rule.max_interval = strtoul(param->argv[4], NULL, 10);
+		rule.low = strtol(param->argv[5], NULL, 10);
+		rule.high = strtol(param->argv[6], NULL, 10);
+		rule.hyst = strtoul(param->argv[7], NULL, 10);
 
-		MYLOG("AT_CMD", "Requested format %ld", gnss_format_new);
+		if ((channel == 0) || (channel > 255) || (relative > 1) || (min_interval > 65535) || (rule.low > rule.high))
+		{
+			return AT_PARAM_ERROR;
+		}
+		rule.channel = channel;
+		rule.relative = relative;
+		rule.min_interval = min_interval;
+		MYLOG("AT_CMD", "Rule ch %d deadband %ld%s min %ds max %lds alarms %ld/%ld hyst %ld", rule.channel, rule.deadband,
+			  rule.relative ? " rel" : "", rule.min_interval, rule.max_interval, rule.low, rule.high, rule.hyst);
 
-		if (gnss_format_new > FIELD_TESTER)
+		if (!report_set_rule(&rule))
 		{
 			return AT_PARAM_ERROR;
 		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
 
-		MYLOG("AT_CMD", "Set format to %d", gnss_format_new);
-		gnss_format = gnss_format_new;
-		if (!save_at_setting(GNSS_OFFSET))
+	return AT_OK;
+}
+
+/**
+ * @brief Add custom magnetometer calibration AT commands
+ *
+ * @return true AT commands were added
+ * @return false AT commands couldn't be added
+ */
+bool init_mag_cal_at(void)
+{
+	return api.system.atMode.add((char *)"MAGCAL",
+								 (char *)"RAK1905 calibration. 1 = restart magnetometer calibration, 2 = clear all, offsets are measured on next boot, 3 = measure offsets now (device must lie still)",
+								 (char *)"MAGCAL", mag_cal_handler);
+}
+
+/**
+ * @brief Handler for custom AT command for magnetometer calibration
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int mag_cal_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		Serial.print(cmd);
+		Serial.printf("=\r\n");
+		mag_cal_status();
+	}
+	else if (param->argc == 1)
+	{
+		if (!strcmp(param->argv[0], "1"))
+		{
+			MYLOG("AT_CMD", "Restart magnetometer calibration");
+			mag_cal_reset(false);
+		}
+		else if (!strcmp(param->argv[0], "2"))
+		{
+			MYLOG("AT_CMD", "Clear RAK1905 calibration");
+			mag_cal_reset(true);
+		}
+		else if (!strcmp(param->argv[0], "3"))
+		{
+			MYLOG("AT_CMD", "Measure RAK1905 offsets");
+			// Stop the FIFO while the offsets are measured, the ranges are changed
+			uint8_t rate = g_fusion_rate;
+			rak1905_set_fusion(0);
+			bool still = rak1905_calibrate_offsets();
+			rak1905_set_fusion(rate);
+			if (!still)
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		else
 		{
-			MYLOG("AT_CMD", "Save failed");
 			return AT_PARAM_ERROR;
 		}
 	}
@@ -420,6 +1604,10 @@ int status_handler(SERIAL_PORT port, char *cmd, stParam *param)
 			Serial.printf("Bitrate = %d\r\n", api.lora.pbr.get());
 			Serial.printf("Deviaton = %d\r\n", api.lora.pfdev.get());
 		}
+		if (found_sensors[GNSS_ID].found_sensor)
+		{
+			gnss_print_stats();
+		}
 		announce_modules();
 	}
 	else
@@ -490,6 +1678,240 @@ bool get_at_setting(uint32_t setting_type)
 		MYLOG("AT_CMD", "send interval found %ld", g_send_interval_time);
 		return true;
 		break;
+	case GNSS_PWR_OFFSET:
+		if (!api.system.flash.get(GNSS_PWR_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read GNSS power mode from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > GNSS_PWR_SAVE))
+		{
+			MYLOG("AT_CMD", "Invalid GNSS power mode, using default");
+			g_gnss_power_mode = GNSS_PWR_OFF;
+			save_at_setting(GNSS_PWR_OFFSET);
+			return true;
+		}
+		g_gnss_power_mode = flash_value[0];
+		MYLOG("AT_CMD", "Found GNSS power mode %d", flash_value[0]);
+		return true;
+		break;
+	case ACC_STREAM_OFFSET:
+		if (!api.system.flash.get(ACC_STREAM_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read ACC streaming from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > 7))
+		{
+			MYLOG("AT_CMD", "Invalid ACC streaming setting, using default");
+			g_acc_stream_odr = 0;
+			save_at_setting(ACC_STREAM_OFFSET);
+			return true;
+		}
+		g_acc_stream_odr = flash_value[0];
+		MYLOG("AT_CMD", "Found ACC streaming %d", flash_value[0]);
+		return true;
+		break;
+	case FUSION_OFFSET:
+		if (!api.system.flash.get(FUSION_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read fusion rate from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > 200) || ((flash_value[0] != 0) && (flash_value[0] < 4)))
+		{
+			MYLOG("AT_CMD", "Invalid fusion rate, using default");
+			g_fusion_rate = 0;
+			save_at_setting(FUSION_OFFSET);
+			return true;
+		}
+		g_fusion_rate = flash_value[0];
+		MYLOG("AT_CMD", "Found fusion rate %d", flash_value[0]);
+		return true;
+		break;
+	case TANK_OFFSET:
+		if (!api.system.flash.get(TANK_OFFSET, flash_value, 8))
+		{
+			MYLOG("AT_CMD", "Failed to read tank model from Flash");
+			return false;
+		}
+		if ((flash_value[7] != 0xAA) || (flash_value[0] > TANK_HORIZ_CYLINDER))
+		{
+			MYLOG("AT_CMD", "Invalid tank model, using default");
+			save_at_setting(TANK_OFFSET);
+			return true;
+		}
+		g_tank.shape = flash_value[0];
+		g_tank.depth = flash_value[1] | (flash_value[2] << 8);
+		g_tank.dim1 = flash_value[3] | (flash_value[4] << 8);
+		g_tank.dim2 = flash_value[5] | (flash_value[6] << 8);
+		MYLOG("AT_CMD", "Found tank shape %d depth %d dim %d %d", g_tank.shape, g_tank.depth, g_tank.dim1, g_tank.dim2);
+		return true;
+		break;
+	case TANK_ALARM_OFFSET:
+		if (!api.system.flash.get(TANK_ALARM_OFFSET, flash_value, 5))
+		{
+			MYLOG("AT_CMD", "Failed to read tank alarms from Flash");
+			return false;
+		}
+		if ((flash_value[4] != 0xAA) || (flash_value[1] > 100) || (flash_value[0] > flash_value[1]))
+		{
+			MYLOG("AT_CMD", "Invalid tank alarms, using default");
+			save_at_setting(TANK_ALARM_OFFSET);
+			return true;
+		}
+		g_tank.low_pct = flash_value[0];
+		g_tank.high_pct = flash_value[1];
+		g_tank.rate_limit = flash_value[2] | (flash_value[3] << 8);
+		MYLOG("AT_CMD", "Found tank alarms %d %d %d", g_tank.low_pct, g_tank.high_pct, g_tank.rate_limit);
+		return true;
+		break;
+	case TOF_BUDGET_OFFSET:
+		if (!api.system.flash.get(TOF_BUDGET_OFFSET, flash_value, 3))
+		{
+			MYLOG("AT_CMD", "Failed to read ToF timing budget from Flash");
+			return false;
+		}
+		if ((flash_value[2] != 0xAA) || ((flash_value[0] | (flash_value[1] << 8)) < TOF_BUDGET_MIN) || ((flash_value[0] | (flash_value[1] << 8)) > TOF_BUDGET_MAX))
+		{
+			MYLOG("AT_CMD", "Invalid ToF timing budget, using default");
+			g_tof_budget = TOF_BUDGET_DEFAULT;
+			save_at_setting(TOF_BUDGET_OFFSET);
+			return true;
+		}
+		g_tof_budget = flash_value[0] | (flash_value[1] << 8);
+		MYLOG("AT_CMD", "Found ToF timing budget %d ms", g_tof_budget);
+		return true;
+		break;
+	case THERMAL_IMG_OFFSET:
+		if (!api.system.flash.get(THERMAL_IMG_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read thermal image setting from Flash");
+			return false;
+		}
+		if (flash_value[1] != 0xAA)
+		{
+			MYLOG("AT_CMD", "Invalid thermal image setting, using default");
+			g_thermal_img_interval = 0;
+			save_at_setting(THERMAL_IMG_OFFSET);
+			return true;
+		}
+		g_thermal_img_interval = flash_value[0];
+		MYLOG("AT_CMD", "Found thermal image interval %d", flash_value[0]);
+		return true;
+		break;
+	case RTC_ALIGN_OFFSET:
+		if (!api.system.flash.get(RTC_ALIGN_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read alignment setting from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > 1))
+		{
+			MYLOG("AT_CMD", "Invalid alignment setting, using default");
+			g_rtc_align = false;
+			save_at_setting(RTC_ALIGN_OFFSET);
+			return true;
+		}
+		g_rtc_align = flash_value[0] == 1;
+		MYLOG("AT_CMD", "Found wall clock alignment %d", flash_value[0]);
+		return true;
+		break;
+	case RTC_WAKE_OFFSET:
+		if (!api.system.flash.get(RTC_WAKE_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read RTC wake up setting from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > 6))
+		{
+			MYLOG("AT_CMD", "Invalid RTC wake up setting, using default");
+			g_rtc_wake_pin = 0;
+			save_at_setting(RTC_WAKE_OFFSET);
+			return true;
+		}
+		g_rtc_wake_pin = flash_value[0];
+		MYLOG("AT_CMD", "Found RTC wake up pin %d", flash_value[0]);
+		return true;
+		break;
+	case VIB_BAND_OFFSET:
+		if (!api.system.flash.get(VIB_BAND_OFFSET, flash_value, 11))
+		{
+			MYLOG("AT_CMD", "Failed to read vibration bands from Flash");
+			return false;
+		}
+		if (flash_value[10] != 0xAA)
+		{
+			MYLOG("AT_CMD", "Invalid vibration bands, using default");
+			save_at_setting(VIB_BAND_OFFSET);
+			return true;
+		}
+		for (uint8_t edge = 0; edge < 5; edge++)
+		{
+			g_vib_band_edges[edge] = flash_value[edge * 2] | (flash_value[edge * 2 + 1] << 8);
+		}
+		MYLOG("AT_CMD", "Found vibration bands %d %d %d %d %d Hz", g_vib_band_edges[0], g_vib_band_edges[1],
+			  g_vib_band_edges[2], g_vib_band_edges[3], g_vib_band_edges[4]);
+		return true;
+		break;
+	case PRESS_MODE_OFFSET:
+		if (!api.system.flash.get(PRESS_MODE_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read barometer mode from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] > PRESS_CONTINUOUS))
+		{
+			MYLOG("AT_CMD", "Invalid barometer mode, using default");
+			g_press_mode = PRESS_ONE_SHOT;
+			save_at_setting(PRESS_MODE_OFFSET);
+			return true;
+		}
+		g_press_mode = flash_value[0];
+		MYLOG("AT_CMD", "Found barometer mode %d", flash_value[0]);
+		return true;
+		break;
+	case BME_GAS_OFFSET:
+		if (!api.system.flash.get(BME_GAS_OFFSET, flash_value, 6))
+		{
+			MYLOG("AT_CMD", "Failed to read gas heater profile from Flash");
+			return false;
+		}
+		if (flash_value[5] != 0xAA)
+		{
+			MYLOG("AT_CMD", "Invalid gas heater profile, using default");
+			save_at_setting(BME_GAS_OFFSET);
+			return true;
+		}
+		g_bme_gas.heater_temp = flash_value[0] | (flash_value[1] << 8);
+		g_bme_gas.heater_time = flash_value[2] | (flash_value[3] << 8);
+		g_bme_gas.duty = flash_value[4];
+		MYLOG("AT_CMD", "Found gas heater %d C %d ms every %d readings", g_bme_gas.heater_temp, g_bme_gas.heater_time, g_bme_gas.duty);
+		return true;
+		break;
+	case EVENT_OFFSET:
+		for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+		{
+			if (!api.system.flash.get(EVENT_OFFSET + sensor * 12, flash_value, 12))
+			{
+				MYLOG("AT_CMD", "Failed to read event thresholds from Flash");
+				return false;
+			}
+			if ((flash_value[11] != 0xAA) || (flash_value[10] > 6))
+			{
+				MYLOG("AT_CMD", "Invalid event thresholds, using default");
+				memset(&g_event_thr[sensor], 0, sizeof(event_thr_s));
+				continue;
+			}
+			g_event_thr[sensor].low = flash_value[0] | (flash_value[1] << 8) | (flash_value[2] << 16) | (flash_value[3] << 24);
+			g_event_thr[sensor].high = flash_value[4] | (flash_value[5] << 8) | (flash_value[6] << 16) | (flash_value[7] << 24);
+			g_event_thr[sensor].hyst = flash_value[8] | (flash_value[9] << 8);
+			g_event_thr[sensor].pin = flash_value[10];
+			MYLOG("AT_CMD", "Found event sensor %d low %ld high %ld hyst %d pin %d", sensor, g_event_thr[sensor].low,
+				  g_event_thr[sensor].high, g_event_thr[sensor].hyst, g_event_thr[sensor].pin);
+		}
+		return true;
+		break;
 	default:
 		return false;
 	}
@@ -528,6 +1950,107 @@ bool save_at_setting(uint32_t setting_type)
 		wr_result = true;
 		return wr_result;
 		break;
+	case GNSS_PWR_OFFSET:
+		flash_value[0] = g_gnss_power_mode;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(GNSS_PWR_OFFSET, flash_value, 2);
+		break;
+	case ACC_STREAM_OFFSET:
+		flash_value[0] = g_acc_stream_odr;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(ACC_STREAM_OFFSET, flash_value, 2);
+		break;
+	case FUSION_OFFSET:
+		flash_value[0] = g_fusion_rate;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(FUSION_OFFSET, flash_value, 2);
+		break;
+	case TANK_OFFSET:
+		flash_value[0] = g_tank.shape;
+		flash_value[1] = (uint8_t)(g_tank.depth >> 0);
+		flash_value[2] = (uint8_t)(g_tank.depth >> 8);
+		flash_value[3] = (uint8_t)(g_tank.dim1 >> 0);
+		flash_value[4] = (uint8_t)(g_tank.dim1 >> 8);
+		flash_value[5] = (uint8_t)(g_tank.dim2 >> 0);
+		flash_value[6] = (uint8_t)(g_tank.dim2 >> 8);
+		flash_value[7] = 0xAA;
+		return api.system.flash.set(TANK_OFFSET, flash_value, 8);
+		break;
+	case TANK_ALARM_OFFSET:
+		flash_value[0] = g_tank.low_pct;
+		flash_value[1] = g_tank.high_pct;
+		flash_value[2] = (uint8_t)(g_tank.rate_limit >> 0);
+		flash_value[3] = (uint8_t)(g_tank.rate_limit >> 8);
+		flash_value[4] = 0xAA;
+		return api.system.flash.set(TANK_ALARM_OFFSET, flash_value, 5);
+		break;
+	case TOF_BUDGET_OFFSET:
+		flash_value[0] = (uint8_t)(g_tof_budget >> 0);
+		flash_value[1] = (uint8_t)(g_tof_budget >> 8);
+		flash_value[2] = 0xAA;
+		return api.system.flash.set(TOF_BUDGET_OFFSET, flash_value, 3);
+		break;
+	case THERMAL_IMG_OFFSET:
+		flash_value[0] = g_thermal_img_interval;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(THERMAL_IMG_OFFSET, flash_value, 2);
+		break;
+	case RTC_ALIGN_OFFSET:
+		flash_value[0] = g_rtc_align ? 1 : 0;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(RTC_ALIGN_OFFSET, flash_value, 2);
+		break;
+	case RTC_WAKE_OFFSET:
+		flash_value[0] = g_rtc_wake_pin;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(RTC_WAKE_OFFSET, flash_value, 2);
+		break;
+	case VIB_BAND_OFFSET:
+		for (uint8_t edge = 0; edge < 5; edge++)
+		{
+			flash_value[edge * 2] = (uint8_t)(g_vib_band_edges[edge] >> 0);
+			flash_value[edge * 2 + 1] = (uint8_t)(g_vib_band_edges[edge] >> 8);
+		}
+		flash_value[10] = 0xAA;
+		return api.system.flash.set(VIB_BAND_OFFSET, flash_value, 11);
+		break;
+	case PRESS_MODE_OFFSET:
+		flash_value[0] = g_press_mode;
+		flash_value[1] = 0xAA;
+		return api.system.flash.set(PRESS_MODE_OFFSET, flash_value, 2);
+		break;
+	case BME_GAS_OFFSET:
+		flash_value[0] = (uint8_t)(g_bme_gas.heater_temp >> 0);
+		flash_value[1] = (uint8_t)(g_bme_gas.heater_temp >> 8);
+		flash_value[2] = (uint8_t)(g_bme_gas.heater_time >> 0);
+		flash_value[3] = (uint8_t)(g_bme_gas.heater_time >> 8);
+		flash_value[4] = g_bme_gas.duty;
+		flash_value[5] = 0xAA;
+		return api.system.flash.set(BME_GAS_OFFSET, flash_value, 6);
+		break;
+	case EVENT_OFFSET:
+		for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+		{
+			event_thr_s *thr = &g_event_thr[sensor];
+			flash_value[0] = (uint8_t)(thr->low >> 0);
+			flash_value[1] = (uint8_t)(thr->low >> 8);
+			flash_value[2] = (uint8_t)(thr->low >> 16);
+			flash_value[3] = (uint8_t)(thr->low >> 24);
+			flash_value[4] = (uint8_t)(thr->high >> 0);
+			flash_value[5] = (uint8_t)(thr->high >> 8);
+			flash_value[6] = (uint8_t)(thr->high >> 16);
+			flash_value[7] = (uint8_t)(thr->high >> 24);
+			flash_value[8] = (uint8_t)(thr->hyst >> 0);
+			flash_value[9] = (uint8_t)(thr->hyst >> 8);
+			flash_value[10] = thr->pin;
+			flash_value[11] = 0xAA;
+			if (!api.system.flash.set(EVENT_OFFSET + sensor * 12, flash_value, 12))
+			{
+				return false;
+			}
+		}
+		return true;
+		break;
 	default:
 		return false;
 		break;
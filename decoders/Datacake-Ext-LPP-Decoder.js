@@ -39,6 +39,7 @@
  *                                                          Longitude : 0.000001 ° Signed MSB
  *                                                          Altitude  : 0.01 meter Signed MSB
  *  VOC index           3338    138     8A      1           VOC index
+ *  Vibration           3339    139     8B      2           1 mg Unsigned MSB
  * 
  */
 
@@ -74,6 +75,7 @@ function lppDecode(bytes) {
 		136: { 'size': 9, 'name': 'gps', 'signed': true, 'divisor': [10000, 10000, 100] },
 		137: { 'size': 11, 'name': 'gps', 'signed': true, 'divisor': [1000000, 1000000, 100] },
 		138: { 'size': 2, 'name': 'voc', 'signed': false, 'divisor': 1 },
+		139: { 'size': 2, 'name': 'vibration', 'signed': false, 'divisor': 1 },
 		142: { 'size': 1, 'name': 'switch', 'signed': false, 'divisor': 1 },
 	};
 
@@ -209,8 +211,25 @@ function lppDecode(bytes) {
 
 }
 
+// RAK12040 thermal frame fragments on fPort 12, reassemble them with RAK12040-Thermal-Frame-Decoder.js
+function thermalFragment(bytes) {
+	var hex = '';
+	for (var i = 2; i < bytes.length; i++) {
+		hex += ('0' + bytes[i].toString(16)).slice(-2);
+	}
+	return {
+		'thermal_frame': bytes[0],
+		'thermal_fragment': bytes[1] >> 4,
+		'thermal_fragments': bytes[1] & 0x0F,
+		'thermal_data': hex
+	};
+}
+
 // To use with Datacake
 function Decoder(bytes, fPort) {
+	if (fPort == 12) {
+		return thermalFragment(bytes);
+	}
 
 	// flat output (like original decoder):
 	var response = {};
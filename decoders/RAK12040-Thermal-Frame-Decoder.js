@@ -0,0 +1,128 @@
+/**
+ * Reassembler and decoder for the RAK12040 thermal frames sent on fPort 12
+ *
+ * The network server decoders only split the fragments (thermal_frame, thermal_fragment,
+ * thermal_fragments, thermal_data), the reassembly needs to keep state between uplinks
+ * and has to run in the application (e.g. Node-RED function node or Node.js).
+ *
+ * Fragment format:
+ *  Byte 0      frame number (0 - 255)
+ *  Byte 1      fragment index << 4 | number of fragments
+ *  Byte 2 ...  part of the encoded frame
+ *
+ * Encoded frame (bit stream, MSB first):
+ *  8 bits      bit 7 = key frame, bits 0-3 = Rice parameter k
+ *  16 bits     key frames only: first pixel, signed, 0.25 °C
+ *  Residuals   Rice coded zigzag values, quotient in unary with terminating 0 and k bits remainder.
+ *              15 ones without terminating 0 are followed by the raw 16 bit zigzag value.
+ *              Key frames: 63 differences to the previous pixel in serpentine order (odd rows right to left)
+ *              Delta frames: 64 differences to the same pixel of the previous frame
+ *
+ * Usage:
+ *  var thermal = new ThermalFrameDecoder();
+ *  var frame = thermal.add(bytes); // null until a frame is complete, then 8x8 array in °C
+ */
+function ThermalFrameDecoder() {
+	this.fragments = [];
+	this.frameNum = -1;
+	this.lastFrame = null;
+	this.lastFrameNum = -1;
+}
+
+ThermalFrameDecoder.prototype.add = function (bytes) {
+	var frameNum = bytes[0];
+	var index = bytes[1] >> 4;
+	var count = bytes[1] & 0x0F;
+
+	if (frameNum != this.frameNum) {
+		this.fragments = [];
+		this.frameNum = frameNum;
+	}
+	this.fragments[index] = bytes.slice(2);
+
+	for (var i = 0; i < count; i++) {
+		if (typeof this.fragments[i] == 'undefined') {
+			return null;
+		}
+	}
+
+	var data = [];
+	for (var i = 0; i < count; i++) {
+		data = data.concat(Array.prototype.slice.call(this.fragments[i]));
+	}
+	this.fragments = [];
+	this.frameNum = -1;
+
+	var frame = this.decode(data, frameNum);
+	if (frame == null) {
+		return null;
+	}
+	var result = [];
+	for (var row = 0; row < 8; row++) {
+		result.push([]);
+		for (var col = 0; col < 8; col++) {
+			result[row].push(frame[row * 8 + col] / 4);
+		}
+	}
+	return result;
+};
+
+ThermalFrameDecoder.prototype.decode = function (data, frameNum) {
+	var pos = 0;
+	function getBits(num) {
+		var value = 0;
+		for (var i = 0; i < num; i++) {
+			var bit = (data[pos >> 3] >> (7 - (pos & 7))) & 1;
+			value = (value << 1) | bit;
+			pos++;
+		}
+		return value;
+	}
+	function getRice(k) {
+		var quotient = 0;
+		while (quotient < 15 && getBits(1) == 1) {
+			quotient++;
+		}
+		if (quotient == 15) {
+			return getBits(16);
+		}
+		return (quotient << k) | getBits(k);
+	}
+	function unzigzag(value) {
+		return (value & 1) ? -((value + 1) >> 1) : (value >> 1);
+	}
+
+	var header = getBits(8);
+	var keyFrame = (header & 0x80) != 0;
+	var k = header & 0x0F;
+	var frame = new Array(64);
+
+	if (keyFrame) {
+		var first = getBits(16);
+		var value = first > 0x7FFF ? first - 0x10000 : first;
+		for (var idx = 0; idx < 64; idx++) {
+			if (idx != 0) {
+				value += unzigzag(getRice(k));
+			}
+			var row = idx >> 3;
+			var pixel = (row & 1) ? row * 8 + 7 - (idx & 7) : idx;
+			frame[pixel] = value;
+		}
+	} else {
+		// Delta frame needs the previous frame
+		if ((this.lastFrame == null) || (((this.lastFrameNum + 1) & 0xFF) != frameNum)) {
+			this.lastFrame = null;
+			return null;
+		}
+		for (var idx = 0; idx < 64; idx++) {
+			frame[idx] = this.lastFrame[idx] + unzigzag(getRice(k));
+		}
+	}
+	this.lastFrame = frame;
+	this.lastFrameNum = frameNum;
+	return frame;
+};
+
+if (typeof module !== 'undefined') {
+	module.exports = ThermalFrameDecoder;
+}
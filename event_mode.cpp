@@ -0,0 +1,230 @@
+/**
+ * @file event_mode.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Threshold interrupt event mode for RAK1903, RAK12019 and RAK12040
+ *        The sensors compare in hardware and wake the node through their interrupt pin
+ * @version 0.1
+ * @date 2022-07-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Min time between two event uplinks in ms */
+#define EVENT_MIN_INTERVAL 15000
+
+/** Thresholds of the event sensors, pin 0 = event mode off */
+event_thr_s g_event_thr[EVENT_NUM] = {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
+
+/** Threshold units of the sensors (lux, 0.01 UVI, 0.1 degrees C) */
+static const float event_unit[EVENT_NUM] = {1.0, 0.01, 0.1};
+
+/** Alarm state of the sensors */
+uint8_t event_state[EVENT_NUM] = {EVENT_NORMAL, EVENT_NORMAL, EVENT_NORMAL};
+
+/** Flag if the current uplink was triggered by an event */
+bool g_event_triggered = false;
+
+/** WisBlock IO pins selectable for the interrupts, index = IO number, WB_IO2 is the 3V3_S supply */
+static const uint8_t event_pins[] = {0, WB_IO1, 0, WB_IO3, WB_IO4, WB_IO5, WB_IO6};
+
+/**
+ * @brief Get the interrupt pin of a sensor
+ *
+ * @param sensor EVENT_LIGHT, EVENT_UV or EVENT_IR
+ * @return uint8_t WisBlock pin, 0 if event mode is off
+ */
+uint8_t event_pin(uint8_t sensor)
+{
+	if ((sensor >= EVENT_NUM) || (g_event_thr[sensor].pin == 0) || (g_event_thr[sensor].pin >= sizeof(event_pins)))
+	{
+		return 0;
+	}
+	return event_pins[g_event_thr[sensor].pin];
+}
+
+/**
+ * @brief Check if a WisBlock IO can be used for the interrupt of a sensor
+ *        The pin must not be used by another event sensor, the RTC wake up or a module
+ *
+ * @param sensor EVENT_LIGHT, EVENT_UV or EVENT_IR
+ * @param io WisBlock IO number 1 to 6, 0 = event mode off
+ * @return true if the pin is free
+ * @return false if the pin is not selectable or already used
+ */
+bool event_pin_free(uint8_t sensor, uint8_t io)
+{
+	if (io == 0)
+	{
+		return true;
+	}
+	if ((io >= sizeof(event_pins)) || (event_pins[io] == 0) || wb_io_used(event_pins[io]) || (g_rtc_wake_pin == io))
+	{
+		return false;
+	}
+	for (uint8_t other = 0; other < EVENT_NUM; other++)
+	{
+		if ((other != sensor) && (g_event_thr[other].pin == io))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Update the alarm state of a sensor and calculate the window for the hardware comparator
+ *        Outside the window the sensor asserts its interrupt.
+ *        After an alarm the window is moved by the hysteresis, the return to normal is the next event
+ *
+ * @param sensor EVENT_LIGHT, EVENT_UV or EVENT_IR
+ * @param value current sensor value (lux, UVI or degrees C)
+ * @param low pointer for the lower limit, EVENT_NO_LOW if none
+ * @param high pointer for the upper limit, EVENT_NO_HIGH if none
+ */
+void event_window(uint8_t sensor, float value, float *low, float *high)
+{
+	event_thr_s *thr = &g_event_thr[sensor];
+	float unit = event_unit[sensor];
+	float thr_low = thr->low * unit;
+	float thr_high = thr->high * unit;
+	float hyst = thr->hyst * unit;
+
+	switch (event_state[sensor])
+	{
+	case EVENT_HIGH:
+		if (value < thr_high - hyst)
+		{
+			event_state[sensor] = EVENT_NORMAL;
+		}
+		break;
+	case EVENT_LOW:
+		if (value > thr_low + hyst)
+		{
+			event_state[sensor] = EVENT_NORMAL;
+		}
+		break;
+	default:
+		break;
+	}
+	if (event_state[sensor] == EVENT_NORMAL)
+	{
+		if ((thr->high != 0) && (value > thr_high))
+		{
+			event_state[sensor] = EVENT_HIGH;
+		}
+		else if ((thr->low != 0) && (value < thr_low))
+		{
+			event_state[sensor] = EVENT_LOW;
+		}
+	}
+
+	switch (event_state[sensor])
+	{
+	case EVENT_HIGH:
+		*low = thr_high - hyst;
+		*high = EVENT_NO_HIGH;
+		break;
+	case EVENT_LOW:
+		*low = EVENT_NO_LOW;
+		*high = thr_low + hyst;
+		break;
+	default:
+		*low = thr->low != 0 ? thr_low : EVENT_NO_LOW;
+		*high = thr->high != 0 ? thr_high : EVENT_NO_HIGH;
+		break;
+	}
+	MYLOG("EVENT", "Sensor %d value %.2f state %d window %.2f - %.2f", sensor, value, event_state[sensor], *low, *high);
+}
+
+/**
+ * @brief Called from the sensor interrupt callbacks
+ *        Reads the sensors and sends an event uplink, the periodic timer restarts
+ *
+ * @param sensor EVENT_LIGHT, EVENT_UV or EVENT_IR
+ * @return true if the event uplink was started, the sensor was read and is armed again
+ * @return false if too less time since the last uplink, the sensor must be armed again by the caller
+ */
+bool event_trigger(uint8_t sensor)
+{
+	MYLOG("EVENT", "Interrupt from sensor %d", sensor);
+	if (((millis() - last_trigger) < EVENT_MIN_INTERVAL) || gnss_active)
+	{
+		MYLOG("EVENT", "GNSS still active or too less time since last trigger");
+		return false;
+	}
+	g_event_triggered = true;
+	// Read the sensors and trigger a packet, restarts the heartbeat as well
+	sensor_handler(NULL);
+	g_event_triggered = false;
+	return true;
+}
+
+/**
+ * @brief (Re)configure the event mode of a sensor after the thresholds changed
+ *
+ * @param sensor EVENT_LIGHT, EVENT_UV or EVENT_IR
+ */
+void event_setup(uint8_t sensor)
+{
+	switch (sensor)
+	{
+	case EVENT_LIGHT:
+		if (found_sensors[LIGHT_ID].found_sensor)
+		{
+			rak1903_event_setup();
+		}
+		break;
+	case EVENT_UV:
+		if (found_sensors[UVL_ID].found_sensor)
+		{
+			rak12019_event_setup();
+		}
+		break;
+	case EVENT_IR:
+		if (found_sensors[TEMP_ARR_ID].found_sensor)
+		{
+			rak12040_event_setup();
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Add the alarm states to the payload if any sensor is in event mode
+ *     Data is added to Cayenne LPP payload as channel
+ *     LPP_CHANNEL_EVENT, bits 0/1 RAK1903 high/low, bits 2/3 RAK12019 high/low,
+ *     bit 4 RAK12040 high, bit 7 uplink was triggered by an event
+ *
+ */
+void event_add_payload(void)
+{
+	uint8_t states = 0;
+	bool active = false;
+	for (uint8_t sensor = 0; sensor < EVENT_NUM; sensor++)
+	{
+		if (event_pin(sensor) == 0)
+		{
+			continue;
+		}
+		active = true;
+		if (event_state[sensor] == EVENT_HIGH)
+		{
+			states |= 0x01 << (sensor * 2);
+		}
+		if (event_state[sensor] == EVENT_LOW)
+		{
+			states |= 0x02 << (sensor * 2);
+		}
+	}
+	if (!active)
+	{
+		return;
+	}
+	if (g_event_triggered)
+	{
+		states |= 0x80;
+	}
+	g_solution_data.addDigitalInput(LPP_CHANNEL_EVENT, states);
+}
@@ -0,0 +1,541 @@
+/**
+ * @file gnss_manager.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief GNSS power management between location acquisitions
+ *        and cache of the last fix and navigation database
+ * @version 0.1
+ * @date 2022-06-02
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+#include <SparkFun_u-blox_GNSS_Arduino_Library.h>
+
+/** Instance of the RAK12500 GNSS module (in RAK1910-RAK12500_gnss.cpp) */
+extern SFE_UBLOX_GNSS my_gnss;
+
+/** Wake up the module this time before the next acquisition (backup mode) */
+#define GNSS_WAKE_LEAD 5000
+/** Shortest time for which backup mode makes sense */
+#define GNSS_MIN_BACKUP 15000
+/** Store the fix in flash only every n fixes to save flash cycles */
+#define GNSS_CACHE_SAVE_EVERY 10
+/** Magic marker for the cached fix in flash */
+#define GNSS_CACHE_MARK 0x55AA
+/** RAK15001 sector used for the navigation database */
+#define GNSS_DBD_SECTOR 511
+/** Max size of the navigation database dump */
+#define GNSS_DBD_MAX_SIZE 4088
+/** Refresh the navigation database dump after 2 hours */
+#define GNSS_DBD_SAVE_INTERVAL 7200000
+/** Polling interval of the GNSS module during an acquisition */
+#define GNSS_POLL_INTERVAL 2500
+/** Shortest acquisition timeout */
+#define GNSS_MIN_TIMEOUT 30000
+/** Acquisition timeout without TTFF history (cold start) */
+#define GNSS_COLD_TIMEOUT 300000
+/** Number of failed acquisitions before backing off */
+#define GNSS_BACKOFF_AFTER 3
+/** Max number of cycles skipped in backoff */
+#define GNSS_BACKOFF_MAX 32
+/** Max number of cycles the last location is reused without motion */
+#define GNSS_STATIC_REFRESH 24
+
+/** GNSS power mode between acquisitions */
+uint8_t g_gnss_power_mode = GNSS_PWR_OFF;
+
+/** Last valid location */
+gnss_fix_s g_last_fix = {0};
+
+/** Cached fix as stored in flash */
+struct gnss_cache_s
+{
+	uint16_t mark;
+	uint16_t reserved;
+	int32_t latitude;
+	int32_t longitude;
+	int32_t altitude;
+	uint32_t unix_time;
+	uint32_t fix_count;
+};
+
+/** Header of the navigation database dump in the RAK15001 */
+struct gnss_dbd_header_s
+{
+	uint16_t mark;
+	uint16_t size;
+	uint32_t unix_time;
+};
+
+/** Time when the module was powered up or woke up */
+time_t gnss_on_start = 0;
+/** Time when the current acquisition was started */
+time_t gnss_acq_start = 0;
+/** Flag if a fix was found in the current cycle */
+bool gnss_cycle_fix = false;
+
+/** Time to first fix of the last cycle in ms */
+uint32_t gnss_ttff = 0;
+/** On-time of the module in the last cycle in ms */
+uint32_t gnss_on_time = 0;
+/** Sum of all TTFF's for the average */
+uint64_t gnss_ttff_sum = 0;
+/** Sum of all on-times for the average */
+uint64_t gnss_on_time_sum = 0;
+/** Number of acquisition cycles */
+uint32_t gnss_cycles = 0;
+/** Number of acquisition cycles with a fix */
+uint32_t gnss_fixes = 0;
+
+/** Smoothed TTFF in ms */
+uint32_t gnss_ttff_avg = 0;
+/** Smoothed deviation of the TTFF in ms */
+uint32_t gnss_ttff_dev = 0;
+/** Flag if TTFF history is available */
+bool gnss_ttff_init = false;
+/** Smoothed failure rate, 0 = never fails, 256 = always fails */
+uint16_t gnss_fail_rate = 0;
+/** Consecutive failed acquisitions */
+uint8_t gnss_fail_count = 0;
+/** Acquisition cycles to skip (backoff) */
+uint16_t gnss_skip_cycles = 0;
+/** Flag if the device moved since the last good fix */
+volatile bool gnss_moved = true;
+/** Number of cycles the last location was reused */
+uint16_t gnss_static_cycles = 0;
+/** Flag if the last acquisition was skipped because the device did not move */
+bool gnss_static = false;
+
+/** Number of fixes since the cache was saved */
+uint8_t gnss_cache_unsaved = 0;
+/** Last time the navigation database was saved */
+time_t gnss_dbd_saved = 0;
+/** Flag if the navigation database was ever saved since boot */
+bool gnss_dbd_valid = false;
+
+#ifdef _VARIANT_RAK4630_
+/** Buffer for the navigation database dump, header + data */
+uint8_t gnss_dbd_buffer[GNSS_DBD_MAX_SIZE + sizeof(gnss_dbd_header_s)];
+#endif
+
+/**
+ * @brief Power up or wake up the GNSS module
+ *        Depending on g_gnss_power_mode the module is either
+ *        powered up (cold/warm start) or is woken up from
+ *        backup or power save mode (hot start)
+ *
+ */
+void gnss_power_up(void)
+{
+	gnss_on_start = millis();
+
+	switch (g_gnss_power_mode)
+	{
+	case GNSS_PWR_BACKUP:
+		// Make sure the power supply is on
+		digitalWrite(WB_IO2, HIGH);
+		if (g_gnss_option == RAK12500_GNSS)
+		{
+			// Module wakes up by itself at the end of the backup period
+			if (my_gnss.isConnected())
+			{
+				break;
+			}
+			// Module did not wake up (e.g. acquisition triggered by motion), power cycle it
+			MYLOG("GNSS", "Module still in backup, power cycle");
+			digitalWrite(WB_IO2, LOW);
+			delay(100);
+			digitalWrite(WB_IO2, HIGH);
+		}
+		// Give the module some time to power up
+		delay(500);
+		break;
+	case GNSS_PWR_SAVE:
+		digitalWrite(WB_IO2, HIGH);
+		if ((g_gnss_option == RAK12500_GNSS) && my_gnss.isConnected())
+		{
+			// Switch back to continuous mode for the acquisition
+			my_gnss.powerSaveMode(false);
+			break;
+		}
+		delay(500);
+		break;
+	default:
+		// Power on the GNSS module
+		digitalWrite(WB_IO2, HIGH);
+		// Give the module some time to power up
+		delay(500);
+		break;
+	}
+}
+
+/**
+ * @brief Put the RAK12500 into backup mode until shortly before the next acquisition
+ *
+ */
+static void gnss_backup(void)
+{
+	if (g_send_interval_time > GNSS_MIN_BACKUP)
+	{
+		my_gnss.powerOff(g_send_interval_time - GNSS_WAKE_LEAD);
+	}
+	else
+	{
+		// Interval too short for backup mode, stay in power save
+		my_gnss.powerSaveMode(true);
+	}
+}
+
+/**
+ * @brief Power down the GNSS module after an acquisition
+ *        Updates the on-time statistics and saves the
+ *        navigation database if required
+ *
+ */
+void gnss_power_down(void)
+{
+	gnss_on_time = millis() - gnss_on_start;
+	gnss_on_time_sum += gnss_on_time;
+	gnss_cycles++;
+	if (gnss_cycle_fix)
+	{
+		MYLOG("GNSS", "TTFF %ld ms, on-time %ld ms", gnss_ttff, gnss_on_time);
+		if (!gnss_ttff_init)
+		{
+			gnss_ttff_avg = gnss_ttff;
+			gnss_ttff_dev = gnss_ttff / 2;
+			gnss_ttff_init = true;
+		}
+		else
+		{
+			// Smoothed TTFF and deviation (gain 1/8 and 1/4)
+			int32_t ttff_err = (int32_t)gnss_ttff - (int32_t)gnss_ttff_avg;
+			gnss_ttff_avg += ttff_err / 8;
+			gnss_ttff_dev += ((int32_t)abs(ttff_err) - (int32_t)gnss_ttff_dev) / 4;
+		}
+		gnss_fail_rate -= gnss_fail_rate / 8;
+		gnss_fail_count = 0;
+		gnss_skip_cycles = 0;
+	}
+	else
+	{
+		MYLOG("GNSS", "No fix, on-time %ld ms", gnss_on_time);
+		gnss_fail_rate += (256 - gnss_fail_rate) / 8;
+		// Timeout might have been too short, widen it
+		gnss_ttff_dev += gnss_ttff_avg / 2;
+		if (gnss_fail_count < 255)
+		{
+			gnss_fail_count++;
+		}
+		if (gnss_fail_count >= GNSS_BACKOFF_AFTER)
+		{
+			// Exponential backoff, skip 1, 2, 4, ... cycles
+			uint8_t backoff_exp = gnss_fail_count - GNSS_BACKOFF_AFTER;
+			gnss_skip_cycles = backoff_exp < 5 ? (1 << backoff_exp) : GNSS_BACKOFF_MAX;
+			MYLOG("GNSS", "%d failed acquisitions, skip %d cycles", gnss_fail_count, gnss_skip_cycles);
+		}
+	}
+	MYLOG("GNSS", "Next timeout %ld ms, failure rate %d%%", gnss_acquisition_timeout(), (gnss_fail_rate * 100) / 256);
+
+	if (g_gnss_option == RAK1910_GNSS)
+	{
+		// The power supply (WB_IO2) is shared with other modules and stays on,
+		// the module keeps tracking and stays on RAK1910_BAUD
+		stop_rak1910();
+		return;
+	}
+
+	if ((g_gnss_option != RAK12500_GNSS) || (g_gnss_power_mode == GNSS_PWR_OFF))
+	{
+		// Power down the module
+		digitalWrite(WB_IO2, LOW);
+		delay(100);
+		return;
+	}
+
+#ifdef _VARIANT_RAK4630_
+	// Save the navigation database for a fast start after a reboot
+	if (gnss_cycle_fix && g_has_rak15001 && (!gnss_dbd_valid || ((millis() - gnss_dbd_saved) > GNSS_DBD_SAVE_INTERVAL)))
+	{
+		gnss_dbd_header_s *header = (gnss_dbd_header_s *)gnss_dbd_buffer;
+		size_t dbd_size = my_gnss.readNavigationDatabase(&gnss_dbd_buffer[sizeof(gnss_dbd_header_s)], GNSS_DBD_MAX_SIZE);
+		if (dbd_size != 0)
+		{
+			header->mark = GNSS_CACHE_MARK;
+			header->size = dbd_size;
+			header->unix_time = g_last_fix.unix_time;
+			if (write_rak15001(GNSS_DBD_SECTOR, gnss_dbd_buffer, dbd_size + sizeof(gnss_dbd_header_s)))
+			{
+				MYLOG("GNSS", "Saved %d bytes navigation database", dbd_size);
+				gnss_dbd_saved = millis();
+				gnss_dbd_valid = true;
+			}
+		}
+	}
+#endif
+
+	if (g_gnss_power_mode == GNSS_PWR_SAVE)
+	{
+		my_gnss.powerSaveMode(true);
+		return;
+	}
+
+	gnss_backup();
+}
+
+/**
+ * @brief Put the module back to sleep if an acquisition is skipped
+ *        In backup mode the RAK12500 wakes up by itself at the end of the backup period,
+ *        without this call it would stay at full power until the next acquisition.
+ *        Powered off modules and modules in power save mode are still sleeping.
+ *
+ */
+void gnss_skip_acquisition(void)
+{
+	if ((g_gnss_option != RAK12500_GNSS) || (g_gnss_power_mode != GNSS_PWR_BACKUP))
+	{
+		return;
+	}
+	if (!my_gnss.isConnected())
+	{
+		// Still in backup mode
+		return;
+	}
+	MYLOG("GNSS", "Acquisition skipped, back to backup mode");
+	gnss_backup();
+}
+
+/**
+ * @brief Mark the start of a location acquisition
+ *
+ */
+void gnss_acquisition_start(void)
+{
+	gnss_acq_start = millis();
+	gnss_cycle_fix = false;
+}
+
+/**
+ * @brief Check if a location acquisition is required in this cycle
+ *        Acquisition is skipped during backoff after repeated
+ *        failures and if the accelerometer did not detect motion
+ *        since the last good fix
+ *
+ * @return true start the acquisition
+ * @return false skip the acquisition, check gnss_is_static() if
+ *         the last location can be reused
+ */
+bool gnss_acquisition_needed(void)
+{
+	gnss_static = false;
+	if (gnss_skip_cycles != 0)
+	{
+		gnss_skip_cycles--;
+		MYLOG("GNSS", "Backoff, %d cycles left", gnss_skip_cycles);
+		return false;
+	}
+
+	// Without accelerometer there is no motion information
+	if (!found_sensors[ACC_ID].found_sensor && !found_sensors[MPU_ID].found_sensor)
+	{
+		return true;
+	}
+
+	if (!gnss_moved && (gnss_fixes != 0) && (gnss_static_cycles < GNSS_STATIC_REFRESH))
+	{
+		gnss_static_cycles++;
+		gnss_static = true;
+		MYLOG("GNSS", "No motion since last fix, reuse location");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Check if the last acquisition was skipped because
+ *        the device did not move
+ *
+ * @return true g_last_fix is still valid
+ * @return false g_last_fix is outdated or not available
+ */
+bool gnss_is_static(void)
+{
+	return gnss_static;
+}
+
+/**
+ * @brief Get the timeout for the next location acquisition
+ *        Calculated from the smoothed TTFF and its deviation,
+ *        limited to 1/2 of the send interval
+ *
+ * @return uint32_t timeout in ms
+ */
+uint32_t gnss_acquisition_timeout(void)
+{
+	uint32_t max_timeout = g_send_interval_time / 2;
+	if (max_timeout == 0)
+	{
+		max_timeout = GNSS_COLD_TIMEOUT;
+	}
+
+	uint32_t timeout = GNSS_COLD_TIMEOUT;
+	if (gnss_ttff_init)
+	{
+		timeout = gnss_ttff_avg + 4 * gnss_ttff_dev + GNSS_POLL_INTERVAL;
+	}
+
+	if (timeout < GNSS_MIN_TIMEOUT)
+	{
+		timeout = GNSS_MIN_TIMEOUT;
+	}
+	if (timeout > max_timeout)
+	{
+		timeout = max_timeout;
+	}
+	return timeout;
+}
+
+/**
+ * @brief Called by the accelerometer interrupts
+ *        Marks the last location as outdated
+ *
+ */
+void gnss_motion_detected(void)
+{
+	gnss_moved = true;
+}
+
+/**
+ * @brief Called by the GNSS driver when a valid fix is in g_last_fix
+ *        Updates the TTFF statistics and the cached location
+ *
+ */
+void gnss_fix_acquired(void)
+{
+	if (!gnss_cycle_fix)
+	{
+		gnss_cycle_fix = true;
+		gnss_ttff = millis() - gnss_acq_start;
+		gnss_ttff_sum += gnss_ttff;
+		gnss_fixes++;
+		gnss_moved = false;
+		gnss_static_cycles = 0;
+	}
+
+	// Only the first fix after boot and every GNSS_CACHE_SAVE_EVERY fix is written to flash
+	if ((gnss_fixes != 1) && (++gnss_cache_unsaved < GNSS_CACHE_SAVE_EVERY))
+	{
+		return;
+	}
+	gnss_cache_unsaved = 0;
+
+	gnss_cache_s cache;
+	cache.mark = GNSS_CACHE_MARK;
+	cache.reserved = 0;
+	cache.latitude = g_last_fix.latitude;
+	cache.longitude = g_last_fix.longitude;
+	cache.altitude = g_last_fix.altitude;
+	cache.unix_time = g_last_fix.unix_time;
+	cache.fix_count = gnss_fixes;
+	if (!api.system.flash.set(GNSS_CACHE_OFFSET, (uint8_t *)&cache, sizeof(gnss_cache_s)))
+	{
+		MYLOG("GNSS", "Failed to save location cache");
+	}
+}
+
+#ifdef _VARIANT_RAK4630_
+/**
+ * @brief Push the navigation database saved on the RAK15001 to the GNSS module
+ *
+ */
+static void gnss_restore_dbd(void)
+{
+	if (!g_has_rak15001)
+	{
+		return;
+	}
+	gnss_dbd_header_s *header = (gnss_dbd_header_s *)gnss_dbd_buffer;
+	if (!read_rak15001(GNSS_DBD_SECTOR, gnss_dbd_buffer, sizeof(gnss_dbd_header_s)))
+	{
+		return;
+	}
+	if ((header->mark != GNSS_CACHE_MARK) || (header->size > GNSS_DBD_MAX_SIZE))
+	{
+		MYLOG("GNSS", "No navigation database saved");
+		return;
+	}
+	if (read_rak15001(GNSS_DBD_SECTOR, gnss_dbd_buffer, header->size + sizeof(gnss_dbd_header_s)))
+	{
+		size_t pushed = my_gnss.pushAssistNowData(&gnss_dbd_buffer[sizeof(gnss_dbd_header_s)], header->size);
+		MYLOG("GNSS", "Pushed %d bytes navigation database", pushed);
+	}
+}
+#endif
+
+/**
+ * @brief Push the cached location, the time of the RTC and the
+ *        saved navigation database to the GNSS module
+ *        Called once after a reboot for a fast start
+ *        Each assistance is pushed if it is available, independent of the others
+ *
+ */
+void gnss_restore_assist(void)
+{
+	if (g_gnss_option != RAK12500_GNSS)
+	{
+		return;
+	}
+
+	gnss_cache_s cache;
+	if (!api.system.flash.get(GNSS_CACHE_OFFSET, (uint8_t *)&cache, sizeof(gnss_cache_s)) || (cache.mark != GNSS_CACHE_MARK))
+	{
+		MYLOG("GNSS", "No cached location");
+	}
+	else
+	{
+		g_last_fix.latitude = cache.latitude;
+		g_last_fix.longitude = cache.longitude;
+		g_last_fix.altitude = cache.altitude;
+		g_last_fix.unix_time = cache.unix_time;
+
+		// Last position with 10 km accuracy, device might have moved while it was off
+		my_gnss.setPositionAssistanceLLH(cache.latitude, cache.longitude, cache.altitude / 10, 1000000);
+		MYLOG("GNSS", "Pushed cached location %.4f %.4f", cache.latitude / 10000000.0, cache.longitude / 10000000.0);
+	}
+
+	// Without a RTC the current time is unknown after a reboot
+	if (found_sensors[RTC_ID].found_sensor)
+	{
+		read_rak12002();
+		if (g_date_time.year >= 2022)
+		{
+			my_gnss.setUTCTimeAssistance(g_date_time.year, g_date_time.month, g_date_time.date,
+										 g_date_time.hour, g_date_time.minute, g_date_time.second, 0, 2);
+		}
+	}
+
+#ifdef _VARIANT_RAK4630_
+	gnss_restore_dbd();
+#endif
+}
+
+/**
+ * @brief Print the GNSS power mode and timing statistics
+ *
+ */
+void gnss_print_stats(void)
+{
+	Serial.printf("GNSS power mode %d\r\n", g_gnss_power_mode);
+	Serial.printf("GNSS cycles %ld, fixes %ld\r\n", gnss_cycles, gnss_fixes);
+	if (gnss_fixes != 0)
+	{
+		Serial.printf("GNSS TTFF last %ld ms, avg %ld ms\r\n", gnss_ttff, (uint32_t)(gnss_ttff_sum / gnss_fixes));
+	}
+	if (gnss_cycles != 0)
+	{
+		Serial.printf("GNSS on-time last %ld ms, avg %ld ms\r\n", gnss_on_time, (uint32_t)(gnss_on_time_sum / gnss_cycles));
+	}
+	Serial.printf("GNSS timeout %ld ms, failure rate %d%%\r\n", gnss_acquisition_timeout(), (gnss_fail_rate * 100) / 256);
+}
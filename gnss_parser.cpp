@@ -0,0 +1,652 @@
+/**
+ * @file gnss_parser.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Streaming NMEA and UBX parser for UART GNSS modules (RAK1910)
+ *        Bytes are parsed one by one as they come from the UART,
+ *        no line buffer, no String and no floating point.
+ *        Supported are GGA, RMC and GSA sentences and UBX-NAV-PVT.
+ * @version 0.1
+ * @date 2022-06-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Parser states */
+enum parser_state_e
+{
+	PARSE_IDLE,
+	PARSE_NMEA_BODY,
+	PARSE_NMEA_CK1,
+	PARSE_NMEA_CK2,
+	PARSE_UBX_SYNC2,
+	PARSE_UBX_CLASS,
+	PARSE_UBX_ID,
+	PARSE_UBX_LEN1,
+	PARSE_UBX_LEN2,
+	PARSE_UBX_PAYLOAD,
+	PARSE_UBX_CKA,
+	PARSE_UBX_CKB
+};
+
+/** NMEA sentence types */
+enum nmea_type_e
+{
+	NMEA_UNKNOWN,
+	NMEA_GGA,
+	NMEA_RMC,
+	NMEA_GSA
+};
+
+/** Max length of a NMEA sentence (NMEA 0183 allows 82 chars) */
+#define NMEA_MAX_LEN 100
+/** Max number of decimals used for coordinates (ddmm.mmmmm) */
+#define NMEA_MAX_DECIMALS 5
+/** UBX-NAV-PVT class and ID */
+#define UBX_NAV_CLASS 0x01
+#define UBX_NAV_PVT 0x07
+/** UBX-NAV-PVT payload length */
+#define UBX_NAV_PVT_LEN 92
+/** Bytes of UBX-NAV-PVT used, offsets 0 to 47 */
+#define UBX_PVT_CAPTURE 48
+/** Offset of pDOP in UBX-NAV-PVT */
+#define UBX_PVT_PDOP 76
+
+/** Current parser state */
+parser_state_e parser_state = PARSE_IDLE;
+
+// NMEA parsing
+/** Type of the current NMEA sentence */
+nmea_type_e nmea_type = NMEA_UNKNOWN;
+/** Running NMEA checksum */
+uint8_t nmea_checksum = 0;
+/** Received NMEA checksum */
+uint8_t nmea_rx_checksum = 0;
+/** Length of the current sentence */
+uint8_t nmea_len = 0;
+/** Current field index, 0 is the talker/type field */
+uint8_t nmea_field = 0;
+/** Characters of the current field */
+uint8_t nmea_field_len = 0;
+/** Integer part of the current field */
+uint32_t nmea_int = 0;
+/** Fraction part of the current field, scaled to NMEA_MAX_DECIMALS digits */
+uint32_t nmea_frac = 0;
+/** Number of fraction digits of the current field */
+uint8_t nmea_decimals = 0;
+/** Flag if the current field has a decimal point */
+bool nmea_has_point = false;
+/** Flag if the current field is negative */
+bool nmea_negative = false;
+/** First character of the current field (hemisphere, status) */
+char nmea_char = 0;
+/** Last 3 characters of the sentence type, e.g. "GGA" */
+char nmea_id[3];
+
+/** Pending values of the current sentence, only used if the checksum is ok */
+struct nmea_pending_s
+{
+	int32_t latitude;
+	int32_t longitude;
+	int32_t altitude;
+	uint16_t hdop;
+	uint8_t satellites;
+	uint8_t quality;
+	uint8_t fix_type;
+	bool status_ok;
+	uint32_t time;
+	uint32_t date;
+} nmea_pending;
+
+// UBX parsing
+/** Class of the current UBX frame */
+uint8_t ubx_class = 0;
+/** ID of the current UBX frame */
+uint8_t ubx_id = 0;
+/** Payload length of the current UBX frame */
+uint16_t ubx_len = 0;
+/** Payload bytes received */
+uint16_t ubx_idx = 0;
+/** Running Fletcher checksum */
+uint8_t ubx_ck_a = 0;
+uint8_t ubx_ck_b = 0;
+/** Captured part of the UBX-NAV-PVT payload */
+uint8_t ubx_pvt[UBX_PVT_CAPTURE];
+/** Captured pDOP of the UBX-NAV-PVT payload */
+uint8_t ubx_pdop[2];
+
+// Results
+/** Latest complete fix */
+gnss_fix_s parser_fix = {0};
+/** Flag if a new fix is available */
+volatile bool parser_new_fix = false;
+/** Latest fix type from GSA (NMEA) */
+uint8_t parser_gsa_fix = 0;
+/** Latest time (hhmmss) and date (ddmmyy) from RMC */
+uint32_t parser_rmc_time = 0;
+uint32_t parser_rmc_date = 0;
+/** millis() when the start of the current sentence or frame was received */
+time_t parser_msg_start = 0;
+/** millis() when the latest RMC was received */
+time_t parser_rmc_stamp = 0;
+/** millis() when the sentence or frame with the time of the latest fix was received */
+time_t parser_fix_stamp = 0;
+
+/** Statistics */
+uint32_t parser_nmea_ok = 0;
+uint32_t parser_ubx_ok = 0;
+uint32_t parser_ck_errors = 0;
+
+/**
+ * @brief Convert a date and time to UTC seconds since 1970
+ *
+ * @param year 4 digit year
+ * @param month 1 to 12
+ * @param date 1 to 31
+ * @param hour 0 to 23
+ * @param minute 0 to 59
+ * @param second 0 to 59
+ * @return uint32_t seconds since 1970-01-01 00:00:00
+ */
+uint32_t date_to_unix(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute, uint8_t second)
+{
+	// Days from civil, March based year
+	int32_t y = (int32_t)year - (month <= 2 ? 1 : 0);
+	int32_t era = y / 400;
+	uint32_t yoe = (uint32_t)(y - era * 400);
+	uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + date - 1;
+	uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int32_t days = era * 146097 + (int32_t)doe - 719468;
+	return (uint32_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/**
+ * @brief Convert a hex character to its value
+ *
+ * @param c character
+ * @return uint8_t value, 0xFF if c is no hex character
+ */
+static uint8_t hex_value(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return 0xFF;
+}
+
+/**
+ * @brief Convert NMEA ddmm.mmmmm / dddmm.mmmmm to 1e-7 degree
+ *
+ * @return int32_t coordinate in 1e-7 degree
+ */
+static int32_t nmea_coordinate(void)
+{
+	uint32_t degrees = nmea_int / 100;
+	uint32_t minutes = nmea_int % 100;
+	// Minutes scaled by 10^NMEA_MAX_DECIMALS, 1 minute = 1e7 / 60 units
+	uint32_t minutes_scaled = minutes * 100000 + nmea_frac;
+	return (int32_t)(degrees * 10000000 + (uint32_t)(((uint64_t)minutes_scaled * 100) / 60));
+}
+
+/**
+ * @brief Reset the field accumulator
+ *
+ */
+static void nmea_field_start(void)
+{
+	nmea_field_len = 0;
+	nmea_int = 0;
+	nmea_frac = 0;
+	nmea_decimals = 0;
+	nmea_has_point = false;
+	nmea_negative = false;
+	nmea_char = 0;
+}
+
+/**
+ * @brief Fraction of the current field scaled to the given number of decimals
+ *
+ * @param decimals number of decimals
+ * @return uint32_t fraction
+ */
+static uint32_t nmea_frac_scaled(uint8_t decimals)
+{
+	uint32_t frac = nmea_frac;
+	for (uint8_t i = decimals; i < NMEA_MAX_DECIMALS; i++)
+	{
+		frac /= 10;
+	}
+	return frac;
+}
+
+/**
+ * @brief Handle the end of a NMEA field
+ *        Values go to nmea_pending, they are published only if the checksum is ok
+ *
+ */
+static void nmea_field_end(void)
+{
+	if (nmea_field == 0)
+	{
+		// Talker + type, e.g. GPGGA or GNRMC, type are the last 3 characters
+		if (nmea_field_len >= 5)
+		{
+			if ((nmea_id[0] == 'G') && (nmea_id[1] == 'G') && (nmea_id[2] == 'A'))
+				nmea_type = NMEA_GGA;
+			else if ((nmea_id[0] == 'R') && (nmea_id[1] == 'M') && (nmea_id[2] == 'C'))
+				nmea_type = NMEA_RMC;
+			else if ((nmea_id[0] == 'G') && (nmea_id[1] == 'S') && (nmea_id[2] == 'A'))
+				nmea_type = NMEA_GSA;
+		}
+		return;
+	}
+
+	// Scale the fraction to NMEA_MAX_DECIMALS digits
+	for (; nmea_decimals < NMEA_MAX_DECIMALS; nmea_decimals++)
+	{
+		nmea_frac *= 10;
+	}
+
+	switch (nmea_type)
+	{
+	case NMEA_GGA:
+		// $GPGGA,hhmmss.ss,ddmm.mmmm,N,dddmm.mmmm,E,q,nn,h.h,a.a,M,...
+		switch (nmea_field)
+		{
+		case 2:
+			nmea_pending.latitude = nmea_coordinate();
+			break;
+		case 3:
+			if (nmea_char == 'S')
+				nmea_pending.latitude = -nmea_pending.latitude;
+			break;
+		case 4:
+			nmea_pending.longitude = nmea_coordinate();
+			break;
+		case 5:
+			if (nmea_char == 'W')
+				nmea_pending.longitude = -nmea_pending.longitude;
+			break;
+		case 6:
+			nmea_pending.quality = nmea_int;
+			break;
+		case 7:
+			nmea_pending.satellites = nmea_int;
+			break;
+		case 8:
+			nmea_pending.hdop = nmea_int * 100 + nmea_frac_scaled(2);
+			break;
+		case 9:
+			nmea_pending.altitude = (int32_t)(nmea_int * 1000 + nmea_frac_scaled(3));
+			if (nmea_negative)
+				nmea_pending.altitude = -nmea_pending.altitude;
+			break;
+		}
+		break;
+	case NMEA_RMC:
+		// $GPRMC,hhmmss.ss,A,ddmm.mmmm,N,dddmm.mmmm,E,s.s,c.c,ddmmyy,...
+		switch (nmea_field)
+		{
+		case 1:
+			nmea_pending.time = nmea_int;
+			break;
+		case 2:
+			nmea_pending.status_ok = (nmea_char == 'A');
+			break;
+		case 9:
+			nmea_pending.date = nmea_int;
+			break;
+		}
+		break;
+	case NMEA_GSA:
+		// $GPGSA,A,f,...
+		if (nmea_field == 2)
+		{
+			nmea_pending.fix_type = nmea_int;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Publish the values of a NMEA sentence with valid checksum
+ *
+ */
+static void nmea_commit(void)
+{
+	parser_nmea_ok++;
+	switch (nmea_type)
+	{
+	case NMEA_GGA:
+		parser_fix.latitude = nmea_pending.latitude;
+		parser_fix.longitude = nmea_pending.longitude;
+		parser_fix.altitude = nmea_pending.altitude;
+		parser_fix.hdop = nmea_pending.hdop;
+		parser_fix.satellites = nmea_pending.satellites;
+		// GGA has only quality, fix type comes from GSA
+		parser_fix.fix_type = (nmea_pending.quality == 0) ? 0 : (parser_gsa_fix != 0 ? parser_gsa_fix : 3);
+		if (parser_rmc_date != 0)
+		{
+			parser_fix.unix_time = date_to_unix(2000 + parser_rmc_date % 100, (parser_rmc_date / 100) % 100, parser_rmc_date / 10000,
+												parser_rmc_time / 10000, (parser_rmc_time / 100) % 100, parser_rmc_time % 100);
+			parser_fix_stamp = parser_rmc_stamp;
+		}
+		parser_new_fix = true;
+		break;
+	case NMEA_RMC:
+		if (nmea_pending.status_ok)
+		{
+			parser_rmc_time = nmea_pending.time;
+			parser_rmc_date = nmea_pending.date;
+			parser_rmc_stamp = parser_msg_start;
+		}
+		break;
+	case NMEA_GSA:
+		// 1 = no fix, 2 = 2D, 3 = 3D
+		parser_gsa_fix = nmea_pending.fix_type == 1 ? 0 : nmea_pending.fix_type;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Handle a character of the NMEA sentence body
+ *
+ * @param c character
+ */
+static void nmea_body(char c)
+{
+	if (c == ',')
+	{
+		nmea_field_end();
+		nmea_field++;
+		nmea_field_start();
+		return;
+	}
+
+	if (nmea_field == 0)
+	{
+		// Keep the last 3 characters of the type
+		nmea_id[0] = nmea_id[1];
+		nmea_id[1] = nmea_id[2];
+		nmea_id[2] = c;
+		nmea_field_len++;
+		return;
+	}
+
+	if (nmea_type == NMEA_UNKNOWN)
+	{
+		// Sentence is not used, only the checksum is checked
+		return;
+	}
+
+	if (nmea_field_len == 0)
+	{
+		nmea_char = c;
+	}
+	nmea_field_len++;
+
+	if ((c >= '0') && (c <= '9'))
+	{
+		if (!nmea_has_point)
+		{
+			nmea_int = nmea_int * 10 + (c - '0');
+		}
+		else if (nmea_decimals < NMEA_MAX_DECIMALS)
+		{
+			nmea_frac = nmea_frac * 10 + (c - '0');
+			nmea_decimals++;
+		}
+	}
+	else if (c == '.')
+	{
+		nmea_has_point = true;
+	}
+	else if (c == '-')
+	{
+		nmea_negative = true;
+	}
+}
+
+/**
+ * @brief Capture the used bytes of the UBX payload
+ *
+ * @param c payload byte
+ */
+static void ubx_payload(uint8_t c)
+{
+	if ((ubx_class == UBX_NAV_CLASS) && (ubx_id == UBX_NAV_PVT) && (ubx_len == UBX_NAV_PVT_LEN))
+	{
+		if (ubx_idx < UBX_PVT_CAPTURE)
+		{
+			ubx_pvt[ubx_idx] = c;
+		}
+		else if ((ubx_idx == UBX_PVT_PDOP) || (ubx_idx == UBX_PVT_PDOP + 1))
+		{
+			ubx_pdop[ubx_idx - UBX_PVT_PDOP] = c;
+		}
+	}
+	ubx_idx++;
+}
+
+/**
+ * @brief Little endian value from the captured UBX payload
+ *
+ * @param offset offset in the payload
+ * @return int32_t value
+ */
+static int32_t ubx_i4(uint8_t offset)
+{
+	return (int32_t)((uint32_t)ubx_pvt[offset] | ((uint32_t)ubx_pvt[offset + 1] << 8) | ((uint32_t)ubx_pvt[offset + 2] << 16) | ((uint32_t)ubx_pvt[offset + 3] << 24));
+}
+
+/**
+ * @brief Publish a UBX frame with valid checksum
+ *
+ */
+static void ubx_commit(void)
+{
+	parser_ubx_ok++;
+	if ((ubx_class != UBX_NAV_CLASS) || (ubx_id != UBX_NAV_PVT) || (ubx_len != UBX_NAV_PVT_LEN))
+	{
+		return;
+	}
+	// gnssFixOK flag
+	bool fix_ok = (ubx_pvt[21] & 0x01) != 0;
+	parser_fix.fix_type = fix_ok ? ubx_pvt[20] : 0;
+	parser_fix.satellites = ubx_pvt[23];
+	parser_fix.longitude = ubx_i4(24);
+	parser_fix.latitude = ubx_i4(28);
+	parser_fix.altitude = ubx_i4(36); // hMSL
+	// No HDOP in NAV-PVT, use pDOP
+	parser_fix.hdop = (uint16_t)ubx_pdop[0] | ((uint16_t)ubx_pdop[1] << 8);
+	// validDate and validTime
+	if ((ubx_pvt[11] & 0x03) == 0x03)
+	{
+		parser_fix.unix_time = date_to_unix((uint16_t)ubx_pvt[4] | ((uint16_t)ubx_pvt[5] << 8), ubx_pvt[6], ubx_pvt[7],
+											ubx_pvt[8], ubx_pvt[9], ubx_pvt[10]);
+		parser_fix_stamp = parser_msg_start;
+	}
+	parser_new_fix = true;
+}
+
+/**
+ * @brief Feed one byte from the UART into the parser
+ *
+ * @param c received byte
+ */
+void gnss_parser_feed(uint8_t c)
+{
+	switch (parser_state)
+	{
+	case PARSE_IDLE:
+		if (c == '$')
+		{
+			parser_msg_start = millis();
+			parser_state = PARSE_NMEA_BODY;
+			nmea_type = NMEA_UNKNOWN;
+			nmea_checksum = 0;
+			nmea_len = 0;
+			nmea_field = 0;
+			nmea_id[0] = nmea_id[1] = nmea_id[2] = 0;
+			nmea_field_start();
+			memset(&nmea_pending, 0, sizeof(nmea_pending_s));
+		}
+		else if (c == 0xB5)
+		{
+			parser_msg_start = millis();
+			parser_state = PARSE_UBX_SYNC2;
+		}
+		break;
+	case PARSE_NMEA_BODY:
+		if (c == '*')
+		{
+			nmea_field_end();
+			parser_state = PARSE_NMEA_CK1;
+		}
+		else if ((c < 0x20) || (c > 0x7E) || (++nmea_len > NMEA_MAX_LEN))
+		{
+			// Broken sentence, resync on the next start character
+			parser_state = PARSE_IDLE;
+			if (c == '$')
+			{
+				gnss_parser_feed(c);
+			}
+		}
+		else
+		{
+			nmea_checksum ^= c;
+			nmea_body((char)c);
+		}
+		break;
+	case PARSE_NMEA_CK1:
+		nmea_rx_checksum = hex_value(c) << 4;
+		parser_state = hex_value(c) == 0xFF ? PARSE_IDLE : PARSE_NMEA_CK2;
+		break;
+	case PARSE_NMEA_CK2:
+		parser_state = PARSE_IDLE;
+		if ((hex_value(c) != 0xFF) && ((nmea_rx_checksum | hex_value(c)) == nmea_checksum))
+		{
+			nmea_commit();
+		}
+		else
+		{
+			parser_ck_errors++;
+		}
+		break;
+	case PARSE_UBX_SYNC2:
+		parser_state = (c == 0x62) ? PARSE_UBX_CLASS : PARSE_IDLE;
+		ubx_ck_a = 0;
+		ubx_ck_b = 0;
+		break;
+	case PARSE_UBX_CLASS:
+	case PARSE_UBX_ID:
+	case PARSE_UBX_LEN1:
+	case PARSE_UBX_LEN2:
+		ubx_ck_a += c;
+		ubx_ck_b += ubx_ck_a;
+		if (parser_state == PARSE_UBX_CLASS)
+		{
+			ubx_class = c;
+			parser_state = PARSE_UBX_ID;
+		}
+		else if (parser_state == PARSE_UBX_ID)
+		{
+			ubx_id = c;
+			parser_state = PARSE_UBX_LEN1;
+		}
+		else if (parser_state == PARSE_UBX_LEN1)
+		{
+			ubx_len = c;
+			parser_state = PARSE_UBX_LEN2;
+		}
+		else
+		{
+			ubx_len |= (uint16_t)c << 8;
+			ubx_idx = 0;
+			parser_state = (ubx_len == 0) ? PARSE_UBX_CKA : PARSE_UBX_PAYLOAD;
+		}
+		break;
+	case PARSE_UBX_PAYLOAD:
+		ubx_ck_a += c;
+		ubx_ck_b += ubx_ck_a;
+		ubx_payload(c);
+		if (ubx_idx >= ubx_len)
+		{
+			parser_state = PARSE_UBX_CKA;
+		}
+		break;
+	case PARSE_UBX_CKA:
+		parser_state = (c == ubx_ck_a) ? PARSE_UBX_CKB : PARSE_IDLE;
+		if (c != ubx_ck_a)
+		{
+			parser_ck_errors++;
+		}
+		break;
+	case PARSE_UBX_CKB:
+		parser_state = PARSE_IDLE;
+		if (c == ubx_ck_b)
+		{
+			ubx_commit();
+		}
+		else
+		{
+			parser_ck_errors++;
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Get the latest fix from the parser
+ *
+ * @param fix structure for the location
+ * @return true a new fix was parsed since the last call
+ * @return false no new fix
+ */
+bool gnss_parser_get_fix(gnss_fix_s *fix)
+{
+	if (!parser_new_fix)
+	{
+		return false;
+	}
+	parser_new_fix = false;
+	*fix = parser_fix;
+	return true;
+}
+
+/**
+ * @brief Get the arrival time of the latest fix
+ *        The sentence or frame with the time is sent right after the measurement epoch,
+ *        the accuracy is limited by the UART drain interval.
+ *
+ * @return time_t millis() when the sentence or frame with the fix time was received
+ */
+time_t gnss_parser_fix_stamp(void)
+{
+	return parser_fix_stamp;
+}
+
+/**
+ * @brief Check if the parser received any valid sentence or frame
+ *
+ * @return uint32_t number of NMEA sentences and UBX frames with valid checksum
+ */
+uint32_t gnss_parser_valid(void)
+{
+	return parser_nmea_ok + parser_ubx_ok;
+}
+
+/**
+ * @brief Print the parser statistics
+ *
+ */
+void gnss_parser_stats(void)
+{
+	MYLOG("GNSS", "NMEA %ld UBX %ld checksum errors %ld", parser_nmea_ok, parser_ubx_ok, parser_ck_errors);
+}
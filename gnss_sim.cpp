@@ -0,0 +1,141 @@
+/**
+ * @file gnss_sim.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief GNSS simulator, replays recorded NMEA sentences through
+ *        the NMEA parser instead of a real module
+ *        Enable with GNSS_SIM in main.h
+ * @version 0.1
+ * @date 2022-06-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+#if GNSS_SIM > 0
+
+#include "gnss_sim_trace.h"
+
+/** Simulated TTFF without any assistance data */
+#define GNSS_SIM_TTFF_COLD 32000
+/** Simulated TTFF with time and last location pushed to the module, no valid ephemeris */
+#define GNSS_SIM_TTFF_WARM 25000
+/** Simulated TTFF after wake up from backup mode with valid ephemeris */
+#define GNSS_SIM_TTFF_HOT 2000
+/** Simulated time to a new fix in power save mode, the module keeps tracking */
+#define GNSS_SIM_TTFF_TRACKING 1000
+/** Ephemeris are valid this long after the last fix */
+#define GNSS_SIM_EPHEMERIS_VALID 14400000
+
+/** Number of records in the trace */
+#define GNSS_SIM_RECORDS (sizeof(gnss_sim_trace) / sizeof(gnss_sim_record_s))
+
+/** Time when the replay was started */
+time_t gnss_sim_start = 0;
+/** Time when the simulated module was powered up */
+time_t gnss_sim_power_on = 0;
+/** Simulated TTFF for the current cycle */
+uint32_t gnss_sim_ttff = GNSS_SIM_TTFF_COLD;
+/** Time of the last fix, 0 = no fix since boot */
+time_t gnss_sim_last_fix = 0;
+/** Index of the next record to send */
+uint16_t gnss_sim_idx = 0;
+/** Number of replays of the complete trace */
+uint16_t gnss_sim_loops = 0;
+
+/**
+ * @brief Send a sentence through the parser as if it came from the UART
+ *
+ * @param sentence NMEA sentence without line end
+ */
+static void gnss_sim_send(const char *sentence)
+{
+	while (*sentence != 0)
+	{
+		gnss_parser_feed(*sentence++);
+	}
+	gnss_parser_feed('\r');
+	gnss_parser_feed('\n');
+}
+
+/**
+ * @brief Start or continue the trace replay
+ *        Called on every power up of the GNSS module
+ *        The TTFF depends on the power mode between the acquisitions:
+ *        powered off modules need a warm start if the time and location were pushed
+ *        (cold start before the first fix), modules in backup mode a hot start if the
+ *        ephemeris are still valid, modules in power save mode are still tracking.
+ *
+ * @return true always
+ */
+bool init_gnss_sim(void)
+{
+	if (gnss_sim_start == 0)
+	{
+		gnss_sim_start = millis();
+		MYLOG("GNSS_SIM", "Replay %d sentences", GNSS_SIM_RECORDS);
+	}
+
+	bool ephemeris_valid = (gnss_sim_last_fix != 0) && ((millis() - gnss_sim_last_fix) < GNSS_SIM_EPHEMERIS_VALID);
+	if (gnss_sim_last_fix == 0)
+	{
+		gnss_sim_ttff = GNSS_SIM_TTFF_COLD;
+	}
+	else
+	{
+		switch (g_gnss_power_mode)
+		{
+		case GNSS_PWR_SAVE:
+			gnss_sim_ttff = ephemeris_valid ? GNSS_SIM_TTFF_TRACKING : GNSS_SIM_TTFF_WARM;
+			break;
+		case GNSS_PWR_BACKUP:
+			gnss_sim_ttff = ephemeris_valid ? GNSS_SIM_TTFF_HOT : GNSS_SIM_TTFF_WARM;
+			break;
+		default:
+			gnss_sim_ttff = GNSS_SIM_TTFF_WARM;
+			break;
+		}
+	}
+	MYLOG("GNSS_SIM", "Power mode %d, simulated TTFF %ld ms", g_gnss_power_mode, gnss_sim_ttff);
+	gnss_sim_power_on = millis();
+	return true;
+}
+
+/**
+ * @brief Replay the sentences up to the current time through the NMEA parser
+ *        and get the fix from the parser like for a RAK1910
+ *
+ * @param fix structure for the location
+ * @return true parser has a new fix
+ * @return false no fix, module is still acquiring or fix was lost in the trace
+ */
+bool poll_gnss_sim(gnss_fix_s *fix)
+{
+	uint32_t trace_length = gnss_sim_trace[GNSS_SIM_RECORDS - 1].time_ms + 1;
+	uint32_t trace_time = (millis() - gnss_sim_start) % trace_length;
+	uint16_t loops = (millis() - gnss_sim_start) / trace_length;
+	bool acquiring = (millis() - gnss_sim_power_on) < gnss_sim_ttff;
+
+	// Sentences since the last poll, the part of the last loop first
+	while ((gnss_sim_loops != loops) || ((gnss_sim_idx < GNSS_SIM_RECORDS) && (gnss_sim_trace[gnss_sim_idx].time_ms <= trace_time)))
+	{
+		if (gnss_sim_idx >= GNSS_SIM_RECORDS)
+		{
+			gnss_sim_idx = 0;
+			gnss_sim_loops++;
+			continue;
+		}
+		// Still acquiring, the module sends only sentences without position
+		gnss_sim_send(acquiring ? gnss_sim_no_fix : gnss_sim_trace[gnss_sim_idx].sentence);
+		gnss_sim_idx++;
+	}
+
+	if (!gnss_parser_get_fix(fix) || (fix->fix_type == 0))
+	{
+		return false;
+	}
+	gnss_sim_last_fix = millis();
+	MYLOG("GNSS_SIM", "t %ld ms fix %d sats %d hdop %d", trace_time, fix->fix_type, fix->satellites, fix->hdop);
+	return true;
+}
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file gnss_sim_trace.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Recorded GNSS trace for the GNSS simulator
+ *        NMEA sentences as received from the module UART, one RMC, GSA and GGA per epoch.
+ *        They are replayed through the NMEA parser, replace with your own recording.
+ *        Records must be sorted by time, epochs without fix (e.g. tunnel or indoor)
+ *        are recorded as sentences without position.
+ * @version 0.1
+ * @date 2022-06-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef GNSS_SIM_TRACE_H
+#define GNSS_SIM_TRACE_H
+
+/** Walk recording, 5 s per epoch, fix lost between 60 s and 85 s, starts 2022-06-10 08:00:00 UTC */
+const gnss_sim_record_s gnss_sim_trace[] = {
+	// time ms, sentence
+	{0, "$GPRMC,080000.00,A,1425.28238,N,12100.41484,E,0.5,0.0,100622,,,A*5A"},
+	{20, "$GPGSA,A,3,,,,,,,,,,,,,3.25,2.50,2.75*01"},
+	{40, "$GPGGA,080000.00,1425.28238,N,12100.41484,E,1,05,2.50,35.0,M,0.0,M,,*5E"},
+	{5000, "$GPRMC,080005.00,A,1425.28472,N,12100.41586,E,0.5,0.0,100622,,,A*54"},
+	{5020, "$GPGSA,A,3,,,,,,,,,,,,,2.34,1.80,1.98*0E"},
+	{5040, "$GPGGA,080005.00,1425.28472,N,12100.41586,E,1,06,1.80,35.2,M,0.0,M,,*5F"},
+	{10000, "$GPRMC,080010.00,A,1425.28718,N,12100.41712,E,0.5,0.0,100622,,,A*50"},
+	{10020, "$GPGSA,A,3,,,,,,,,,,,,,1.95,1.50,1.65*09"},
+	{10040, "$GPGGA,080010.00,1425.28718,N,12100.41712,E,1,07,1.50,35.1,M,0.0,M,,*54"},
+	{15000, "$GPRMC,080015.00,A,1425.28976,N,12100.41814,E,0.5,0.0,100622,,,A*5A"},
+	{15020, "$GPGSA,A,3,,,,,,,,,,,,,1.56,1.20,1.32*03"},
+	{15040, "$GPGGA,080015.00,1425.28976,N,12100.41814,E,1,08,1.20,34.9,M,0.0,M,,*5F"},
+	{20000, "$GPRMC,080020.00,A,1425.29228,N,12100.41910,E,0.5,0.0,100622,,,A*58"},
+	{20020, "$GPGSA,A,3,,,,,,,,,,,,,1.43,1.10,1.21*06"},
+	{20040, "$GPGGA,080020.00,1425.29228,N,12100.41910,E,1,08,1.10,35.3,M,0.0,M,,*55"},
+	{25000, "$GPRMC,080025.00,A,1425.29474,N,12100.42024,E,0.5,0.0,100622,,,A*5F"},
+	{25020, "$GPGSA,A,3,,,,,,,,,,,,,1.30,1.00,1.10*01"},
+	{25040, "$GPGGA,080025.00,1425.29474,N,12100.42024,E,1,09,1.00,35.4,M,0.0,M,,*55"},
+	{30000, "$GPRMC,080030.00,A,1425.29726,N,12100.42132,E,0.5,0.0,100622,,,A*59"},
+	{30020, "$GPGSA,A,3,,,,,,,,,,,,,1.23,0.95,1.04*0B"},
+	{30040, "$GPGGA,080030.00,1425.29726,N,12100.42132,E,1,09,0.95,35.6,M,0.0,M,,*5C"},
+	{35000, "$GPRMC,080035.00,A,1425.29984,N,12100.42246,E,0.5,0.0,100622,,,A*5A"},
+	{35020, "$GPGSA,A,3,,,,,,,,,,,,,1.23,0.95,1.04*0B"},
+	{35040, "$GPGGA,080035.00,1425.29984,N,12100.42246,E,1,09,0.95,35.5,M,0.0,M,,*5C"},
+	{40000, "$GPRMC,080040.00,A,1425.30230,N,12100.42360,E,0.5,0.0,100622,,,A*51"},
+	{40020, "$GPGSA,A,3,,,,,,,,,,,,,1.82,1.40,1.54*0C"},
+	{40040, "$GPGGA,080040.00,1425.30230,N,12100.42360,E,1,07,1.40,35.8,M,0.0,M,,*5D"},
+	{45000, "$GPRMC,080045.00,A,1425.30458,N,12100.42474,E,0.5,0.0,100622,,,A*5E"},
+	{45020, "$GPGSA,A,3,,,,,,,,,,,,,2.73,2.10,2.31*07"},
+	{45040, "$GPGGA,080045.00,1425.30458,N,12100.42474,E,1,06,2.10,36.1,M,0.0,M,,*5F"},
+	{50000, "$GPRMC,080050.00,A,1425.30680,N,12100.42588,E,0.5,0.0,100622,,,A*5F"},
+	{50020, "$GPGSA,A,3,,,,,,,,,,,,,4.94,3.80,4.18*0D"},
+	{50040, "$GPGGA,080050.00,1425.30680,N,12100.42588,E,1,05,3.80,36.4,M,0.0,M,,*50"},
+	{55000, "$GPRMC,080055.00,A,1425.30872,N,12100.42702,E,0.5,0.0,100622,,,A*59"},
+	{55020, "$GPGSA,A,2,,,,,,,,,,,,,6.76,5.20,5.72*03"},
+	{55040, "$GPGGA,080055.00,1425.30872,N,12100.42702,E,1,04,5.20,36.3,M,0.0,M,,*5C"},
+	{60000, "$GPRMC,080100.00,V,,,,,,,100622,,,N*73"},
+	{60020, "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30"},
+	{60040, "$GPGGA,080100.00,,,,,0,02,99.99,,,,,,*6D"},
+	{65000, "$GPRMC,080105.00,V,,,,,,,100622,,,N*76"},
+	{65020, "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30"},
+	{65040, "$GPGGA,080105.00,,,,,0,01,99.99,,,,,,*6B"},
+	{70000, "$GPRMC,080110.00,V,,,,,,,100622,,,N*72"},
+	{70020, "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30"},
+	{70040, "$GPGGA,080110.00,,,,,0,00,99.99,,,,,,*6E"},
+	{75000, "$GPRMC,080115.00,V,,,,,,,100622,,,N*77"},
+	{75020, "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30"},
+	{75040, "$GPGGA,080115.00,,,,,0,02,99.99,,,,,,*69"},
+	{80000, "$GPRMC,080120.00,V,,,,,,,100622,,,N*71"},
+	{80020, "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30"},
+	{80040, "$GPGGA,080120.00,,,,,0,03,99.99,,,,,,*6E"},
+	{85000, "$GPRMC,080125.00,A,1425.31766,N,12100.43218,E,0.5,0.0,100622,,,A*5B"},
+	{85020, "$GPGSA,A,3,,,,,,,,,,,,,5.85,4.50,4.95*03"},
+	{85040, "$GPGGA,080125.00,1425.31766,N,12100.43218,E,1,05,4.50,36.9,M,0.0,M,,*53"},
+	{90000, "$GPRMC,080130.00,A,1425.32018,N,12100.43350,E,0.5,0.0,100622,,,A*5F"},
+	{90020, "$GPGSA,A,3,,,,,,,,,,,,,3.38,2.60,2.86*02"},
+	{90040, "$GPGGA,080130.00,1425.32018,N,12100.43350,E,1,06,2.60,37.0,M,0.0,M,,*59"},
+	{95000, "$GPRMC,080135.00,A,1425.32276,N,12100.43488,E,0.5,0.0,100622,,,A*52"},
+	{95020, "$GPGSA,A,3,,,,,,,,,,,,,1.95,1.50,1.65*09"},
+	{95040, "$GPGGA,080135.00,1425.32276,N,12100.43488,E,1,08,1.50,37.2,M,0.0,M,,*58"},
+	{100000, "$GPRMC,080140.00,A,1425.32528,N,12100.43620,E,0.5,0.0,100622,,,A*5C"},
+	{100020, "$GPGSA,A,3,,,,,,,,,,,,,1.43,1.10,1.21*06"},
+	{100040, "$GPGGA,080140.00,1425.32528,N,12100.43620,E,1,09,1.10,37.1,M,0.0,M,,*50"},
+	{105000, "$GPRMC,080145.00,A,1425.32774,N,12100.43746,E,0.5,0.0,100622,,,A*53"},
+	{105020, "$GPGSA,A,3,,,,,,,,,,,,,1.30,1.00,1.10*01"},
+	{105040, "$GPGGA,080145.00,1425.32774,N,12100.43746,E,1,10,1.00,37.3,M,0.0,M,,*54"},
+	{110000, "$GPRMC,080150.00,A,1425.33026,N,12100.43878,E,0.5,0.0,100622,,,A*54"},
+	{110020, "$GPGSA,A,3,,,,,,,,,,,,,1.17,0.90,0.99*0C"},
+	{110040, "$GPGGA,080150.00,1425.33026,N,12100.43878,E,1,10,0.90,37.5,M,0.0,M,,*5D"},
+	{115000, "$GPRMC,080155.00,A,1425.33272,N,12100.44004,E,0.5,0.0,100622,,,A*56"},
+	{115020, "$GPGSA,A,3,,,,,,,,,,,,,1.17,0.90,0.99*0C"},
+	{115040, "$GPGGA,080155.00,1425.33272,N,12100.44004,E,1,11,0.90,37.4,M,0.0,M,,*5F"},
+};
+
+/** Sentence of the module while it is still acquiring */
+const char gnss_sim_no_fix[] = "$GPGGA,,,,,,0,00,99.99,,,,,,*48";
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file light_range.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Auto ranging of gain and integration time for the light sensors
+ *        The ranges are ordered from least to most sensitive, shorter integration times first
+ * @version 0.1
+ * @date 2022-07-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Counts above this part of the full scale count as saturated */
+#define LIGHT_SATURATED 0.95f
+/** Counts above this part of the full scale switch to a less sensitive range */
+#define LIGHT_TOO_HIGH 0.5f
+/** Headroom kept when selecting a new range, part of the full scale */
+#define LIGHT_HEADROOM 0.25f
+
+/**
+ * @brief Select the fastest range that reaches the target counts with enough headroom
+ *
+ * @param range auto ranging status
+ * @param light light level in the unit of the sensor
+ * @return uint8_t index of the best range
+ */
+static uint8_t light_range_best(light_range_s *range, float light)
+{
+	uint8_t best_safe = 0;
+	for (uint8_t idx = 0; idx < range->num_steps; idx++)
+	{
+		float expected = light / range->steps[idx].scale;
+		if (expected > range->steps[idx].max_count * LIGHT_HEADROOM)
+		{
+			continue;
+		}
+		best_safe = idx;
+		if (expected >= range->target)
+		{
+			return idx;
+		}
+	}
+	// Target not reachable, most sensitive range that does not saturate
+	return best_safe;
+}
+
+/**
+ * @brief Check a reading and select the range for the next reading
+ *        Saturated readings step two ranges down, readings far off the target jump
+ *        to the range calculated from the light level. The selected range is kept for the next cycles.
+ *
+ * @param range auto ranging status
+ * @param counts raw counts of the reading
+ * @return true if the range was changed and the reading should be repeated
+ * @return false if the reading is usable
+ */
+bool light_range_check(light_range_s *range, uint32_t counts)
+{
+	const light_step_s *step = &range->steps[range->step];
+	uint8_t new_step = range->step;
+
+	if (counts >= step->max_count * LIGHT_SATURATED)
+	{
+		range->saturated++;
+		new_step = range->step > 2 ? range->step - 2 : 0;
+	}
+	else if ((counts > step->max_count * LIGHT_TOO_HIGH) || (counts < range->target / 4))
+	{
+		if (counts < range->target / 4)
+		{
+			range->underflow++;
+		}
+		if (counts == 0)
+		{
+			// No light level to calculate from, one step more sensitive
+			new_step = range->step + 1 < range->num_steps ? range->step + 1 : range->step;
+		}
+		else
+		{
+			new_step = light_range_best(range, counts * step->scale);
+		}
+	}
+
+	if (new_step == range->step)
+	{
+		return false;
+	}
+	range->step = new_step;
+	range->changed = millis();
+	return true;
+}
+
+/**
+ * @brief Wait until the sensor has a complete conversion with the current range
+ *        The first conversion after a change can still use the old settings, two integration times are needed
+ *
+ * @param range auto ranging status
+ */
+void light_range_wait(light_range_s *range)
+{
+	uint32_t settle = range->steps[range->step].time_ms * 2 + 5;
+	uint32_t elapsed = millis() - range->changed;
+	if (elapsed < settle)
+	{
+		api.system.sleep.cpu(settle - elapsed);
+	}
+}
@@ -0,0 +1,474 @@
+/**
+ * @file mag_calibration.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Online hard and soft iron calibration of the RAK1905 magnetometer
+ *        Magnetometer samples are collected while the device is moved and
+ *        an ellipsoid is fitted with a fixed size least squares accumulator.
+ *        Result and the accelerometer/gyroscope offsets are kept in flash.
+ * @version 0.1
+ * @date 2022-06-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Mark for a valid calibration in flash */
+#define MAG_CAL_MARK 0x55AA
+/** Minimum number of samples before the fit is solved */
+#define MAG_CAL_MIN_SAMPLES 150
+/** Minimum distance to the last used sample in uT */
+#define MAG_CAL_MIN_STEP 3.0f
+/** Minimum span of each axis in uT, the device must be turned around */
+#define MAG_CAL_MIN_SPAN 40.0f
+/** Valid range of the earth field strength in uT */
+#define MAG_CAL_MIN_FIELD 15.0f
+#define MAG_CAL_MAX_FIELD 100.0f
+
+/** Calibration record in flash */
+struct mag_cal_s
+{
+	uint16_t mark;
+	uint8_t mag_valid;
+	uint8_t offsets_valid;
+	float acc_offset[3];
+	float gyr_offset[3];
+	float mag_offset[3];
+	float mag_matrix[9];
+};
+
+/** Current calibration */
+mag_cal_s mag_cal;
+
+/** Normal equations of the ellipsoid fit, upper triangle of the 9x9 matrix */
+double mag_ata[45];
+/** Right side of the normal equations */
+double mag_atb[9];
+/** Number of samples in the fit */
+uint16_t mag_samples = 0;
+/** Last sample used */
+float mag_last[3];
+/** Min and max per axis */
+float mag_min[3];
+float mag_max[3];
+
+/**
+ * @brief Index of element row/col in the packed upper triangle
+ *
+ * @param row row
+ * @param col column, col >= row
+ * @return uint8_t index in mag_ata
+ */
+static uint8_t mag_idx(uint8_t row, uint8_t col)
+{
+	return row * 9 - (row * (row - 1)) / 2 + (col - row);
+}
+
+/**
+ * @brief Restart the collection of magnetometer samples
+ *
+ */
+void mag_cal_restart(void)
+{
+	memset(mag_ata, 0, sizeof(mag_ata));
+	memset(mag_atb, 0, sizeof(mag_atb));
+	mag_samples = 0;
+	for (uint8_t axis = 0; axis < 3; axis++)
+	{
+		mag_last[axis] = 0.0f;
+		mag_min[axis] = 1000.0f;
+		mag_max[axis] = -1000.0f;
+	}
+}
+
+/**
+ * @brief Eigen decomposition of a symmetric 3x3 matrix (Jacobi rotations)
+ *
+ * @param a matrix, diagonal holds the eigenvalues afterwards
+ * @param v eigenvectors as columns
+ */
+static void mag_jacobi(double a[3][3], double v[3][3])
+{
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		for (uint8_t col = 0; col < 3; col++)
+		{
+			v[row][col] = (row == col) ? 1.0 : 0.0;
+		}
+	}
+
+	for (uint8_t sweep = 0; sweep < 20; sweep++)
+	{
+		double off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+		if (off < 1e-15)
+		{
+			break;
+		}
+		for (uint8_t p = 0; p < 2; p++)
+		{
+			for (uint8_t q = p + 1; q < 3; q++)
+			{
+				if (fabs(a[p][q]) < 1e-20)
+				{
+					continue;
+				}
+				double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+				double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				double c = 1.0 / sqrt(t * t + 1.0);
+				double s = t * c;
+				for (uint8_t k = 0; k < 3; k++)
+				{
+					double akp = a[k][p];
+					double akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (uint8_t k = 0; k < 3; k++)
+				{
+					double apk = a[p][k];
+					double aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (uint8_t k = 0; k < 3; k++)
+				{
+					double vkp = v[k][p];
+					double vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Solve the normal equations and calculate offset and correction matrix
+ *        Ellipsoid Ax² + By² + Cz² + 2Dxy + 2Exz + 2Fyz + 2Gx + 2Hy + 2Iz = 1
+ *
+ * @return true if a valid calibration was found
+ * @return false if the fit failed
+ */
+static bool mag_cal_solve(void)
+{
+	// Full matrix for Gaussian elimination
+	double m[9][10];
+	for (uint8_t row = 0; row < 9; row++)
+	{
+		for (uint8_t col = 0; col < 9; col++)
+		{
+			m[row][col] = row <= col ? mag_ata[mag_idx(row, col)] : mag_ata[mag_idx(col, row)];
+		}
+		m[row][9] = mag_atb[row];
+	}
+
+	for (uint8_t col = 0; col < 9; col++)
+	{
+		uint8_t pivot = col;
+		for (uint8_t row = col + 1; row < 9; row++)
+		{
+			if (fabs(m[row][col]) > fabs(m[pivot][col]))
+			{
+				pivot = row;
+			}
+		}
+		if (fabs(m[pivot][col]) < 1e-12)
+		{
+			MYLOG("MAG", "Fit is singular");
+			return false;
+		}
+		if (pivot != col)
+		{
+			for (uint8_t k = 0; k < 10; k++)
+			{
+				double tmp = m[col][k];
+				m[col][k] = m[pivot][k];
+				m[pivot][k] = tmp;
+			}
+		}
+		for (uint8_t row = 0; row < 9; row++)
+		{
+			if (row == col)
+			{
+				continue;
+			}
+			double factor = m[row][col] / m[col][col];
+			for (uint8_t k = col; k < 10; k++)
+			{
+				m[row][k] -= factor * m[col][k];
+			}
+		}
+	}
+	double p[9];
+	for (uint8_t row = 0; row < 9; row++)
+	{
+		p[row] = m[row][9] / m[row][row];
+	}
+
+	// Quadratic form and linear part
+	double q[3][3] = {{p[0], p[3], p[4]}, {p[3], p[1], p[5]}, {p[4], p[5], p[2]}};
+	double l[3] = {p[6], p[7], p[8]};
+
+	// Center = -Q^-1 * l
+	double det = q[0][0] * (q[1][1] * q[2][2] - q[1][2] * q[2][1]) - q[0][1] * (q[1][0] * q[2][2] - q[1][2] * q[2][0]) + q[0][2] * (q[1][0] * q[2][1] - q[1][1] * q[2][0]);
+	if (fabs(det) < 1e-30)
+	{
+		MYLOG("MAG", "Fit is degenerated");
+		return false;
+	}
+	double inv[3][3];
+	inv[0][0] = (q[1][1] * q[2][2] - q[1][2] * q[2][1]) / det;
+	inv[0][1] = (q[0][2] * q[2][1] - q[0][1] * q[2][2]) / det;
+	inv[0][2] = (q[0][1] * q[1][2] - q[0][2] * q[1][1]) / det;
+	inv[1][0] = inv[0][1];
+	inv[1][1] = (q[0][0] * q[2][2] - q[0][2] * q[2][0]) / det;
+	inv[1][2] = (q[0][2] * q[1][0] - q[0][0] * q[1][2]) / det;
+	inv[2][0] = inv[0][2];
+	inv[2][1] = inv[1][2];
+	inv[2][2] = (q[0][0] * q[1][1] - q[0][1] * q[1][0]) / det;
+
+	double center[3];
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		center[row] = -(inv[row][0] * l[0] + inv[row][1] * l[1] + inv[row][2] * l[2]);
+	}
+
+	// (x - c)' Q (x - c) = 1 + c' Q c
+	double scale = 1.0;
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		for (uint8_t col = 0; col < 3; col++)
+		{
+			scale += center[row] * q[row][col] * center[col];
+		}
+	}
+	if (scale <= 0.0)
+	{
+		MYLOG("MAG", "Fit is no ellipsoid");
+		return false;
+	}
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		for (uint8_t col = 0; col < 3; col++)
+		{
+			q[row][col] /= scale;
+		}
+	}
+
+	// Soft iron matrix W = V * sqrt(eigenvalues) * V', scaled to the mean field strength
+	double v[3][3];
+	mag_jacobi(q, v);
+	double eigen[3] = {q[0][0], q[1][1], q[2][2]};
+	if ((eigen[0] <= 0.0) || (eigen[1] <= 0.0) || (eigen[2] <= 0.0))
+	{
+		MYLOG("MAG", "Fit is no ellipsoid");
+		return false;
+	}
+	// Geometric mean of the radii
+	double field = pow(eigen[0] * eigen[1] * eigen[2], -1.0 / 6.0);
+	if ((field < MAG_CAL_MIN_FIELD) || (field > MAG_CAL_MAX_FIELD))
+	{
+		MYLOG("MAG", "Field strength %.1f uT out of range", field);
+		return false;
+	}
+	for (uint8_t row = 0; row < 3; row++)
+	{
+		for (uint8_t col = 0; col < 3; col++)
+		{
+			double sum = 0.0;
+			for (uint8_t k = 0; k < 3; k++)
+			{
+				sum += v[row][k] * sqrt(eigen[k]) * v[col][k];
+			}
+			mag_cal.mag_matrix[row * 3 + col] = sum * field;
+		}
+		mag_cal.mag_offset[row] = center[row];
+	}
+	mag_cal.mag_valid = 1;
+
+	MYLOG("MAG", "Offset %.1f %.1f %.1f uT, field %.1f uT", center[0], center[1], center[2], field);
+	return true;
+}
+
+/**
+ * @brief Save the calibration to flash
+ *
+ * @return true if the calibration was saved
+ * @return false if the flash write failed
+ */
+bool mag_cal_save(void)
+{
+	mag_cal.mark = MAG_CAL_MARK;
+	if (!api.system.flash.set(MAG_CAL_OFFSET, (uint8_t *)&mag_cal, sizeof(mag_cal_s)))
+	{
+		MYLOG("MAG", "Failed to save calibration");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Load the calibration from flash
+ *
+ * @return true if a calibration was found
+ * @return false if no calibration is stored
+ */
+bool mag_cal_load(void)
+{
+	mag_cal_restart();
+	if (!api.system.flash.get(MAG_CAL_OFFSET, (uint8_t *)&mag_cal, sizeof(mag_cal_s)) || (mag_cal.mark != MAG_CAL_MARK))
+	{
+		memset(&mag_cal, 0, sizeof(mag_cal_s));
+		return false;
+	}
+	MYLOG("MAG", "Calibration found, magnetometer %s", mag_cal.mag_valid ? "calibrated" : "not calibrated");
+	return true;
+}
+
+/**
+ * @brief Store the accelerometer and gyroscope offsets
+ *
+ * @param acc accelerometer offsets X, Y, Z
+ * @param gyr gyroscope offsets X, Y, Z
+ */
+void mag_cal_set_offsets(float *acc, float *gyr)
+{
+	memcpy(mag_cal.acc_offset, acc, sizeof(mag_cal.acc_offset));
+	memcpy(mag_cal.gyr_offset, gyr, sizeof(mag_cal.gyr_offset));
+	mag_cal.offsets_valid = 1;
+	mag_cal_save();
+}
+
+/**
+ * @brief Get the stored accelerometer and gyroscope offsets
+ *
+ * @param acc accelerometer offsets X, Y, Z
+ * @param gyr gyroscope offsets X, Y, Z
+ * @return true if offsets measured while the device was still are stored
+ * @return false if the offsets must be measured
+ */
+bool mag_cal_get_offsets(float *acc, float *gyr)
+{
+	memcpy(acc, mag_cal.acc_offset, sizeof(mag_cal.acc_offset));
+	memcpy(gyr, mag_cal.gyr_offset, sizeof(mag_cal.gyr_offset));
+	return mag_cal.offsets_valid == 1;
+}
+
+/**
+ * @brief Clear the magnetometer calibration and start a new one
+ *
+ * @param clear_offsets true to clear the accelerometer and gyroscope
+ *        offsets as well, they are measured again on the next boot
+ */
+void mag_cal_reset(bool clear_offsets)
+{
+	mag_cal.mag_valid = 0;
+	mag_cal_restart();
+	if (clear_offsets)
+	{
+		memset(&mag_cal, 0, sizeof(mag_cal_s));
+		// Invalid mark, autoOffsets() runs on next boot
+		api.system.flash.set(MAG_CAL_OFFSET, (uint8_t *)&mag_cal, sizeof(mag_cal_s));
+		return;
+	}
+	mag_cal_save();
+}
+
+/**
+ * @brief Add a magnetometer sample to the fit
+ *        Samples close to the last used sample are skipped
+ *
+ * @param mag raw magnetometer values X, Y, Z in uT
+ */
+void mag_cal_add(float *mag)
+{
+	if (mag_cal.mag_valid)
+	{
+		return;
+	}
+
+	float dx = mag[0] - mag_last[0];
+	float dy = mag[1] - mag_last[1];
+	float dz = mag[2] - mag_last[2];
+	if ((dx * dx + dy * dy + dz * dz) < (MAG_CAL_MIN_STEP * MAG_CAL_MIN_STEP))
+	{
+		return;
+	}
+	memcpy(mag_last, mag, sizeof(mag_last));
+
+	double x = mag[0];
+	double y = mag[1];
+	double z = mag[2];
+	double row[9] = {x * x, y * y, z * z, 2 * x * y, 2 * x * z, 2 * y * z, 2 * x, 2 * y, 2 * z};
+	for (uint8_t i = 0; i < 9; i++)
+	{
+		for (uint8_t j = i; j < 9; j++)
+		{
+			mag_ata[mag_idx(i, j)] += row[i] * row[j];
+		}
+		mag_atb[i] += row[i];
+	}
+	mag_samples++;
+
+	for (uint8_t axis = 0; axis < 3; axis++)
+	{
+		mag_min[axis] = mag_last[axis] < mag_min[axis] ? mag_last[axis] : mag_min[axis];
+		mag_max[axis] = mag_last[axis] > mag_max[axis] ? mag_last[axis] : mag_max[axis];
+	}
+
+	if ((mag_samples < MAG_CAL_MIN_SAMPLES) || ((mag_samples % 50) != 0))
+	{
+		return;
+	}
+	for (uint8_t axis = 0; axis < 3; axis++)
+	{
+		if ((mag_max[axis] - mag_min[axis]) < MAG_CAL_MIN_SPAN)
+		{
+			// Not enough orientations seen yet
+			return;
+		}
+	}
+	if (mag_cal_solve())
+	{
+		mag_cal_save();
+	}
+	else
+	{
+		mag_cal_restart();
+	}
+}
+
+/**
+ * @brief Apply the calibration to a magnetometer sample
+ *
+ * @param mag magnetometer values X, Y, Z in uT, corrected in place
+ */
+void mag_cal_apply(float *mag)
+{
+	if (!mag_cal.mag_valid)
+	{
+		return;
+	}
+	float x = mag[0] - mag_cal.mag_offset[0];
+	float y = mag[1] - mag_cal.mag_offset[1];
+	float z = mag[2] - mag_cal.mag_offset[2];
+	mag[0] = mag_cal.mag_matrix[0] * x + mag_cal.mag_matrix[1] * y + mag_cal.mag_matrix[2] * z;
+	mag[1] = mag_cal.mag_matrix[3] * x + mag_cal.mag_matrix[4] * y + mag_cal.mag_matrix[5] * z;
+	mag[2] = mag_cal.mag_matrix[6] * x + mag_cal.mag_matrix[7] * y + mag_cal.mag_matrix[8] * z;
+}
+
+/**
+ * @brief Print the calibration status
+ *
+ */
+void mag_cal_status(void)
+{
+	if (mag_cal.mag_valid)
+	{
+		Serial.printf("Magnetometer offset %.1f %.1f %.1f uT\r\n", mag_cal.mag_offset[0], mag_cal.mag_offset[1], mag_cal.mag_offset[2]);
+	}
+	else
+	{
+		Serial.printf("Magnetometer not calibrated, %d samples collected\r\n", mag_samples);
+	}
+}
@@ -33,6 +33,11 @@
 #define MYLOG(...)
 #endif
 
+// GNSS simulator, set to 1 to replay the trace in gnss_sim_trace.h instead of using a GNSS module
+#ifndef GNSS_SIM
+#define GNSS_SIM 0
+#endif
+
 // Globals
 extern char g_dev_name[];
 extern bool g_has_rak15001;
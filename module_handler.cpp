@@ -107,6 +107,19 @@ void find_modules(void)
 		}
 	}
 
+#if GNSS_SIM > 0
+	// Replay a recorded GNSS trace instead of a GNSS module
+	found_sensors[GNSS_ID].found_sensor = true;
+	num_dev++;
+#endif
+
+	// RAK1910 GNSS is on the UART and not found by the I2C scan, probe only if no RAK12500 answered
+	if (!found_sensors[GNSS_ID].found_sensor && probe_rak1910())
+	{
+		found_sensors[GNSS_ID].found_sensor = true;
+		num_dev++;
+	}
+
 	// MYLOG("SCAN", "Found %d sensors", num_dev);
 
 	// if (num_dev == 0)
@@ -167,6 +180,10 @@ void find_modules(void)
 		{
 			found_sensors[PRESS_ID].found_sensor = false;
 		}
+		else
+		{
+			init_press_mode_at();
+		}
 	}
 
 	if (found_sensors[LIGHT_ID].found_sensor)
@@ -187,6 +204,10 @@ void find_modules(void)
 		{
 			found_sensors[ACC_ID].found_sensor = false;
 		}
+		else
+		{
+			init_acc_stream_at();
+		}
 	}
 
 	if (found_sensors[GYRO_ID].found_sensor)
@@ -204,11 +225,14 @@ void find_modules(void)
 				else
 				{
 					found_sensors[TEMP_ARR_ID].found_sensor = true;
+					init_thermal_img_at();
 				}
 			}
 			else
 			{
 				found_sensors[MPU_ID].found_sensor = true;
+				init_fusion_at();
+				init_mag_cal_at();
 			}
 		}
 	}
@@ -218,6 +242,7 @@ void find_modules(void)
 		if (init_rak1906())
 		{
 			sprintf(g_dev_name, "RUI3 Environment Sensor");
+			init_bme_gas_at();
 		}
 		else
 		{
@@ -276,6 +301,10 @@ void find_modules(void)
 		{
 			found_sensors[TOF_ID].found_sensor = false;
 		}
+		else
+		{
+			init_tank_at();
+		}
 	}
 
 	if (found_sensors[UVL_ID].found_sensor)
@@ -316,12 +345,19 @@ void find_modules(void)
 		{
 			sprintf(g_dev_name, "RUI3 Location Tracker");
 			init_gnss_at();
+			init_gnss_pwr_at();
 		}
 		else
 		{
 			found_sensors[GNSS_ID].found_sensor = false;
 		}
 	}
+
+	// Threshold events need the light, UV or thermal array sensor
+	if (found_sensors[LIGHT_ID].found_sensor || found_sensors[UVL_ID].found_sensor || found_sensors[TEMP_ARR_ID].found_sensor)
+	{
+		init_event_at();
+	}
 }
 
 /**
@@ -368,10 +404,7 @@ void announce_modules(void)
 	if (found_sensors[ENV_ID].found_sensor)
 	{
 		Serial.println("+EVT:RAK1906 OK");
-		// Start reading sensor data
-		start_rak1906();
-		delay(100);
-		// Reading sensor data
+		// Reading sensor data, waits for the end of the measurement
 		read_rak1906();
 	}
 
@@ -440,6 +473,12 @@ void announce_modules(void)
  */
 void get_sensor_values(void)
 {
+	if (found_sensors[ENV_ID].found_sensor)
+	{
+		// Start the BME680 first, the conversion runs while the other sensors are read
+		start_rak1906();
+	}
+
 	if (found_sensors[TEMP_ID].found_sensor)
 	{
 		// Read sensor data
@@ -472,10 +511,7 @@ void get_sensor_values(void)
 
 	if (found_sensors[ENV_ID].found_sensor)
 	{
-		// Start reading sensor data
-		start_rak1906();
-		delay(100);
-		// Reading sensor data
+		// Reading sensor data, waits for the end of the measurement
 		read_rak1906();
 	}
 
@@ -493,8 +529,8 @@ void get_sensor_values(void)
 
 	if (found_sensors[RTC_ID].found_sensor)
 	{
-		// Read sensor data
-		read_rak12002();
+		// Timestamp of the sample
+		rtc_add_payload();
 	}
 
 	if (found_sensors[TOF_ID].found_sensor)
@@ -526,4 +562,40 @@ void get_sensor_values(void)
 		// Read sensor data
 		read_rak12047();
 	}
-}
\ No newline at end of file
+
+	// Alarm states of the threshold events
+	event_add_payload();
+}
+
+/**
+ * @brief Check if a WisBlock IO is used by a found module
+ *        WB_IO2 switches the 3V3_S supply and is never available
+ *
+ * @param pin WisBlock pin, WB_IO1 to WB_IO6
+ * @return true if the pin is used
+ * @return false if the pin is free for an interrupt
+ */
+bool wb_io_used(uint8_t pin)
+{
+	if (pin == WB_IO2)
+	{
+		return true;
+	}
+	if (found_sensors[ACC_ID].found_sensor && (pin == acc_int_pin))
+	{
+		return true;
+	}
+	if (found_sensors[MPU_ID].found_sensor && (pin == mpu_int_pin))
+	{
+		return true;
+	}
+	if (found_sensors[TOF_ID].found_sensor && (pin == xshut_pin))
+	{
+		return true;
+	}
+	if (has_rak12007 && ((pin == TRIG) || (pin == ECHO) || (pin == PD)))
+	{
+		return true;
+	}
+	return false;
+}
@@ -15,6 +15,7 @@
 void find_modules(void);
 void announce_modules(void);
 void get_sensor_values(void);
+bool wb_io_used(uint8_t pin);
 
 // Forward declarations
 void sensor_handler(void *);
@@ -124,53 +125,225 @@ extern volatile sensors_t found_sensors[];
 #define LPP_CHANNEL_WLEVEL 61		   // RAK12059
 #define LPP_CHANNEL_WL_LOW 62		   // RAK12059
 #define LPP_CHANNEL_WL_HIGH 63		   // RAK12059
+#define LPP_CHANNEL_VIB_RMS 64		   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_PEAK 65		   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_CREST 66	   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_BAND_1 67	   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_BAND_2 68	   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_BAND_3 69	   // RAK1904 streaming
+#define LPP_CHANNEL_VIB_BAND_4 70	   // RAK1904 streaming
+#define LPP_CHANNEL_ROLL 71			   // RAK1905 fusion
+#define LPP_CHANNEL_PITCH 72		   // RAK1905 fusion
+#define LPP_CHANNEL_HEADING 73		   // RAK1905 fusion
+#define LPP_CHANNEL_TILT 74			   // RAK1905 fusion
+#define LPP_CHANNEL_TANK_VOL 75		   // Tank model
+#define LPP_CHANNEL_TANK_FILL 76	   // Tank model
+#define LPP_CHANNEL_TANK_RATE 77	   // Tank model
+#define LPP_CHANNEL_TANK_ALARM 78	   // Tank model
+#define LPP_CHANNEL_IR_COUNT 79		   // RAK12040
+#define LPP_CHANNEL_IR_MAX_TEMP 80	   // RAK12040
+#define LPP_CHANNEL_IR_MAX_PIXEL 81	   // RAK12040
+#define LPP_CHANNEL_IR_BACKGROUND 82   // RAK12040
+#define LPP_CHANNEL_PRESS_TREND 83	   // RAK1902
+#define LPP_CHANNEL_EVENT 84		   // RAK1903, RAK12019, RAK12040 event mode
+#define LPP_CHANNEL_TIME 85			   // RAK12002
 
 extern WisCayenne g_solution_data;
 
+// Shared cache of the latest sensor values
+/** Physical quantities in the cache */
+#define CACHE_TEMP 0  // °C
+#define CACHE_HUMID 1 // %RH
+#define CACHE_PRESS 2 // hPa
+#define CACHE_NUM 3
+/** Lower limit of the max age of cached values in ms */
+#define CACHE_MAX_AGE_MIN 1800000
+/** Margin on top of the send interval for the max age in ms */
+#define CACHE_AGE_MARGIN 60000
+/** Cached sensor value */
+struct cache_value_s
+{
+	float value;	 // Value in the unit of the quantity
+	time_t time;	 // millis() of the reading, 0 = no value
+	uint8_t source;	 // Sensor ID
+	uint8_t quality; // Accuracy rank of the sensor, higher is better
+};
+// Accuracy ranks of the sources
+#define QUALITY_RAK1901 4
+#define QUALITY_RAK1906 3
+#define QUALITY_RAK1902 3
+#define QUALITY_RAK12037 2
+#define QUALITY_RAK12003 1
+void sensor_cache_set(uint8_t quantity, float value, uint8_t source, uint8_t quality);
+uint32_t sensor_cache_max_age(void);
+bool sensor_cache_get(uint8_t quantity, float *value, uint32_t max_age = sensor_cache_max_age());
+
 // Sensor functions
 bool init_rak1901(void);
 void read_rak1901(void);
-void get_rak1901_values(float *values);
 bool init_rak1902(void);
 void read_rak1902(void);
-uint16_t get_alt_rak1902(void);
+bool rak1902_set_mode(uint8_t mode);
+extern uint8_t g_press_mode;
+/** RAK1902 one shot conversions on request */
+#define PRESS_ONE_SHOT 0
+/** RAK1902 continuous 1 Hz conversions into the FIFO */
+#define PRESS_CONTINUOUS 1
+bool get_press_rak1902(float *pressure);
 bool init_rak1903(void);
 void read_rak1903(void);
+void rak1903_event_setup(void);
 bool init_rak1904(void);
 void read_rak1904(void);
 void int_assign_rak1904(uint8_t new_irq_pin);
 void clear_int_rak1904(void);
+extern uint8_t acc_int_pin;
+bool rak1904_set_stream(uint8_t odr);
+uint16_t rak1904_stream_available(void);
+bool rak1904_stream_get(int16_t *xyz);
+extern uint8_t g_acc_stream_odr;
+void vib_process(void);
+void vib_add_payload(void);
+extern uint16_t g_vib_band_edges[];
 bool init_rak1905(void);
 void read_rak1905(void);
 void clear_int_rak1905(void);
+extern uint8_t mpu_int_pin;
+bool rak1905_set_fusion(uint8_t rate);
+bool rak1905_calibrate_offsets(void);
+extern uint8_t g_fusion_rate;
+void fusion_init(uint16_t sample_rate);
+void fusion_update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
+void fusion_add_payload(void);
+bool mag_cal_load(void);
+void mag_cal_set_offsets(float *acc, float *gyr);
+bool mag_cal_get_offsets(float *acc, float *gyr);
+void mag_cal_reset(bool clear_offsets);
+void mag_cal_add(float *mag);
+void mag_cal_apply(float *mag);
+void mag_cal_status(void);
 bool init_rak1906(void);
 void start_rak1906(void);
 bool read_rak1906(void);
-uint16_t get_alt_rak1906(void);
+bool get_press_rak1906(float *pressure);
+/** BME680 gas heater profile */
+struct bme_gas_s
+{
+	uint16_t heater_temp; // Heater temperature in degrees C, 0 = T/P/H only
+	uint16_t heater_time; // Heater duration in ms
+	uint8_t duty;		  // Measure gas every n-th reading
+};
+extern bme_gas_s g_bme_gas;
 bool init_rak1921(void);
 void rak1921_add_line(char *line);
 void rak1921_show(void);
 void rak1921_write_header(char *header_line);
 bool init_rak12002(void);
 void set_rak12002(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute);
-void read_rak12002(void);
+bool read_rak12002(void);
+uint32_t get_unix_rak12002(void);
+void rtc_add_payload(void);
+bool rtc_schedule_uplink(void);
+void rtc_restart_uplink_timer(void);
+void rtc_wake_setup(void);
+extern bool g_rtc_align;
+extern uint8_t g_rtc_wake_pin;
+bool rtc_wake_pin_free(uint8_t io);
+extern float g_rtc_drift_ppm;
+
+/** Time sources of the RTC, lower is better */
+#define RTC_SYNC_NONE 0
+#define RTC_SYNC_GNSS 1
+#define RTC_SYNC_LORAWAN 2
+#define RTC_SYNC_MANUAL 3
+
+/** RTC synchronisation status */
+struct rtc_sync_s
+{
+	uint32_t last_time; // Unix time of the last synchronisation, 0 = never
+	int32_t offset_ms;	// RTC minus time source before the last synchronisation
+	float drift_ppm;	// Drift of the RTC between the last two synchronisations
+	uint16_t count;		// Number of synchronisations
+	uint8_t source;		// RTC_SYNC_GNSS, RTC_SYNC_LORAWAN or RTC_SYNC_MANUAL
+};
+extern rtc_sync_s g_rtc_sync;
+bool rtc_sync(uint32_t unix_time, uint16_t millisecond, time_t stamp, uint8_t source);
+void rtc_sync_process(void);
+void rtc_sync_request(void);
+void rtc_sync_lorawan(void);
 bool init_rak12003(void);
 void read_rak12003(void);
 bool init_rak12010(void);
 void read_rak12010(void);
+/** One gain and integration time setting of a light sensor */
+struct light_step_s
+{
+	uint8_t gain;		// Gain setting of the driver
+	uint8_t integration; // Integration time or resolution setting of the driver
+	uint16_t time_ms;	// Integration time in ms
+	uint32_t max_count; // Full scale counts
+	float scale;		// Sensor unit per count
+};
+/** Auto ranging status of a light sensor */
+struct light_range_s
+{
+	const light_step_s *steps; // Ranges, least sensitive first
+	uint8_t num_steps;		   // Number of ranges
+	uint8_t step;			   // Current range
+	uint32_t target;		   // Min counts for a good resolution
+	time_t changed;			   // millis() of the last range change
+	uint16_t saturated;		   // Number of saturated readings
+	uint16_t underflow;		   // Number of readings below target / 4
+};
+bool light_range_check(light_range_s *range, uint32_t counts);
+void light_range_wait(light_range_s *range);
 extern uint8_t xshut_pin;
+extern uint16_t g_tof_budget;
+/** RAK12014 default timing budget per reading in ms */
+#define TOF_BUDGET_DEFAULT 50
+/** RAK12014 min timing budget per reading in ms */
+#define TOF_BUDGET_MIN 20
+/** RAK12014 max timing budget per reading in ms, readings time out after 500 ms */
+#define TOF_BUDGET_MAX 400
 bool init_rak12014(void);
 void read_rak12014(void);
+bool rak12014_measure(uint16_t *distance);
+float tank_volume(uint16_t level);
+void tank_add_payload(uint16_t distance);
+uint32_t tank_check(void);
 bool init_rak12019(void);
 void read_rak12019(void);
+void rak12019_event_setup(void);
 bool init_rak12037(void);
 void read_rak12037(void);
+void rak12037_set_interval(void);
 bool init_rak12040(void);
 void read_rak12040(void);
+void rak12040_event_setup(void);
+extern uint8_t g_thermal_img_interval;
+bool thermal_frame_due(void);
+void thermal_encode_frame(float frame[8][8]);
+uint32_t thermal_send_fragment(void);
+/** fPort for the RAK12040 thermal frame fragments */
+#define THERMAL_FPORT 12
 bool init_rak12047(void);
 void read_rak12047(void);
 bool init_gnss(void);
 bool poll_gnss(void);
+void gnss_power_up(void);
+void gnss_power_down(void);
+void gnss_skip_acquisition(void);
+void gnss_acquisition_start(void);
+bool gnss_acquisition_needed(void);
+bool gnss_is_static(void);
+uint32_t gnss_acquisition_timeout(void);
+void gnss_motion_detected(void);
+void gnss_fix_acquired(void);
+void gnss_restore_assist(void);
+void gnss_print_stats(void);
+bool probe_rak1910(void);
+void stop_rak1910(void);
+uint32_t date_to_unix(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute, uint8_t second);
 bool init_rak15000(void);
 bool read_rak15000(uint16_t addr, uint8_t *buffer, uint16_t num);
 bool write_rak15000(uint16_t addr, uint8_t *buffer, uint16_t num);
@@ -182,6 +355,16 @@ bool read_config(void);
 // Custom AT commands
 bool init_rtc_at(void);
 bool init_gnss_at(void);
+bool init_gnss_pwr_at(void);
+bool init_acc_stream_at(void);
+bool init_fusion_at(void);
+bool init_mag_cal_at(void);
+bool init_tank_at(void);
+bool init_thermal_img_at(void);
+bool init_press_mode_at(void);
+bool init_bme_gas_at(void);
+bool init_event_at(void);
+bool init_report_at(void);
 bool init_status_at(void);
 bool init_frequency_at(void);
 void send_packet(void);
@@ -194,6 +377,7 @@ extern time_t last_trigger;
 extern bool motion_detected;
 extern bool gnss_active;
 extern uint8_t gnss_format;
+extern uint8_t g_gnss_power_mode;
 
 /** RTC date/time structure */
 struct date_time_s
@@ -207,6 +391,113 @@ struct date_time_s
 	uint8_t second;
 };
 extern date_time_s g_date_time;
+
+/** GNSS fix structure, filled by the GNSS driver */
+struct gnss_fix_s
+{
+	int32_t latitude;	// 1e-7 degree
+	int32_t longitude;	// 1e-7 degree
+	int32_t altitude;	// mm above MSL
+	uint16_t hdop;		// 0.01
+	uint8_t satellites; // Satellites in view
+	uint8_t fix_type;	// 0 = no fix, 2 = 2D, 3 = 3D
+	uint32_t unix_time; // UTC seconds since 1970, 0 if unknown
+};
+extern gnss_fix_s g_last_fix;
+void gnss_add_payload(gnss_fix_s *fix);
+void gnss_parser_feed(uint8_t c);
+bool gnss_parser_get_fix(gnss_fix_s *fix);
+time_t gnss_parser_fix_stamp(void);
+uint32_t gnss_parser_valid(void);
+void gnss_parser_stats(void);
+float altitude_from_pressure(float pressure);
+void altitude_refresh(void);
+void altitude_gnss_update(gnss_fix_s *fix);
+int32_t altitude_get(gnss_fix_s *fix);
+
+/** Event mode thresholds */
+struct event_thr_s
+{
+	uint32_t low;  // Low alarm, 0 = off
+	uint32_t high; // High alarm, 0 = off
+	uint16_t hyst; // Hysteresis to return to normal
+	uint8_t pin;   // Interrupt on WB_IO1 ... WB_IO6, 0 = event mode off
+};
+extern event_thr_s g_event_thr[];
+// Event sensors, units of the thresholds
+#define EVENT_LIGHT 0 // RAK1903 in lux
+#define EVENT_UV 1	  // RAK12019 in 0.01 UVI
+#define EVENT_IR 2	  // RAK12040 max pixel in 0.1 degrees C
+#define EVENT_NUM 3
+// Alarm states
+#define EVENT_NORMAL 0
+#define EVENT_HIGH 1
+#define EVENT_LOW 2
+// Window limits if no alarm is set
+#define EVENT_NO_LOW -1.0e9f
+#define EVENT_NO_HIGH 1.0e9f
+uint8_t event_pin(uint8_t sensor);
+bool event_pin_free(uint8_t sensor, uint8_t io);
+void event_window(uint8_t sensor, float value, float *low, float *high);
+bool event_trigger(uint8_t sensor);
+void event_setup(uint8_t sensor);
+void event_add_payload(void);
+extern bool g_event_triggered;
+
+/** Report-on-change rule of a LPP channel */
+struct report_rule_s
+{
+	uint8_t channel;	   // LPP channel, 0 = unused
+	uint8_t relative;	   // 1 = deadband in 0.1 % of the last reported value
+	uint16_t min_interval; // Changes are not reported faster, in seconds
+	uint32_t max_interval; // Report at least every max_interval seconds, 0 = off
+	uint32_t deadband;	   // Min change to report, in 0.01 of the channel unit
+	int32_t low;		   // Low alarm in 0.01 of the channel unit
+	int32_t high;		   // High alarm in 0.01 of the channel unit, low == high = no alarms
+	uint32_t hyst;		   // Alarm hysteresis in 0.01 of the channel unit
+};
+/** Max number of rules */
+#define REPORT_MAX_RULES 8
+void report_check(void);
+void report_sent(void);
+bool report_set_rule(report_rule_s *rule);
+report_rule_s *report_get_rule(uint8_t idx);
+bool report_load(void);
+
+/** Tank model for the water level sensors */
+struct tank_settings_s
+{
+	uint16_t depth;		 // mm, distance from the sensor to the tank bottom
+	uint8_t shape;		 // TANK_RECTANGULAR, TANK_VERT_CYLINDER or TANK_HORIZ_CYLINDER
+	uint16_t dim1;		 // mm, width, diameter or length (see README)
+	uint16_t dim2;		 // mm, length of rectangular tanks
+	uint8_t low_pct;	 // Low level alarm in %
+	uint8_t high_pct;	 // High level alarm in %
+	uint16_t rate_limit; // Fill/drain rate alarm in l/h, 0 = off
+};
+extern tank_settings_s g_tank;
+extern bool g_uplink_suppress;
+extern bool g_uplink_force;
+
+// Tank shapes
+#define TANK_RECTANGULAR 0
+#define TANK_VERT_CYLINDER 1
+#define TANK_HORIZ_CYLINDER 2
+
+// Tank alarm bits
+#define TANK_ALARM_LOW 0x01
+#define TANK_ALARM_HIGH 0x02
+#define TANK_ALARM_DRAIN 0x04
+#define TANK_ALARM_FILL 0x08
+
+/** Record of a recorded GNSS trace for the GNSS simulator */
+struct gnss_sim_record_s
+{
+	uint32_t time_ms;	  // Time since start of the trace
+	const char *sentence; // NMEA sentence without line end
+};
+bool init_gnss_sim(void);
+bool poll_gnss_sim(gnss_fix_s *fix);
 // GNSS precision and data format definitions
 /** GNSS 4 digit precision and standard Cayenne LPP format */
 #define LPP_4_DIGIT 0
@@ -217,9 +508,40 @@ extern date_time_s g_date_time;
 /** Field Tester format */
 #define FIELD_TESTER 3
 
+// GNSS module types
+#define NO_GNSS_INIT 0
+#define RAK1910_GNSS 1
+#define RAK12500_GNSS 2
+#define SIM_GNSS 3
+extern uint8_t g_gnss_option;
+
 /** GNSS settings offset in flash */
 #define GNSS_OFFSET 0x00000000		// length 1 byte
 #define SEND_INTERVAL_OFFSET 0x00000002 // length 4 bytes
+#define GNSS_PWR_OFFSET 0x00000008		// length 2 bytes (value + marker)
+#define ACC_STREAM_OFFSET 0x0000000A	// length 2 bytes (value + marker)
+#define FUSION_OFFSET 0x0000000C		// length 2 bytes (value + marker)
+#define GNSS_CACHE_OFFSET 0x00000010	// length 24 bytes
+#define MAG_CAL_OFFSET 0x00000030		// length 76 bytes
+#define TANK_OFFSET 0x00000080			// length 8 bytes (7 bytes + marker)
+#define TANK_ALARM_OFFSET 0x0000008A	// length 5 bytes (4 bytes + marker)
+#define THERMAL_IMG_OFFSET 0x00000090	// length 2 bytes (value + marker)
+#define PRESS_MODE_OFFSET 0x00000092	// length 2 bytes (value + marker)
+#define BME_GAS_OFFSET 0x00000094		// length 6 bytes (5 bytes + marker)
+#define EVENT_OFFSET 0x000000A0			// length 3 x 12 bytes
+#define REPORT_RULES_OFFSET 0x000000C8	// length 196 bytes
+#define RTC_ALIGN_OFFSET 0x00000190		// length 2 bytes (value + marker)
+#define RTC_WAKE_OFFSET 0x00000192		// length 2 bytes (value + marker)
+#define VIB_BAND_OFFSET 0x00000194		// length 11 bytes (10 bytes + marker)
+#define TOF_BUDGET_OFFSET 0x000001A0	// length 3 bytes (2 bytes + marker)
+
+// GNSS power modes between two location acquisitions
+/** Cut the power of the module (cold/warm start every cycle) */
+#define GNSS_PWR_OFF 0
+/** Put the module into backup mode, RTC and ephemeris are kept (hot start) */
+#define GNSS_PWR_BACKUP 1
+/** Keep the module running in u-blox power save mode */
+#define GNSS_PWR_SAVE 2
 
 // RAK12007
 #define TRIG WB_IO6
@@ -227,6 +549,7 @@ extern date_time_s g_date_time;
 #define PD WB_IO5 // power done control （=1 power done，=0 power on）
 
 bool init_rak12007(void);
+extern bool has_rak12007;
 bool read_rak12007(bool add_payload = true);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+/**
+ * @file orientation.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Orientation fusion (Madgwick filter) for the RAK1905 9DOF sensor
+ * @version 0.1
+ * @date 2022-06-22
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Filter gain, higher values trust the accelerometer and magnetometer more */
+#define FUSION_BETA 0.1f
+
+/** Orientation quaternion */
+float q0 = 1.0f;
+float q1 = 0.0f;
+float q2 = 0.0f;
+float q3 = 0.0f;
+
+/** Time between two samples in seconds */
+float fusion_dt = 0.01f;
+
+/** Number of filter updates */
+uint32_t fusion_updates = 0;
+/** Sum of the filter update times in us */
+uint32_t fusion_time_sum = 0;
+
+/**
+ * @brief Inverse square root, uses the FPU on the M4
+ *
+ * @param x input
+ * @return float 1 / sqrt(x)
+ */
+static float inv_sqrt(float x)
+{
+	return 1.0f / sqrtf(x);
+}
+
+/**
+ * @brief Reset the filter
+ *
+ * @param sample_rate sample rate of the sensor in Hz
+ */
+void fusion_init(uint16_t sample_rate)
+{
+	q0 = 1.0f;
+	q1 = q2 = q3 = 0.0f;
+	fusion_dt = 1.0f / sample_rate;
+	fusion_updates = 0;
+	fusion_time_sum = 0;
+}
+
+/**
+ * @brief Madgwick filter update with gyroscope, accelerometer and magnetometer
+ *
+ * @param gx gyroscope x in rad/s
+ * @param gy gyroscope y in rad/s
+ * @param gz gyroscope z in rad/s
+ * @param ax accelerometer x, any unit
+ * @param ay accelerometer y, any unit
+ * @param az accelerometer z, any unit
+ * @param mx magnetometer x, any unit, aligned to the accelerometer axes
+ * @param my magnetometer y, any unit, aligned to the accelerometer axes
+ * @param mz magnetometer z, any unit, aligned to the accelerometer axes
+ */
+void fusion_update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz)
+{
+	time_t start = micros();
+
+	// Rate of change of quaternion from gyroscope
+	float qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	float qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	float qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	float qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+	if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
+	{
+		float recip_norm = inv_sqrt(ax * ax + ay * ay + az * az);
+		ax *= recip_norm;
+		ay *= recip_norm;
+		az *= recip_norm;
+
+		bool use_mag = !((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f));
+		float s0, s1, s2, s3;
+		if (use_mag)
+		{
+			recip_norm = inv_sqrt(mx * mx + my * my + mz * mz);
+			mx *= recip_norm;
+			my *= recip_norm;
+			mz *= recip_norm;
+
+			// Auxiliary variables to avoid repeated arithmetic
+			float _2q0mx = 2.0f * q0 * mx;
+			float _2q0my = 2.0f * q0 * my;
+			float _2q0mz = 2.0f * q0 * mz;
+			float _2q1mx = 2.0f * q1 * mx;
+			float _2q0 = 2.0f * q0;
+			float _2q1 = 2.0f * q1;
+			float _2q2 = 2.0f * q2;
+			float _2q3 = 2.0f * q3;
+			float _2q0q2 = 2.0f * q0 * q2;
+			float _2q2q3 = 2.0f * q2 * q3;
+			float q0q0 = q0 * q0;
+			float q0q1 = q0 * q1;
+			float q0q2 = q0 * q2;
+			float q0q3 = q0 * q3;
+			float q1q1 = q1 * q1;
+			float q1q2 = q1 * q2;
+			float q1q3 = q1 * q3;
+			float q2q2 = q2 * q2;
+			float q2q3 = q2 * q3;
+			float q3q3 = q3 * q3;
+
+			// Reference direction of Earth's magnetic field
+			float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+			float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+			float _2bx = sqrtf(hx * hx + hy * hy);
+			float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+			float _4bx = 2.0f * _2bx;
+			float _4bz = 2.0f * _2bz;
+
+			// Gradient decent step
+			s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+			s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+			s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+			s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+		}
+		else
+		{
+			// No magnetometer data, IMU only, heading is drifting
+			float _2q0 = 2.0f * q0;
+			float _2q1 = 2.0f * q1;
+			float _2q2 = 2.0f * q2;
+			float _2q3 = 2.0f * q3;
+			float _4q0 = 4.0f * q0;
+			float _4q1 = 4.0f * q1;
+			float _4q2 = 4.0f * q2;
+			float _8q1 = 8.0f * q1;
+			float _8q2 = 8.0f * q2;
+			float q0q0 = q0 * q0;
+			float q1q1 = q1 * q1;
+			float q2q2 = q2 * q2;
+			float q3q3 = q3 * q3;
+
+			s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+			s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+			s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+			s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+		}
+
+		recip_norm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+		if (recip_norm > 0.0f)
+		{
+			recip_norm = inv_sqrt(recip_norm);
+			qDot1 -= FUSION_BETA * s0 * recip_norm;
+			qDot2 -= FUSION_BETA * s1 * recip_norm;
+			qDot3 -= FUSION_BETA * s2 * recip_norm;
+			qDot4 -= FUSION_BETA * s3 * recip_norm;
+		}
+	}
+
+	// Integrate rate of change of quaternion
+	q0 += qDot1 * fusion_dt;
+	q1 += qDot2 * fusion_dt;
+	q2 += qDot3 * fusion_dt;
+	q3 += qDot4 * fusion_dt;
+
+	float recip_norm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recip_norm;
+	q1 *= recip_norm;
+	q2 *= recip_norm;
+	q3 *= recip_norm;
+
+	fusion_time_sum += micros() - start;
+	fusion_updates++;
+}
+
+/**
+ * @brief Get the orientation as Euler angles
+ *
+ * @param roll roll in degrees -180 to 180
+ * @param pitch pitch in degrees -90 to 90
+ * @param heading heading in degrees 0 to 360
+ * @param tilt angle between the Z axis and vertical in degrees
+ */
+void fusion_get_euler(float *roll, float *pitch, float *heading, float *tilt)
+{
+	*roll = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2) * RAD_TO_DEG;
+	float sin_pitch = -2.0f * (q1 * q3 - q0 * q2);
+	sin_pitch = sin_pitch > 1.0f ? 1.0f : (sin_pitch < -1.0f ? -1.0f : sin_pitch);
+	*pitch = asinf(sin_pitch) * RAD_TO_DEG;
+	*heading = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3) * RAD_TO_DEG;
+	if (*heading < 0.0f)
+	{
+		*heading += 360.0f;
+	}
+	// Z axis of the sensor in the earth frame
+	float cos_tilt = 1.0f - 2.0f * (q1 * q1 + q2 * q2);
+	cos_tilt = cos_tilt > 1.0f ? 1.0f : (cos_tilt < -1.0f ? -1.0f : cos_tilt);
+	*tilt = acosf(cos_tilt) * RAD_TO_DEG;
+}
+
+/**
+ * @brief Add the orientation to the payload
+ *
+ */
+void fusion_add_payload(void)
+{
+	if (fusion_updates == 0)
+	{
+		MYLOG("FUSE", "No samples fused");
+		return;
+	}
+
+	float roll, pitch, heading, tilt;
+	fusion_get_euler(&roll, &pitch, &heading, &tilt);
+
+	g_solution_data.addAnalogInput(LPP_CHANNEL_ROLL, roll);
+	g_solution_data.addAnalogInput(LPP_CHANNEL_PITCH, pitch);
+	g_solution_data.addDirection(LPP_CHANNEL_HEADING, heading);
+	g_solution_data.addAnalogInput(LPP_CHANNEL_TILT, tilt);
+
+	uint32_t update_time = fusion_time_sum / fusion_updates;
+	MYLOG("FUSE", "Roll %.1f Pitch %.1f Heading %.1f Tilt %.1f", roll, pitch, heading, tilt);
+	MYLOG("FUSE", "%ld updates, %ld us per update, max rate %ld Hz", fusion_updates, update_time,
+		  update_time == 0 ? 0 : 1000000 / update_time);
+	fusion_updates = 0;
+	fusion_time_sum = 0;
+}
@@ -12,10 +12,49 @@
 
 #define TIME_OUT 24125 // max measure distance is 4m,the velocity of sound is 331.6m/s in 0℃,TIME_OUT=4*2/331.6*1000000=24215us
 
+/** Max number of pings per measurement */
+#define US_MAX_PINGS 10
+/** Min number of valid echos before the estimate is checked */
+#define US_MIN_PINGS 5
+/** Time between two pings in ms, echo timeout of the sensor is 33 ms */
+#define US_PING_INTERVAL 40
+/** Echos more than US_GATE_MAD * MAD away from the median are outliers */
+#define US_GATE_MAD 4
+/** Min outlier gate in us (~5 mm) */
+#define US_GATE_MIN 30
+/** Stop when the echo times are within this MAD in us */
+#define US_CONVERGED_US 15
+
 float ratio = 346.6 / 1000 / 2; // velocity of sound =331.6+0.6*25℃(m/s),(Indoor temperature about 25℃)
 
 bool has_rak12007 = false;
 
+/** Time stamp of the rising edge of the echo */
+volatile uint32_t us_echo_rise = 0;
+/** Length of the echo pulse in us */
+volatile uint32_t us_echo_time = 0;
+/** Flag if a complete echo pulse was captured */
+volatile bool us_echo_done = false;
+
+/**
+ * @brief Interrupt callback for the ECHO pin
+ *        Time stamps both edges of the echo pulse
+ *
+ */
+void us_echo_callback(void)
+{
+	uint32_t now = micros();
+	if (digitalRead(ECHO) == HIGH)
+	{
+		us_echo_rise = now;
+	}
+	else if ((us_echo_rise != 0) && !us_echo_done)
+	{
+		us_echo_time = now - us_echo_rise;
+		us_echo_done = true;
+	}
+}
+
 bool init_rak12007(void)
 {
 	// Initialize GPIO
@@ -35,60 +74,143 @@ bool init_rak12007(void)
 	return has_rak12007;
 }
 
+/**
+ * @brief Send one ping and sleep until the echo is over
+ *        The echo edges are captured by the interrupt
+ *
+ * @return uint32_t echo time in us, 0 if no valid echo
+ */
+static uint32_t us_ping(void)
+{
+	us_echo_rise = 0;
+	us_echo_done = false;
+
+	time_t ping_start = millis();
+	digitalWrite(TRIG, HIGH);
+	delayMicroseconds(20); // pull high time need over 10us
+	digitalWrite(TRIG, LOW);
+
+	// CPU sleeps while the echo is captured by the interrupt, every interrupt (e.g. the rising edge) ends the sleep early
+	while (!us_echo_done && ((millis() - ping_start) < US_PING_INTERVAL))
+	{
+		api.system.sleep.cpu(US_PING_INTERVAL - (millis() - ping_start));
+	}
+
+	if (!us_echo_done || (us_echo_time == 0) || (us_echo_time >= TIME_OUT)) // ECHO pin max timeout is 33000us according it's datasheet
+	{
+		return 0;
+	}
+	return us_echo_time;
+}
+
 bool read_rak12007(bool add_payload)
 {
-	uint32_t respond_time;
-	uint64_t measure_time = 0;
 	uint32_t distance = 0;
-	uint16_t valid_measures = 0;
+	uint16_t samples[US_MAX_PINGS];
+	uint8_t num_samples = 0;
+	uint8_t num_rejected = 0;
+	uint8_t num_pings = 0;
+	uint16_t median = 0;
+	uint16_t mad = 0;
 
 	digitalWrite(PD, LOW); // Power up the sensor
 	digitalWrite(TRIG, LOW);
-	delay(500);
+	api.system.sleep.cpu(500);
+
+	attachInterrupt(ECHO, us_echo_callback, CHANGE);
 
-	// Do 10 measurements to get an average
-	for (int reading = 0; reading < 10; reading++)
+	time_t start = millis();
+	for (num_pings = 0; num_pings < US_MAX_PINGS; num_pings++)
 	{
-		digitalWrite(TRIG, HIGH);
-		delayMicroseconds(20); // pull high time need over 10us
-		digitalWrite(TRIG, LOW);
-		respond_time = pulseInLong(ECHO, HIGH, 2000000L); // microseconds
-		delay(33);
-		if ((respond_time > 0) && (respond_time < TIME_OUT)) // ECHO pin max timeout is 33000us according it's datasheet
+		uint32_t respond_time = us_ping();
+		if (respond_time == 0)
 		{
-#ifdef _VARIANT_RAK4630_
-			measure_time += respond_time * 0.7726; // Time calibration factor is 0.7726,to get real time microseconds for 4631 board
-#else
-			measure_time += respond_time; // No time calibration
-#endif
-			valid_measures++;
+			MYLOG("US", "Timeout");
+			continue;
 		}
-		else
+
+		// Outlier gating against the running median
+		if (num_samples >= US_MIN_PINGS)
 		{
-			MYLOG("US", "Timeout");
+			uint16_t gate = mad * US_GATE_MAD < US_GATE_MIN ? US_GATE_MIN : mad * US_GATE_MAD;
+			uint16_t deviation = respond_time > median ? respond_time - median : median - respond_time;
+			if (deviation > gate)
+			{
+				num_rejected++;
+				continue;
+			}
 		}
-		MYLOG("US", "Respond time is %d valid measures %d", respond_time, valid_measures);
-		delay(500);
-	}
-	measure_time = measure_time / valid_measures;
 
-	if ((measure_time > 0) && (measure_time < TIME_OUT)) // ECHO pin max timeout is 33000us according it's datasheet
-	{
-		// Calculate measured distance
-		distance = measure_time * ratio; // Test distance = (high level time × velocity of sound (340M/S) / 2
+		// Insert sorted
+		uint8_t idx = num_samples;
+		while ((idx > 0) && (samples[idx - 1] > respond_time))
+		{
+			samples[idx] = samples[idx - 1];
+			idx--;
+		}
+		samples[idx] = respond_time;
+		num_samples++;
 
-		MYLOG("US", "Distance is %ld mm", distance);
+		// Median and median absolute deviation
+		median = samples[num_samples / 2];
+		uint16_t deviations[US_MAX_PINGS];
+		for (idx = 0; idx < num_samples; idx++)
+		{
+			uint16_t deviation = samples[idx] > median ? samples[idx] - median : median - samples[idx];
+			uint8_t pos = idx;
+			while ((pos > 0) && (deviations[pos - 1] > deviation))
+			{
+				deviations[pos] = deviations[pos - 1];
+				pos--;
+			}
+			deviations[pos] = deviation;
+		}
+		mad = deviations[num_samples / 2];
 
-		if (add_payload)
+		if ((num_samples >= US_MIN_PINGS) && (mad <= US_CONVERGED_US))
 		{
-			// Add level to the payload (in cm !)
-			g_solution_data.addAnalogInput(LPP_CHANNEL_WLEVEL, (float)(distance / 1.0));
+			break;
 		}
-		digitalWrite(PD, HIGH); // Power down the sensor
-		digitalWrite(TRIG, HIGH);
-		return true;
 	}
+
+	detachInterrupt(ECHO);
 	digitalWrite(PD, HIGH); // Power down the sensor
 	digitalWrite(TRIG, HIGH);
-	return false;
+
+	MYLOG("US", "%d pings, %d used, %d rejected, MAD %d us, %ld ms", num_pings, num_samples, num_rejected, mad, millis() - start);
+
+	if (num_samples == 0)
+	{
+		return false;
+	}
+
+	// Mean of the inner half of the sorted echo times
+	uint8_t first = num_samples / 4;
+	uint8_t last = num_samples - num_samples / 4;
+	uint32_t measure_time = 0;
+	for (uint8_t idx = first; idx < last; idx++)
+	{
+		measure_time += samples[idx];
+	}
+	measure_time = measure_time / (last - first);
+
+	// Velocity of sound from the ambient temperature of another sensor, if available
+	float ambient = 25.0;
+	float echo_ratio = ratio;
+	if (sensor_cache_get(CACHE_TEMP, &ambient))
+	{
+		echo_ratio = (331.3 + 0.606 * ambient) / 1000 / 2;
+	}
+
+	// Calculate measured distance
+	distance = measure_time * echo_ratio; // Test distance = (high level time × velocity of sound (340M/S) / 2
+
+	MYLOG("US", "Echo %ld us, %.1f℃, distance is %ld mm", measure_time, ambient, distance);
+
+	if (add_payload)
+	{
+		// Add level to the payload (in cm !)
+		g_solution_data.addAnalogInput(LPP_CHANNEL_WLEVEL, (float)(distance / 1.0));
+	}
+	return true;
 }
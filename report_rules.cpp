@@ -0,0 +1,383 @@
+/**
+ * @file report_rules.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Report-on-change rules per LPP channel
+ *        Deadband, min/max report interval and alarm levels with hysteresis decide if an uplink is needed
+ * @version 0.1
+ * @date 2022-07-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Marker of valid rules in flash */
+#define REPORT_MARK 0x55AB
+
+/** Rules record in flash */
+struct report_flash_s
+{
+	uint16_t mark;
+	uint16_t reserved;
+	report_rule_s rules[REPORT_MAX_RULES];
+};
+
+/** Current rules */
+report_flash_s report_flash;
+
+/** Runtime status of a rule */
+struct report_status_s
+{
+	float last_value;  // Last reported value
+	time_t last_time;  // millis() of the last report, 0 = never reported
+	uint8_t state;	   // EVENT_NORMAL, EVENT_HIGH or EVENT_LOW
+};
+report_status_s report_status[REPORT_MAX_RULES];
+/** Flag that report_check() decided to send, report_sent() stores the values after the enqueue */
+bool report_pending = false;
+
+/**
+ * @brief Decode the first value of a Cayenne LPP data field
+ *
+ * @param type LPP data type
+ * @param data pointer to the data field
+ * @param value pointer for the value in the unit of the data type
+ * @return uint8_t size of the data field, 0 if the type is unknown
+ */
+static uint8_t report_decode(uint8_t type, uint8_t *data, float *value)
+{
+	uint8_t size = 0;
+	float divider = 1.0;
+	bool is_signed = false;
+	bool has_value = true;
+	switch (type)
+	{
+	case LPP_DIGITAL_INPUT:
+	case LPP_PRESENCE:
+	case LPP_PERCENTAGE:
+		size = 1;
+		break;
+	case LPP_RELATIVE_HUMIDITY:
+		size = 1;
+		divider = 2.0;
+		break;
+	case LPP_ANALOG_INPUT:
+		size = 2;
+		divider = 100.0;
+		is_signed = true;
+		break;
+	case LPP_TEMPERATURE:
+		size = 2;
+		divider = 10.0;
+		is_signed = true;
+		break;
+	case LPP_BAROMETRIC_PRESSURE:
+		size = 2;
+		divider = 10.0;
+		break;
+	case LPP_VOLTAGE:
+		size = 2;
+		divider = 100.0;
+		break;
+	case LPP_LUMINOSITY:
+	case LPP_CONCENTRATION:
+	case LPP_DIRECTION:
+	case LPP_VOC:
+	case LPP_VIBRATION:
+		size = 2;
+		break;
+	case LPP_GENERIC_SENSOR:
+		size = 4;
+		break;
+	case LPP_UNIXTIME:
+		// Changes every reading, never a trigger
+		size = 4;
+		has_value = false;
+		break;
+	case LPP_GPS4:
+		size = LPP_GPS4_SIZE;
+		has_value = false;
+		break;
+	case LPP_GPS6:
+		size = LPP_GPS6_SIZE;
+		has_value = false;
+		break;
+	default:
+		return 0;
+	}
+	if (!has_value)
+	{
+		return size;
+	}
+	uint32_t raw = 0;
+	for (uint8_t idx = 0; idx < size; idx++)
+	{
+		raw = (raw << 8) | data[idx];
+	}
+	if (is_signed && (size == 2))
+	{
+		*value = (int16_t)raw / divider;
+	}
+	else
+	{
+		*value = raw / divider;
+	}
+	return size;
+}
+
+/**
+ * @brief Find the rule of a channel
+ *
+ * @param channel LPP channel
+ * @return int8_t index of the rule, -1 if no rule
+ */
+static int8_t report_find(uint8_t channel)
+{
+	for (uint8_t idx = 0; idx < REPORT_MAX_RULES; idx++)
+	{
+		if ((report_flash.rules[idx].channel != 0) && (report_flash.rules[idx].channel == channel))
+		{
+			return idx;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Check a value against its rule
+ *
+ * @param idx index of the rule
+ * @param value current value
+ * @return true if the value has to be reported
+ * @return false if the value did not change enough
+ */
+static bool report_rule_check(uint8_t idx, float value)
+{
+	report_rule_s *rule = &report_flash.rules[idx];
+	report_status_s *status = &report_status[idx];
+	time_t now = millis();
+
+	// Alarm levels with hysteresis, a state change is always reported
+	if (rule->low != rule->high)
+	{
+		float low = rule->low / 100.0;
+		float high = rule->high / 100.0;
+		float hyst = rule->hyst / 100.0;
+		uint8_t new_state = status->state;
+		if ((new_state == EVENT_HIGH) && (value < high - hyst))
+		{
+			new_state = EVENT_NORMAL;
+		}
+		if ((new_state == EVENT_LOW) && (value > low + hyst))
+		{
+			new_state = EVENT_NORMAL;
+		}
+		if (new_state == EVENT_NORMAL)
+		{
+			new_state = value > high ? EVENT_HIGH : (value < low ? EVENT_LOW : EVENT_NORMAL);
+		}
+		if (new_state != status->state)
+		{
+			MYLOG("REPORT", "Ch %d alarm state %d -> %d", rule->channel, status->state, new_state);
+			status->state = new_state;
+			return true;
+		}
+	}
+
+	if (status->last_time == 0)
+	{
+		return true;
+	}
+
+	uint32_t elapsed = (now - status->last_time) / 1000;
+	if ((rule->max_interval != 0) && (elapsed >= rule->max_interval))
+	{
+		MYLOG("REPORT", "Ch %d max interval", rule->channel);
+		return true;
+	}
+	if (elapsed < rule->min_interval)
+	{
+		return false;
+	}
+
+	float deadband = rule->relative ? fabsf(status->last_value) * rule->deadband / 1000.0 : rule->deadband / 100.0;
+	if (fabsf(value - status->last_value) > deadband)
+	{
+		MYLOG("REPORT", "Ch %d changed %.2f -> %.2f", rule->channel, status->last_value, value);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Decide if the payload in g_solution_data needs an uplink
+ *        Channels without a rule do not trigger an uplink but are sent with it.
+ *        Without rules every cycle is sent.
+ *        Sets g_uplink_suppress if no rule triggers, never clears it to keep the skip requests of the sensors.
+ *        Not checked for uplinks started by motion, events or alarms.
+ *
+ */
+void report_check(void)
+{
+	report_pending = false;
+	if (g_uplink_force || g_event_triggered)
+	{
+		return;
+	}
+
+	bool has_rules = false;
+	for (uint8_t idx = 0; idx < REPORT_MAX_RULES; idx++)
+	{
+		has_rules |= report_flash.rules[idx].channel != 0;
+	}
+	if (!has_rules)
+	{
+		return;
+	}
+
+	uint8_t *buffer = g_solution_data.getBuffer();
+	uint8_t size = g_solution_data.getSize();
+	bool send = false;
+	uint8_t pos = 0;
+	while (pos + 2 <= size)
+	{
+		uint8_t channel = buffer[pos];
+		float value = 0.0;
+		uint8_t data_size = report_decode(buffer[pos + 1], &buffer[pos + 2], &value);
+		if ((data_size == 0) || (pos + 2 + data_size > size))
+		{
+			// Unknown format, send to be safe
+			MYLOG("REPORT", "Unknown LPP type %d", buffer[pos + 1]);
+			send = true;
+			break;
+		}
+		int8_t idx = report_find(channel);
+		if (idx >= 0)
+		{
+			send |= report_rule_check(idx, value);
+		}
+		pos += 2 + data_size;
+	}
+
+	if (!send)
+	{
+		MYLOG("REPORT", "No rule triggered");
+		g_uplink_suppress = true;
+		return;
+	}
+	report_pending = true;
+}
+
+/**
+ * @brief Store the values of the payload as reported after the uplink was enqueued
+ *        A failed uplink keeps the old values, the next cycle triggers again
+ *
+ */
+void report_sent(void)
+{
+	if (!report_pending)
+	{
+		return;
+	}
+	report_pending = false;
+
+	uint8_t *buffer = g_solution_data.getBuffer();
+	uint8_t size = g_solution_data.getSize();
+	uint8_t pos = 0;
+	while (pos + 2 <= size)
+	{
+		float value = 0.0;
+		uint8_t data_size = report_decode(buffer[pos + 1], &buffer[pos + 2], &value);
+		if (data_size == 0)
+		{
+			break;
+		}
+		int8_t idx = report_find(buffer[pos]);
+		if (idx >= 0)
+		{
+			report_status[idx].last_value = value;
+			report_status[idx].last_time = millis();
+		}
+		pos += 2 + data_size;
+	}
+}
+
+/**
+ * @brief Set, change or remove the rule of a channel
+ *
+ * @param rule new rule, all values 0 except the channel removes the rule
+ * @return true if the rule was stored
+ * @return false if no free rule or flash write failed
+ */
+bool report_set_rule(report_rule_s *rule)
+{
+	int8_t idx = report_find(rule->channel);
+	bool remove = (rule->deadband == 0) && (rule->min_interval == 0) && (rule->max_interval == 0) && (rule->low == rule->high);
+	if (idx < 0)
+	{
+		if (remove)
+		{
+			return true;
+		}
+		// Find a free rule
+		for (uint8_t free_idx = 0; free_idx < REPORT_MAX_RULES; free_idx++)
+		{
+			if (report_flash.rules[free_idx].channel == 0)
+			{
+				idx = free_idx;
+				break;
+			}
+		}
+		if (idx < 0)
+		{
+			MYLOG("REPORT", "No free rule");
+			return false;
+		}
+	}
+	if (remove)
+	{
+		memset(&report_flash.rules[idx], 0, sizeof(report_rule_s));
+	}
+	else
+	{
+		report_flash.rules[idx] = *rule;
+	}
+	memset(&report_status[idx], 0, sizeof(report_status_s));
+
+	report_flash.mark = REPORT_MARK;
+	report_flash.reserved = 0;
+	if (!api.system.flash.set(REPORT_RULES_OFFSET, (uint8_t *)&report_flash, sizeof(report_flash_s)))
+	{
+		MYLOG("REPORT", "Failed to save rules");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Get a rule
+ *
+ * @param idx index of the rule, 0 to REPORT_MAX_RULES - 1
+ * @return report_rule_s* rule, channel 0 = unused
+ */
+report_rule_s *report_get_rule(uint8_t idx)
+{
+	return &report_flash.rules[idx];
+}
+
+/**
+ * @brief Load the rules from flash
+ *
+ * @return true if rules were found
+ * @return false if no rules are stored
+ */
+bool report_load(void)
+{
+	memset(report_status, 0, sizeof(report_status));
+	if (!api.system.flash.get(REPORT_RULES_OFFSET, (uint8_t *)&report_flash, sizeof(report_flash_s)) || (report_flash.mark != REPORT_MARK))
+	{
+		memset(&report_flash, 0, sizeof(report_flash_s));
+		return false;
+	}
+	return true;
+}
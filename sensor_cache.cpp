@@ -0,0 +1,78 @@
+/**
+ * @file sensor_cache.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Latest sensor values, shared between the sensors for compensation
+ *        Sensors publish when they are read, consumers never start a reading
+ * @version 0.1
+ * @date 2022-07-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Latest value of each physical quantity */
+cache_value_s sensor_cache[CACHE_NUM];
+
+/**
+ * @brief Max age of cached values
+ *        The sensors are read once per send interval, a value must stay valid
+ *        until the next reading, even with send intervals above 30 minutes
+ *
+ * @return uint32_t send interval plus CACHE_AGE_MARGIN, at least CACHE_MAX_AGE_MIN in ms
+ */
+uint32_t sensor_cache_max_age(void)
+{
+	uint32_t max_age = g_send_interval_time + CACHE_AGE_MARGIN;
+	return max_age < CACHE_MAX_AGE_MIN ? CACHE_MAX_AGE_MIN : max_age;
+}
+
+/**
+ * @brief Publish a sensor value
+ *        A fresh value of a more accurate sensor is not overwritten
+ *
+ * @param quantity physical quantity (CACHE_TEMP, CACHE_HUMID, ...)
+ * @param value sensor value in the unit of the quantity
+ * @param source sensor ID of the publishing sensor
+ * @param quality accuracy of the sensor, higher is better
+ */
+void sensor_cache_set(uint8_t quantity, float value, uint8_t source, uint8_t quality)
+{
+	if (quantity >= CACHE_NUM)
+	{
+		return;
+	}
+	cache_value_s *entry = &sensor_cache[quantity];
+	if ((entry->time != 0) && ((millis() - entry->time) < sensor_cache_max_age()) && (quality < entry->quality))
+	{
+		return;
+	}
+	entry->value = value;
+	entry->time = millis();
+	entry->source = source;
+	entry->quality = quality;
+}
+
+/**
+ * @brief Get the latest value of a physical quantity
+ *
+ * @param quantity physical quantity (CACHE_TEMP, CACHE_HUMID, ...)
+ * @param value pointer for the value
+ * @param max_age max age of the value in ms
+ * @return true if a value not older than max_age is available
+ * @return false if no recent value is available
+ */
+bool sensor_cache_get(uint8_t quantity, float *value, uint32_t max_age)
+{
+	if (quantity >= CACHE_NUM)
+	{
+		return false;
+	}
+	cache_value_s *entry = &sensor_cache[quantity];
+	if ((entry->time == 0) || ((millis() - entry->time) > max_age))
+	{
+		return false;
+	}
+	*value = entry->value;
+	return true;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file tank_level.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tank model for the water level sensors
+ *        Volume, fill rate, alarms and uplink suppression for stable levels
+ * @version 0.1
+ * @date 2022-06-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Number of readings used for the fill rate */
+#define TANK_TREND_SIZE 8
+/** Max number of skipped uplinks while the level is stable */
+#define TANK_MAX_SKIP 12
+/** Level change that counts as stable, in 0.1 % of the tank volume */
+#define TANK_STABLE_DELTA 10
+/** Time between two level checks for the alarms in ms */
+#define TANK_CHECK_INTERVAL 60000
+
+/** Tank settings */
+tank_settings_s g_tank = {1100, TANK_RECTANGULAR, 1000, 1000, 10, 90, 50};
+
+/** Flag to skip the next uplink */
+bool g_uplink_suppress = false;
+/** Flag to send the next uplink even if a sensor or rule wants to skip it (motion, events, alarms) */
+bool g_uplink_force = false;
+
+/** Readings for the fill rate, time in seconds and volume in liters */
+float tank_trend_time[TANK_TREND_SIZE];
+float tank_trend_volume[TANK_TREND_SIZE];
+uint8_t tank_trend_num = 0;
+uint8_t tank_trend_idx = 0;
+
+/** Volume and alarms of the last uplink */
+float tank_sent_volume = -1.0f;
+uint8_t tank_sent_alarms = 0;
+/** Number of uplinks skipped */
+uint8_t tank_skipped = 0;
+/** millis() of the last level reading */
+time_t tank_last_check = 0;
+
+/**
+ * @brief Calculate the volume for a water level
+ *
+ * @param level water level in mm from the bottom of the tank
+ * @return float volume in liters
+ */
+float tank_volume(uint16_t level)
+{
+	if (level > g_tank.depth)
+	{
+		level = g_tank.depth;
+	}
+	float h = level;
+	switch (g_tank.shape)
+	{
+	case TANK_VERT_CYLINDER:
+		// dim1 = diameter
+		return (PI / 4.0f * g_tank.dim1 * g_tank.dim1 * h) / 1000000.0f;
+	case TANK_HORIZ_CYLINDER:
+	{
+		// Diameter = depth, dim1 = length
+		float r = g_tank.depth / 2.0f;
+		if (h > 2.0f * r)
+		{
+			h = 2.0f * r;
+		}
+		float chord = 2.0f * r * h - h * h;
+		float area = r * r * acosf((r - h) / r) - (r - h) * sqrtf(chord < 0.0f ? 0.0f : chord);
+		return (area * g_tank.dim1) / 1000000.0f;
+	}
+	default:
+		// dim1 = width, dim2 = length
+		return ((float)g_tank.dim1 * g_tank.dim2 * h) / 1000000.0f;
+	}
+}
+
+/**
+ * @brief Fill rate from a least squares fit over the last readings
+ *
+ * @return float fill rate in liters per hour, negative when draining
+ */
+static float tank_rate(void)
+{
+	if (tank_trend_num < 2)
+	{
+		return 0.0f;
+	}
+	// Use time relative to the first point to keep the float precision
+	float t0 = tank_trend_time[(tank_trend_idx + TANK_TREND_SIZE - tank_trend_num) % TANK_TREND_SIZE];
+	float sum_t = 0.0f, sum_v = 0.0f, sum_tt = 0.0f, sum_tv = 0.0f;
+	for (uint8_t idx = 0; idx < tank_trend_num; idx++)
+	{
+		uint8_t pos = (tank_trend_idx + TANK_TREND_SIZE - tank_trend_num + idx) % TANK_TREND_SIZE;
+		float t = tank_trend_time[pos] - t0;
+		sum_t += t;
+		sum_v += tank_trend_volume[pos];
+		sum_tt += t * t;
+		sum_tv += t * tank_trend_volume[pos];
+	}
+	float denominator = tank_trend_num * sum_tt - sum_t * sum_t;
+	if (denominator <= 0.0f)
+	{
+		return 0.0f;
+	}
+	// liters per second to liters per hour
+	return (tank_trend_num * sum_tv - sum_t * sum_v) / denominator * 3600.0f;
+}
+
+/**
+ * @brief Calculate volume, fill level, fill rate and alarms from a new reading
+ *
+ * @param distance measured distance from the sensor to the water surface in mm
+ * @param volume pointer for the volume in liters
+ * @param fill pointer for the fill level in %
+ * @param rate pointer for the fill rate in liters per hour
+ * @return uint8_t alarm bits TANK_ALARM_xxx
+ */
+static uint8_t tank_update(uint16_t distance, float *volume, float *fill, float *rate)
+{
+	uint16_t level = distance < g_tank.depth ? g_tank.depth - distance : 0;
+	float capacity = tank_volume(g_tank.depth);
+	*volume = tank_volume(level);
+	*fill = capacity > 0.0f ? (*volume * 100.0f) / capacity : 0.0f;
+
+	tank_last_check = millis();
+	tank_trend_time[tank_trend_idx] = millis() / 1000.0f;
+	tank_trend_volume[tank_trend_idx] = *volume;
+	tank_trend_idx = (tank_trend_idx + 1) % TANK_TREND_SIZE;
+	if (tank_trend_num < TANK_TREND_SIZE)
+	{
+		tank_trend_num++;
+	}
+	*rate = tank_rate();
+
+	uint8_t alarms = 0;
+	if (*fill < g_tank.low_pct)
+	{
+		alarms |= TANK_ALARM_LOW;
+	}
+	if (*fill > g_tank.high_pct)
+	{
+		alarms |= TANK_ALARM_HIGH;
+	}
+	if ((g_tank.rate_limit != 0) && (*rate < -(float)g_tank.rate_limit))
+	{
+		alarms |= TANK_ALARM_DRAIN;
+	}
+	if ((g_tank.rate_limit != 0) && (*rate > (float)g_tank.rate_limit))
+	{
+		alarms |= TANK_ALARM_FILL;
+	}
+
+	MYLOG("TANK", "Level %d mm, %.1f l (%.1f %%), rate %.1f l/h, alarms %02X", level, *volume, *fill, *rate, alarms);
+	return alarms;
+}
+
+/**
+ * @brief Add the tank values to the payload and decide if the uplink is needed
+ *
+ * @param distance measured distance from the sensor to the water surface in mm
+ */
+void tank_add_payload(uint16_t distance)
+{
+	float volume, fill, rate;
+	uint8_t alarms = tank_update(distance, &volume, &fill, &rate);
+	float capacity = tank_volume(g_tank.depth);
+
+	// Fill rate in l/min, 0.01 l/min resolution covers +/- 19600 l/h
+	float rate_min = rate / 60.0f;
+	g_solution_data.addGenericSensor(LPP_CHANNEL_TANK_VOL, volume);
+	g_solution_data.addPercentage(LPP_CHANNEL_TANK_FILL, (uint32_t)(fill + 0.5f));
+	g_solution_data.addAnalogInput(LPP_CHANNEL_TANK_RATE, rate_min > 327.0f ? 327.0f : (rate_min < -327.0f ? -327.0f : rate_min));
+	g_solution_data.addDigitalInput(LPP_CHANNEL_TANK_ALARM, alarms);
+
+	// Send if alarms changed, a rate alarm is active, the level changed or after TANK_MAX_SKIP quiet cycles
+	bool level_changed = (tank_sent_volume < 0.0f) || (fabsf(volume - tank_sent_volume) * 1000.0f > capacity * TANK_STABLE_DELTA);
+	bool rate_alarm = (alarms & (TANK_ALARM_DRAIN | TANK_ALARM_FILL)) != 0;
+	if ((alarms != tank_sent_alarms) || rate_alarm)
+	{
+		// Alarms are always sent, independent of the report rules
+		g_uplink_force = true;
+	}
+	if (!level_changed && !rate_alarm && (alarms == tank_sent_alarms) && (tank_skipped < TANK_MAX_SKIP))
+	{
+		tank_skipped++;
+		g_uplink_suppress = true;
+		MYLOG("TANK", "Level stable, skip uplink %d", tank_skipped);
+		return;
+	}
+	tank_skipped = 0;
+	tank_sent_volume = volume;
+	tank_sent_alarms = alarms;
+}
+
+/**
+ * @brief Check the level between the uplinks, called from loop()
+ *        Starts an uplink as soon as an alarm changes,
+ *        the periodic timer restarts like for an event uplink
+ *
+ * @return uint32_t ms until the next check is due, 0 if no check is needed
+ */
+uint32_t tank_check(void)
+{
+	if ((g_send_interval_time != 0) && (g_send_interval_time <= TANK_CHECK_INTERVAL))
+	{
+		// Every uplink reads the level anyway
+		return 0;
+	}
+	time_t elapsed = millis() - tank_last_check;
+	if (elapsed < TANK_CHECK_INTERVAL)
+	{
+		return TANK_CHECK_INTERVAL - elapsed;
+	}
+	if (gnss_active || !api.lorawan.njs.get())
+	{
+		// Try again after the next interval
+		tank_last_check = millis();
+		return TANK_CHECK_INTERVAL;
+	}
+
+	uint16_t distance;
+	if (!rak12014_measure(&distance))
+	{
+		tank_last_check = millis();
+		return TANK_CHECK_INTERVAL;
+	}
+	float volume, fill, rate;
+	uint8_t alarms = tank_update(distance, &volume, &fill, &rate);
+	if (alarms != tank_sent_alarms)
+	{
+		MYLOG("TANK", "Alarms changed %02X -> %02X, send uplink", tank_sent_alarms, alarms);
+		// Reads the sensors again, the new alarm state forces the uplink
+		sensor_handler(NULL);
+	}
+	return TANK_CHECK_INTERVAL;
+}
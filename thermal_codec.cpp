@@ -0,0 +1,338 @@
+/**
+ * @file thermal_codec.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Compression and fragmented transfer of RAK12040 thermal frames
+ *        Quantized to 0.25 degrees C, delta and Rice coded
+ * @version 0.1
+ * @date 2022-07-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+/** Number of pixels of a frame */
+#define THERMAL_PIXELS 64
+/** Max payload bytes per fragment, the size is reduced to the max payload of the datarate */
+#define THERMAL_MAX_FRAG_SIZE 40
+/** Size of the fragment header */
+#define THERMAL_FRAG_HEADER 2
+/** Max number of fragments per frame */
+#define THERMAL_MAX_FRAGS 15
+/** Time between two fragments in ms */
+#define THERMAL_FRAG_INTERVAL 10000
+/** Time before a failed fragment is sent again in ms, e.g. radio busy or duty cycle limit */
+#define THERMAL_RETRY_INTERVAL 30000
+/** Send attempts per fragment before the frame is dropped */
+#define THERMAL_MAX_RETRIES 10
+/** Every n-th transferred frame is a key frame that does not need the previous frame */
+#define THERMAL_KEY_INTERVAL 4
+/** Quotients from this value on are sent as escape with the raw value */
+#define THERMAL_RICE_ESCAPE 15
+/** Max Rice parameter */
+#define THERMAL_MAX_K 12
+
+/** Send a frame every n-th reading, 0 = off */
+uint8_t g_thermal_img_interval = 0;
+
+/** Last transferred frame in 0.25 degrees C, reference for delta frames */
+int16_t thermal_last_frame[THERMAL_PIXELS];
+/** Number of transferred frames */
+uint8_t thermal_frame_num = 0;
+/** Number of readings since the last transfer */
+uint8_t thermal_readings = 0;
+/** Flag if the next frame must be a key frame, e.g. after a dropped frame */
+bool thermal_key_needed = false;
+
+/** Encoded frame */
+uint8_t thermal_buffer[THERMAL_MAX_FRAGS * THERMAL_MAX_FRAG_SIZE];
+/** Size of the encoded frame in bytes, 0 = nothing to send */
+uint16_t thermal_size = 0;
+/** Payload bytes per fragment of the current frame */
+uint8_t thermal_frag_size = 0;
+/** Number of fragments of the encoded frame, 0 = not yet fragmented */
+uint8_t thermal_num_frags = 0;
+/** Next fragment to send */
+uint8_t thermal_next_frag = 0;
+/** Failed send attempts of the next fragment */
+uint8_t thermal_retries = 0;
+/** millis() when the next fragment is due */
+time_t thermal_next_time = 0;
+
+/** Bit writer position in bits */
+uint16_t thermal_bit_pos = 0;
+
+/**
+ * @brief Append bits to the encoded frame, MSB first
+ *
+ * @param value bits to write
+ * @param num_bits number of bits
+ */
+static void thermal_put_bits(uint32_t value, uint8_t num_bits)
+{
+	while (num_bits != 0)
+	{
+		num_bits--;
+		if ((thermal_bit_pos >> 3) >= sizeof(thermal_buffer))
+		{
+			return;
+		}
+		if ((value >> num_bits) & 0x01)
+		{
+			thermal_buffer[thermal_bit_pos >> 3] |= 0x80 >> (thermal_bit_pos & 0x07);
+		}
+		thermal_bit_pos++;
+	}
+}
+
+/**
+ * @brief Number of bits of a zigzag value with Rice parameter k
+ *
+ * @param value zigzag value
+ * @param k Rice parameter
+ * @return uint16_t number of bits
+ */
+static uint16_t thermal_rice_bits(uint16_t value, uint8_t k)
+{
+	uint16_t quotient = value >> k;
+	if (quotient >= THERMAL_RICE_ESCAPE)
+	{
+		return THERMAL_RICE_ESCAPE + 16;
+	}
+	return quotient + 1 + k;
+}
+
+/**
+ * @brief Write a zigzag value with Rice parameter k
+ *        Quotient in unary with terminating 0, then k bits of remainder
+ *        Quotients >= THERMAL_RICE_ESCAPE are sent as THERMAL_RICE_ESCAPE ones and 16 raw bits
+ *
+ * @param value zigzag value
+ * @param k Rice parameter
+ */
+static void thermal_put_rice(uint16_t value, uint8_t k)
+{
+	uint16_t quotient = value >> k;
+	if (quotient >= THERMAL_RICE_ESCAPE)
+	{
+		thermal_put_bits((1UL << THERMAL_RICE_ESCAPE) - 1, THERMAL_RICE_ESCAPE);
+		thermal_put_bits(value, 16);
+		return;
+	}
+	thermal_put_bits(((1UL << quotient) - 1) << 1, quotient + 1);
+	thermal_put_bits(value & ((1UL << k) - 1), k);
+}
+
+/**
+ * @brief Check if a frame should be sent with this reading
+ *
+ * @return true if a frame is due and the previous transfer is finished
+ */
+bool thermal_frame_due(void)
+{
+	if ((g_thermal_img_interval == 0) || (thermal_size != 0))
+	{
+		return false;
+	}
+	thermal_readings++;
+	if (thermal_readings < g_thermal_img_interval)
+	{
+		return false;
+	}
+	thermal_readings = 0;
+	return true;
+}
+
+/**
+ * @brief Encode a frame and prepare the fragments
+ *        Key frames code the difference to the neighbour pixel (serpentine scan),
+ *        other frames the difference to the previous frame
+ *
+ * @param frame pixel temperatures in degrees C, [row][column]
+ */
+void thermal_encode_frame(float frame[8][8])
+{
+	time_t start = micros();
+
+	int16_t quantized[THERMAL_PIXELS];
+	for (uint8_t idx = 0; idx < THERMAL_PIXELS; idx++)
+	{
+		float value = frame[idx / 8][idx % 8] * 4.0;
+		quantized[idx] = (int16_t)(value < 0 ? value - 0.5 : value + 0.5);
+	}
+
+	bool key_frame = thermal_key_needed || ((thermal_frame_num % THERMAL_KEY_INTERVAL) == 0);
+	thermal_key_needed = false;
+
+	// Residuals as zigzag values
+	uint16_t residuals[THERMAL_PIXELS];
+	for (uint8_t idx = 0; idx < THERMAL_PIXELS; idx++)
+	{
+		int16_t residual;
+		if (key_frame)
+		{
+			// Serpentine scan, odd rows right to left
+			uint8_t row = idx / 8;
+			uint8_t pixel = (row & 0x01) ? row * 8 + 7 - idx % 8 : idx;
+			uint8_t prev_idx = idx - 1;
+			uint8_t prev_row = prev_idx / 8;
+			uint8_t prev_pixel = (prev_row & 0x01) ? prev_row * 8 + 7 - prev_idx % 8 : prev_idx;
+			residual = idx == 0 ? 0 : quantized[pixel] - quantized[prev_pixel];
+		}
+		else
+		{
+			residual = quantized[idx] - thermal_last_frame[idx];
+		}
+		residuals[idx] = (uint16_t)((residual << 1) ^ (residual >> 15));
+	}
+
+	// Find the best Rice parameter
+	uint8_t best_k = 0;
+	uint16_t best_bits = 0xFFFF;
+	for (uint8_t k = 0; k <= THERMAL_MAX_K; k++)
+	{
+		uint16_t bits = 0;
+		for (uint8_t idx = 1; idx < THERMAL_PIXELS; idx++)
+		{
+			bits += thermal_rice_bits(residuals[idx], k);
+		}
+		if (key_frame == false)
+		{
+			bits += thermal_rice_bits(residuals[0], k);
+		}
+		if (bits < best_bits)
+		{
+			best_bits = bits;
+			best_k = k;
+		}
+	}
+
+	// Header: bit 7 key frame, bits 0-3 Rice parameter, key frames add the first pixel as int16
+	memset(thermal_buffer, 0, sizeof(thermal_buffer));
+	thermal_bit_pos = 0;
+	thermal_put_bits((key_frame ? 0x80 : 0x00) | best_k, 8);
+	if (key_frame)
+	{
+		thermal_put_bits((uint16_t)quantized[0], 16);
+	}
+	for (uint8_t idx = key_frame ? 1 : 0; idx < THERMAL_PIXELS; idx++)
+	{
+		thermal_put_rice(residuals[idx], best_k);
+	}
+
+	thermal_size = (thermal_bit_pos + 7) >> 3;
+	thermal_num_frags = 0;
+	thermal_next_frag = 0;
+	thermal_retries = 0;
+	// Send after the uplink of this reading
+	thermal_next_time = millis() + THERMAL_FRAG_INTERVAL;
+	memcpy(thermal_last_frame, quantized, sizeof(thermal_last_frame));
+	thermal_frame_num++;
+
+	MYLOG("IR_IMG", "Frame %d %s k=%d, %d bytes, ratio %.1f (raw int16) %.1f (float), %ld us",
+		  thermal_frame_num - 1, key_frame ? "key" : "delta", best_k, thermal_size,
+		  (float)(THERMAL_PIXELS * 2) / thermal_size, (float)(THERMAL_PIXELS * 4) / thermal_size, micros() - start);
+}
+
+/**
+ * @brief Max application payload of the current region and datarate
+ *        AS923 assumes the uplink dwell time limit
+ *
+ * @return uint8_t max payload size in bytes
+ */
+static uint8_t thermal_max_payload(void)
+{
+	uint8_t dr = api.lorawan.dr.get();
+	switch (api.lorawan.band.get())
+	{
+	case 5: // US915
+		return dr == 0 ? 11 : (dr == 1 ? 53 : (dr == 2 ? 125 : 242));
+	case 8: // AS923-1 to AS923-4
+	case 9:
+	case 10:
+	case 11:
+		return dr <= 2 ? 11 : (dr == 3 ? 53 : (dr == 4 ? 125 : 242));
+	default:
+		return dr <= 2 ? 51 : (dr == 3 ? 115 : 222);
+	}
+}
+
+/**
+ * @brief Drop the rest of the frame, the receiver cannot decode delta frames after it
+ *
+ */
+static void thermal_drop_frame(void)
+{
+	thermal_size = 0;
+	thermal_key_needed = true;
+}
+
+/**
+ * @brief Send the next fragment of the encoded frame on THERMAL_FPORT if it is due
+ *        Called from the loop, the fragments are paced by THERMAL_FRAG_INTERVAL.
+ *        A failed send (radio busy, duty cycle) is repeated after THERMAL_RETRY_INTERVAL.
+ *        The fragment size is set from the datarate at the first fragment and kept for the frame.
+ *        Fragment header: frame number, fragment index << 4 | number of fragments
+ *
+ * @return uint32_t ms until the next fragment is due, 0 if nothing to send
+ */
+uint32_t thermal_send_fragment(void)
+{
+	if (thermal_size == 0)
+	{
+		return 0;
+	}
+	if ((int32_t)(thermal_next_time - millis()) > 0)
+	{
+		return thermal_next_time - millis();
+	}
+	if (gnss_active)
+	{
+		// Wait until the location uplink is done
+		return THERMAL_FRAG_INTERVAL;
+	}
+
+	if (thermal_num_frags == 0)
+	{
+		uint8_t max_size = thermal_max_payload() - THERMAL_FRAG_HEADER;
+		thermal_frag_size = max_size < THERMAL_MAX_FRAG_SIZE ? max_size : THERMAL_MAX_FRAG_SIZE;
+		thermal_num_frags = (thermal_size + thermal_frag_size - 1) / thermal_frag_size;
+		if (thermal_num_frags > THERMAL_MAX_FRAGS)
+		{
+			MYLOG("IR_IMG", "Frame needs %d fragments of %d bytes, dropped", thermal_num_frags, thermal_frag_size);
+			thermal_drop_frame();
+			return 0;
+		}
+	}
+
+	uint8_t fragment[THERMAL_MAX_FRAG_SIZE + THERMAL_FRAG_HEADER];
+	uint16_t offset = thermal_next_frag * thermal_frag_size;
+	uint16_t length = thermal_size - offset < thermal_frag_size ? thermal_size - offset : thermal_frag_size;
+	fragment[0] = thermal_frame_num - 1;
+	fragment[1] = (thermal_next_frag << 4) | thermal_num_frags;
+	memcpy(&fragment[THERMAL_FRAG_HEADER], &thermal_buffer[offset], length);
+
+	if (!api.lorawan.send(length + THERMAL_FRAG_HEADER, fragment, THERMAL_FPORT, false, 0))
+	{
+		thermal_retries++;
+		if (thermal_retries >= THERMAL_MAX_RETRIES)
+		{
+			MYLOG("IR_IMG", "Send fragment %d failed %d times, frame dropped", thermal_next_frag, thermal_retries);
+			thermal_drop_frame();
+			return 0;
+		}
+		MYLOG("IR_IMG", "Send fragment %d failed, retry %d", thermal_next_frag, thermal_retries);
+		thermal_next_time = millis() + THERMAL_RETRY_INTERVAL;
+		return THERMAL_RETRY_INTERVAL;
+	}
+	MYLOG("IR_IMG", "Fragment %d/%d enqueued", thermal_next_frag + 1, thermal_num_frags);
+	thermal_retries = 0;
+	thermal_next_frag++;
+	if (thermal_next_frag >= thermal_num_frags)
+	{
+		thermal_size = 0;
+		return 0;
+	}
+	thermal_next_time = millis() + THERMAL_FRAG_INTERVAL;
+	return THERMAL_FRAG_INTERVAL;
+}
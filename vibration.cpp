@@ -0,0 +1,364 @@
+/**
+ * @file vibration.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Vibration analysis of the RAK1904 acceleration stream
+ *        Windowed RMS, peak, crest factor and FFT band levels in fixed point
+ *        Each axis is analysed without its static part (gravity), the results are combined to vector levels
+ * @version 0.1
+ * @date 2022-06-20
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include <arm_acle.h>
+#define VIB_USE_DSP 1
+#endif
+
+/** Window size in samples, must be a power of 2 */
+#define VIB_WINDOW 256
+/** log2 of the window size */
+#define VIB_WINDOW_BITS 8
+/** Input scaling to use more of the Q15 range (4 g * 8 < 32768) */
+#define VIB_INPUT_SHIFT 3
+/** Number of frequency bands */
+#define VIB_NUM_BANDS 4
+
+/** Band edges in Hz, band n is from g_vib_band_edges[n] to g_vib_band_edges[n+1], set with ATC+VIBBAND */
+uint16_t g_vib_band_edges[VIB_NUM_BANDS + 1] = {2, 10, 25, 50, 200};
+
+/** Sample rate for the LIS3DH ODR settings */
+const uint16_t vib_odr_hz[8] = {0, 1, 10, 25, 50, 100, 200, 400};
+
+/** Samples of the current window per axis, acceleration in mg << VIB_INPUT_SHIFT, word aligned for the dual 16 bit MAC */
+int16_t vib_samples[3][VIB_WINDOW] __attribute__((aligned(4)));
+/** FFT buffer, packed complex, real in the low and imaginary in the high half word */
+uint32_t vib_fft[VIB_WINDOW];
+/** Twiddle factors in Q15, packed like the FFT buffer */
+uint32_t vib_twiddle[VIB_WINDOW / 2];
+/** Number of samples in the current window */
+uint16_t vib_fill = 0;
+/** Flag if the twiddle table was calculated */
+bool vib_initialized = false;
+
+/** Results accumulated until the next payload */
+uint32_t vib_rms_sum = 0;
+uint16_t vib_peak_max = 0;
+uint32_t vib_band_sum[VIB_NUM_BANDS];
+uint16_t vib_windows = 0;
+/** Processing time of the last window in us */
+uint32_t vib_window_time = 0;
+
+/**
+ * @brief Integer square root
+ *
+ * @param value input
+ * @return uint32_t floor(sqrt(value))
+ */
+static uint32_t vib_isqrt(uint64_t value)
+{
+	uint64_t result = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+	while (bit != 0)
+	{
+		if (value >= result + bit)
+		{
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+		{
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)result;
+}
+
+/**
+ * @brief Pack real and imaginary part
+ *
+ * @param re real part
+ * @param im imaginary part
+ * @return uint32_t packed complex value
+ */
+static inline uint32_t vib_pack(int32_t re, int32_t im)
+{
+	return ((uint32_t)(uint16_t)re) | ((uint32_t)(uint16_t)im << 16);
+}
+
+/**
+ * @brief Multiply a packed complex value with a packed Q15 twiddle factor
+ *
+ * @param x complex value
+ * @param w twiddle factor
+ * @return uint32_t product
+ */
+static inline uint32_t vib_cmul(uint32_t x, uint32_t w)
+{
+#ifdef VIB_USE_DSP
+	// re = xr * wr - xi * wi, im = xr * wi + xi * wr
+	int32_t re = __smusd((int32_t)x, (int32_t)w) >> 15;
+	int32_t im = __smuadx((int32_t)x, (int32_t)w) >> 15;
+#else
+	int32_t xr = (int16_t)(x & 0xFFFF);
+	int32_t xi = (int16_t)(x >> 16);
+	int32_t wr = (int16_t)(w & 0xFFFF);
+	int32_t wi = (int16_t)(w >> 16);
+	int32_t re = (xr * wr - xi * wi) >> 15;
+	int32_t im = (xr * wi + xi * wr) >> 15;
+#endif
+	return vib_pack(re, im);
+}
+
+/**
+ * @brief Butterfly with scaling by 1/2 to avoid overflow
+ *
+ * @param a first value, gets (a + b) / 2
+ * @param b second value, gets (a - b) / 2
+ */
+static inline void vib_butterfly(uint32_t *a, uint32_t *b)
+{
+#ifdef VIB_USE_DSP
+	// Halving add and subtract on both half words
+	uint32_t sum = (uint32_t)__shadd16((int32_t)*a, (int32_t)*b);
+	uint32_t diff = (uint32_t)__shsub16((int32_t)*a, (int32_t)*b);
+	*a = sum;
+	*b = diff;
+#else
+	int32_t ar = (int16_t)(*a & 0xFFFF);
+	int32_t ai = (int16_t)(*a >> 16);
+	int32_t br = (int16_t)(*b & 0xFFFF);
+	int32_t bi = (int16_t)(*b >> 16);
+	*a = vib_pack((ar + br) >> 1, (ai + bi) >> 1);
+	*b = vib_pack((ar - br) >> 1, (ai - bi) >> 1);
+#endif
+}
+
+/**
+ * @brief Radix-2 decimation in frequency FFT, scaled by 1/N
+ *        Output is in bit reversed order
+ *
+ */
+static void vib_run_fft(void)
+{
+	for (uint16_t span = VIB_WINDOW / 2, tw_step = 1; span > 0; span >>= 1, tw_step <<= 1)
+	{
+		for (uint16_t start = 0; start < VIB_WINDOW; start += 2 * span)
+		{
+			for (uint16_t idx = 0; idx < span; idx++)
+			{
+				uint32_t *a = &vib_fft[start + idx];
+				uint32_t *b = &vib_fft[start + idx + span];
+				vib_butterfly(a, b);
+				if (idx != 0)
+				{
+					*b = vib_cmul(*b, vib_twiddle[idx * tw_step]);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Reverse the bits of a FFT bin index
+ *
+ * @param idx index
+ * @return uint16_t bit reversed index
+ */
+static uint16_t vib_bit_reverse(uint16_t idx)
+{
+	uint16_t result = 0;
+	for (uint8_t bit = 0; bit < VIB_WINDOW_BITS; bit++)
+	{
+		result = (result << 1) | (idx & 0x01);
+		idx >>= 1;
+	}
+	return result;
+}
+
+/**
+ * @brief Calculate the twiddle factors
+ *
+ */
+static void vib_init(void)
+{
+	for (uint16_t idx = 0; idx < VIB_WINDOW / 2; idx++)
+	{
+		float angle = -2.0 * PI * idx / VIB_WINDOW;
+		vib_twiddle[idx] = vib_pack((int32_t)(cosf(angle) * 32767), (int32_t)(sinf(angle) * 32767));
+	}
+	vib_initialized = true;
+}
+
+/**
+ * @brief Calculate the features of a full window
+ *        Every axis gets its own FFT, RMS and band energies are summed over the axes.
+ *        The peak is the largest length of the dynamic acceleration vector.
+ *
+ */
+static void vib_process_window(void)
+{
+	time_t start = micros();
+
+	// FFT bins of the bands, bins are Hz * N / fs
+	uint16_t sample_rate = vib_odr_hz[g_acc_stream_odr];
+	uint16_t band_bins[VIB_NUM_BANDS + 1];
+	for (uint8_t edge = 0; edge <= VIB_NUM_BANDS; edge++)
+	{
+		uint32_t bin = ((uint32_t)g_vib_band_edges[edge] * VIB_WINDOW) / sample_rate;
+		band_bins[edge] = bin == 0 ? 1 : (bin > VIB_WINDOW / 2 ? VIB_WINDOW / 2 : bin);
+	}
+
+	uint64_t square_sum = 0;
+	uint64_t band_energy[VIB_NUM_BANDS] = {0};
+	for (uint8_t axis = 0; axis < 3; axis++)
+	{
+		int16_t *samples = vib_samples[axis];
+
+		// Remove the static part (gravity) of this axis
+		int32_t mean = 0;
+		for (uint16_t idx = 0; idx < VIB_WINDOW; idx++)
+		{
+			mean += samples[idx];
+		}
+		mean >>= VIB_WINDOW_BITS;
+
+		for (uint16_t idx = 0; idx < VIB_WINDOW; idx++)
+		{
+			int32_t value = samples[idx] - mean;
+			value = value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+			samples[idx] = value;
+			vib_fft[idx] = vib_pack(value, 0);
+		}
+
+		// Sum of squares, two samples per instruction on the M4
+#ifdef VIB_USE_DSP
+		const int32_t *pairs = (const int32_t *)samples;
+		for (uint16_t idx = 0; idx < VIB_WINDOW / 2; idx++)
+		{
+			square_sum = __smlald(pairs[idx], pairs[idx], square_sum);
+		}
+#else
+		for (uint16_t idx = 0; idx < VIB_WINDOW; idx++)
+		{
+			square_sum += (int32_t)samples[idx] * samples[idx];
+		}
+#endif
+
+		vib_run_fft();
+
+		for (uint8_t band = 0; band < VIB_NUM_BANDS; band++)
+		{
+			for (uint16_t bin = band_bins[band]; bin < band_bins[band + 1]; bin++)
+			{
+				uint32_t value = vib_fft[vib_bit_reverse(bin)];
+				int32_t re = (int16_t)(value & 0xFFFF);
+				int32_t im = (int16_t)(value >> 16);
+				band_energy[band] += (uint32_t)(re * re) + (uint32_t)(im * im);
+			}
+		}
+	}
+
+	// Peak of the dynamic acceleration vector
+	uint64_t peak_square = 0;
+	for (uint16_t idx = 0; idx < VIB_WINDOW; idx++)
+	{
+		uint64_t square = 0;
+		for (uint8_t axis = 0; axis < 3; axis++)
+		{
+			square += (uint32_t)((int32_t)vib_samples[axis][idx] * vib_samples[axis][idx]);
+		}
+		if (square > peak_square)
+		{
+			peak_square = square;
+		}
+	}
+	uint32_t peak = vib_isqrt(peak_square) >> VIB_INPUT_SHIFT;
+	uint32_t rms = vib_isqrt(square_sum >> VIB_WINDOW_BITS);
+
+	for (uint8_t band = 0; band < VIB_NUM_BANDS; band++)
+	{
+		// Single sided spectrum of the 1/N scaled FFT, band RMS = sqrt(2 * sum |X|^2)
+		vib_band_sum[band] += vib_isqrt(band_energy[band] * 2) >> VIB_INPUT_SHIFT;
+	}
+
+	vib_rms_sum += rms >> VIB_INPUT_SHIFT;
+	if (peak > vib_peak_max)
+	{
+		vib_peak_max = peak > 65535 ? 65535 : peak;
+	}
+	vib_windows++;
+
+	vib_window_time = micros() - start;
+}
+
+/**
+ * @brief Take all samples from the RAK1904 ring buffer
+ *        and process each complete window
+ *        Called from the loop and the sensor handler, never from the interrupt
+ *
+ */
+void vib_process(void)
+{
+	if (g_acc_stream_odr == 0)
+	{
+		return;
+	}
+	if (!vib_initialized)
+	{
+		vib_init();
+	}
+
+	int16_t xyz[3];
+	while (rak1904_stream_get(xyz))
+	{
+		for (uint8_t axis = 0; axis < 3; axis++)
+		{
+			int32_t value = (int32_t)xyz[axis] << VIB_INPUT_SHIFT;
+			vib_samples[axis][vib_fill] = value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+		}
+		vib_fill++;
+		if (vib_fill == VIB_WINDOW)
+		{
+			vib_process_window();
+			vib_fill = 0;
+		}
+	}
+}
+
+/**
+ * @brief Add the vibration features to the payload
+ *        Averages of RMS and band levels and the max peak
+ *        since the last payload
+ *
+ */
+void vib_add_payload(void)
+{
+	if (vib_windows == 0)
+	{
+		MYLOG("VIB", "No complete window");
+		return;
+	}
+
+	uint16_t rms = vib_rms_sum / vib_windows;
+	g_solution_data.addVibration(LPP_CHANNEL_VIB_RMS, rms);
+	g_solution_data.addVibration(LPP_CHANNEL_VIB_PEAK, vib_peak_max);
+	g_solution_data.addAnalogInput(LPP_CHANNEL_VIB_CREST, rms == 0 ? 0.0 : (float)vib_peak_max / (float)rms);
+	for (uint8_t band = 0; band < VIB_NUM_BANDS; band++)
+	{
+		g_solution_data.addVibration(LPP_CHANNEL_VIB_BAND_1 + band, vib_band_sum[band] / vib_windows);
+	}
+	MYLOG("VIB", "%d windows, RMS %d mg, peak %d mg, %ld us per window", vib_windows, rms, vib_peak_max, vib_window_time);
+
+	vib_rms_sum = 0;
+	vib_peak_max = 0;
+	memset(vib_band_sum, 0, sizeof(vib_band_sum));
+	vib_windows = 0;
+}
@@ -276,4 +276,21 @@ uint8_t WisCayenne::addVoc_index(uint8_t channel, uint32_t voc_index)
 	_buffer[_cursor++] = voc_union.val8[0];
 
 	return _cursor;
-}
\ No newline at end of file
+}
+
+uint8_t WisCayenne::addVibration(uint8_t channel, uint16_t vibration)
+{
+	// check buffer overflow
+	if ((_cursor + LPP_VIBRATION_SIZE + 2) > _maxsize)
+	{
+		_error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_VIBRATION;
+
+	_buffer[_cursor++] = (uint8_t)(vibration >> 8);
+	_buffer[_cursor++] = (uint8_t)(vibration & 0xFF);
+
+	return _cursor;
+}
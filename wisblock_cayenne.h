@@ -18,6 +18,7 @@
 #define LPP_GPS4 136 // 3 byte lon/lat 0.0001 °, 3 bytes alt 0.01 meter (Cayenne LPP default)
 #define LPP_GPS6 137 // 4 byte lon/lat 0.000001 °, 3 bytes alt 0.01 meter (Customized Cayenne LPP, higher precision)
 #define LPP_VOC 138	 // 2 byte VOC index
+#define LPP_VIBRATION 139 // 2 byte vibration level in mg
 
 // Only Data Size
 #define LPP_GPS4_SIZE 9
@@ -25,6 +26,7 @@
 #define LPP_GPSH_SIZE 14
 #define LPP_GPST_SIZE 10
 #define LPP_VOC_SIZE 2
+#define LPP_VIBRATION_SIZE 2
 
 class WisCayenne : public CayenneLPP
 {
@@ -36,6 +38,7 @@ public:
 	uint8_t addGNSS_H(uint32_t latitude, uint32_t longitude, uint16_t altitude, uint16_t accuracy, uint16_t battery);
 	uint8_t addGNSS_T(int32_t latitude, int32_t longitude, int16_t altitude, int16_t accuracy, int8_t sats);
 	uint8_t addVoc_index(uint8_t channel, uint32_t voc_index);
+	uint8_t addVibration(uint8_t channel, uint16_t vibration);
 
 private:
 };